@@ -0,0 +1,253 @@
+/*
+ *      album.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "album.h"
+#include "string-pool.h"
+#include "art-cache.h"
+
+struct _Artist {
+    gint ref;
+
+    const gchar *name;
+    guint num_entries;
+
+    // Album name (pooled pointer) -> Album
+    GHashTable *albums;
+};
+
+struct _Album {
+    gint ref;
+
+    const gchar *name;
+    Artist *artist;
+
+    gint year;
+    const gchar *genre;
+    gchar *art;
+    guint art_serial;
+
+    guint num_entries;
+};
+
+Artist*
+_artist_new (const gchar *name)
+{
+    Artist *self = g_new0 (Artist, 1);
+
+    self->ref = 1;
+    self->name = string_pool_ref (name);
+    self->albums = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) album_unref);
+
+    return self;
+}
+
+Artist*
+artist_ref (Artist *self)
+{
+    g_atomic_int_inc (&self->ref);
+
+    return self;
+}
+
+static void
+artist_detach_album (gpointer key, Album *album, Artist *self)
+{
+    album->artist = NULL;
+}
+
+void
+artist_unref (Artist *self)
+{
+    if (!g_atomic_int_dec_and_test (&self->ref)) {
+        return;
+    }
+
+    g_hash_table_foreach (self->albums, (GHFunc) artist_detach_album, self);
+    g_hash_table_unref (self->albums);
+    string_pool_unref (self->name);
+
+    g_free (self);
+}
+
+const gchar*
+artist_get_name (Artist *self)
+{
+    return self->name;
+}
+
+guint
+artist_get_num_entries (Artist *self)
+{
+    return self->num_entries;
+}
+
+Album**
+artist_get_albums (Artist *self)
+{
+    Album **albums = g_new0 (Album*, g_hash_table_size (self->albums) + 1);
+    GHashTableIter iter;
+    Album *album;
+    gint i = 0;
+
+    g_hash_table_iter_init (&iter, self->albums);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &album)) {
+        albums[i++] = album;
+    }
+
+    return albums;
+}
+
+Album*
+_artist_get_album (Artist *self, const gchar *name)
+{
+    return g_hash_table_lookup (self->albums, name);
+}
+
+Album*
+_artist_add_album (Artist *self, const gchar *name)
+{
+    Album *album = g_new0 (Album, 1);
+
+    album->ref = 1;
+    album->name = string_pool_ref (name);
+    album->artist = self;
+
+    g_hash_table_insert (self->albums, (gpointer) album->name, album);
+
+    return album;
+}
+
+void
+_artist_remove_album (Artist *self, Album *album)
+{
+    self->num_entries -= album->num_entries;
+    album->artist = NULL;
+
+    g_hash_table_remove (self->albums, album->name);
+}
+
+Album*
+album_ref (Album *self)
+{
+    g_atomic_int_inc (&self->ref);
+
+    return self;
+}
+
+void
+album_unref (Album *self)
+{
+    if (!g_atomic_int_dec_and_test (&self->ref)) {
+        return;
+    }
+
+    string_pool_unref (self->name);
+    string_pool_unref (self->genre);
+    g_free (self->art);
+
+    g_free (self);
+}
+
+const gchar*
+album_get_name (Album *self)
+{
+    return self->name;
+}
+
+Artist*
+album_get_artist (Album *self)
+{
+    return self->artist;
+}
+
+gint
+album_get_year (Album *self)
+{
+    return self->year;
+}
+
+const gchar*
+album_get_genre (Album *self)
+{
+    return self->genre;
+}
+
+const gchar*
+album_get_art (Album *self)
+{
+    // Forget the artwork once the art cache has seen a change on disk
+    if (self->art && self->art_serial != art_cache_get_serial ()) {
+        g_free (self->art);
+        self->art = NULL;
+    }
+
+    return self->art;
+}
+
+guint
+album_get_num_entries (Album *self)
+{
+    return self->num_entries;
+}
+
+void
+_album_add_entry (Album *self)
+{
+    self->num_entries++;
+
+    if (self->artist) {
+        self->artist->num_entries++;
+    }
+}
+
+void
+_album_remove_entry (Album *self)
+{
+    self->num_entries--;
+
+    if (self->artist) {
+        self->artist->num_entries--;
+    }
+}
+
+void
+_album_set_year (Album *self, gint year)
+{
+    self->year = year;
+}
+
+void
+_album_set_genre (Album *self, const gchar *genre)
+{
+    const gchar *old = self->genre;
+
+    self->genre = string_pool_ref (genre);
+    string_pool_unref (old);
+}
+
+void
+_album_set_art (Album *self, const gchar *art)
+{
+    g_free (self->art);
+    self->art = g_strdup (art);
+    self->art_serial = art_cache_get_serial ();
+}
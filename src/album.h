@@ -0,0 +1,65 @@
+/*
+ *      album.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __ALBUM_H__
+#define __ALBUM_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// Album and Artist records are shared by every Entry of the same album and
+// artist. Names are string pool references, so they compare by pointer.
+typedef struct _Album Album;
+typedef struct _Artist Artist;
+
+Artist *artist_ref (Artist *self);
+void artist_unref (Artist *self);
+
+const gchar *artist_get_name (Artist *self);
+guint artist_get_num_entries (Artist *self);
+Album **artist_get_albums (Artist *self);
+
+Album *album_ref (Album *self);
+void album_unref (Album *self);
+
+const gchar *album_get_name (Album *self);
+Artist *album_get_artist (Album *self);
+gint album_get_year (Album *self);
+const gchar *album_get_genre (Album *self);
+const gchar *album_get_art (Album *self);
+guint album_get_num_entries (Album *self);
+
+// These functions should only be used inside the MediaStore object
+Artist *_artist_new (const gchar *name);
+Album  *_artist_get_album (Artist *self, const gchar *name);
+Album  *_artist_add_album (Artist *self, const gchar *name);
+void    _artist_remove_album (Artist *self, Album *album);
+
+void    _album_add_entry (Album *self);
+void    _album_remove_entry (Album *self);
+void    _album_set_year (Album *self, gint year);
+void    _album_set_genre (Album *self, const gchar *genre);
+void    _album_set_art (Album *self, const gchar *art);
+
+G_END_DECLS
+
+#endif /* __ALBUM_H__ */
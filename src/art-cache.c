@@ -0,0 +1,173 @@
+/*
+ *      art-cache.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "art-cache.h"
+
+// The directory mtime changes whenever a file is added, removed or renamed in
+// it, so a scan stays good for as long as the mtime does
+typedef struct {
+    gchar *art;
+    gint64 mtime;
+} ArtDir;
+
+// Directory path -> ArtDir, an ArtDir with no art remembers a miss
+static GHashTable *dirs = NULL;
+
+// Bumped whenever a directory is found changed so callers holding on to a
+// resolved path (like Album) know to ask again
+static guint serial = 0;
+
+G_LOCK_DEFINE_STATIC (dirs);
+
+static void
+art_dir_free (ArtDir *ad)
+{
+    g_free (ad->art);
+    g_free (ad);
+}
+
+static gint
+art_cache_score (const gchar *file)
+{
+    gchar *name = g_ascii_strdown (file, -1);
+    gchar *ext = strrchr (name, '.');
+    gint score = 0;
+
+    if (ext && (!strcmp (ext, ".jpg") || !strcmp (ext, ".jpeg") ||
+                !strcmp (ext, ".png") || !strcmp (ext, ".bmp"))) {
+        *ext = '\0';
+
+        if (!strcmp (name, "cover")) {
+            score = 6;
+        } else if (!strcmp (name, "folder")) {
+            score = 5;
+        } else if (!strcmp (name, "front")) {
+            score = 4;
+        } else if (strstr (name, "cover")) {
+            score = 3;
+        } else if (strstr (name, "front")) {
+            score = 2;
+        } else {
+            score = 1;
+        }
+    }
+
+    g_free (name);
+
+    return score;
+}
+
+static gchar*
+art_cache_scan (const gchar *path)
+{
+    GDir *dir = g_dir_open (path, 0, NULL);
+    const gchar *file;
+    gchar *best = NULL;
+    gint score, best_score = 0;
+
+    while (dir && (file = g_dir_read_name (dir))) {
+        score = art_cache_score (file);
+
+        // Ties go to the lowest name so the result does not depend on readdir order
+        if (score > best_score ||
+            (score && score == best_score && strcmp (file, best) < 0)) {
+            g_free (best);
+            best = g_strdup (file);
+            best_score = score;
+        }
+    }
+
+    if (dir) {
+        g_dir_close (dir);
+    }
+
+    if (best) {
+        gchar *ret = g_build_filename (path, best, NULL);
+        g_free (best);
+        return ret;
+    }
+
+    return NULL;
+}
+
+// Returns the artwork for the directory holding location, or NULL
+gchar*
+art_cache_lookup (const gchar *location)
+{
+    gchar *path, *ret;
+    gboolean known;
+    struct stat st;
+    gint64 mtime;
+    ArtDir *ad;
+
+    if (!location) {
+        return NULL;
+    }
+
+    path = g_path_get_dirname (location);
+    mtime = g_stat (path, &st) == 0 ? (gint64) st.st_mtime : -1;
+
+    G_LOCK (dirs);
+
+    if (!dirs) {
+        dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) art_dir_free);
+    }
+
+    ad = g_hash_table_lookup (dirs, path);
+    if (ad && ad->mtime == mtime) {
+        ret = g_strdup (ad->art);
+        G_UNLOCK (dirs);
+
+        g_free (path);
+        return ret;
+    }
+
+    known = ad != NULL;
+
+    G_UNLOCK (dirs);
+
+    ad = g_new0 (ArtDir, 1);
+    ad->art = art_cache_scan (path);
+    ad->mtime = mtime;
+
+    ret = g_strdup (ad->art);
+
+    G_LOCK (dirs);
+
+    g_hash_table_replace (dirs, path, ad);
+    if (known) {
+        serial++;
+    }
+
+    G_UNLOCK (dirs);
+
+    return ret;
+}
+
+guint
+art_cache_get_serial (void)
+{
+    return serial;
+}
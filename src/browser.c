@@ -29,6 +29,10 @@
 #include "track-source.h"
 
 #include "tag-dialog.h"
+#include "string-pool.h"
+
+// Added batches at least this large are merged instead of inserted one by one
+#define BROWSER_MERGE_MIN 32
 
 static void track_source_init (TrackSourceInterface *iface);
 G_DEFINE_TYPE_WITH_CODE (Browser, browser, GTK_TYPE_VPANED,
@@ -39,7 +43,7 @@ struct _BrowserPrivate {
     Shell *shell;
 
     MediaStore *store;
-    gulong ss_add, ss_remove;
+    gulong ss_add, ss_remove, ss_update;
 
     GtkWidget *pane1;
     GtkWidget *sw1;
@@ -49,6 +53,7 @@ struct _BrowserPrivate {
 
     GtkWidget *pane3;
     GtkWidget *sw3;
+    GtkWidget *search;
     GtkWidget *top_box;
 
     GtkTreeSelection *p3_sel;
@@ -58,10 +63,26 @@ struct _BrowserPrivate {
     GtkListStore *p3_store;
     GtkTreeModel *p3_filter;
 
-    gchar *s_p1;
-    gchar *s_p2;
+    // Entry -> GtkTreeIter of its row in p3_store
+    GHashTable *rows;
+
+    const gchar *s_p1;
+    const gchar *s_p2;
+    gboolean p1_pooled, p2_pooled;
+
+    // Selection the visible column of p3_store currently reflects
+    const gchar *vis_p1, *vis_p2;
+    gboolean vis_valid;
     Entry *s_entry;
 
+    // Entries matching the search box, NULL when everything matches
+    GHashTable *hits;
+
+    // Store the panes still hold after browser_set_model (self, NULL), and
+    // its sequence number at the time
+    MediaStore *detached;
+    guint64 seq;
+
     gint num_p1, num_p2;
 
     EntryCompareFunc cmp_func;
@@ -73,7 +94,7 @@ struct _BrowserPrivate {
 
 static gboolean browser_insert_iter (GtkListStore *store, GtkTreeIter *iter,
     gpointer ne, EntryCompareFunc cmp, gint l, gboolean create, GDestroyNotify destroy);
-static void entry_changed (Browser *self, Entry *entry);
+static void on_entries_state (Entry **entries, guint len, Browser *self);
 
 static gint browser_default_cmp_func (Entry *e1, Entry *e2);
 static void num_column_func (GtkTreeViewColumn *column, GtkCellRenderer *cell,
@@ -82,6 +103,9 @@ static void num_column_func (GtkTreeViewColumn *column, GtkCellRenderer *cell,
 static void browser_set_pane_visibility (Browser *self);
 static void browser_populate_pane1 (Browser *self);
 static void browser_populate_pane2 (Browser *self);
+static void browser_set_vis_selection (Browser *self);
+static void browser_search_refresh (Browser *self);
+static void on_search_changed (Browser *self, GtkEditable *editable);
 static void browser_populate_pane3 (Browser *self);
 static void browser_update_pane3 (Browser *self);
 
@@ -112,8 +136,58 @@ static Entry *browser_get_next (TrackSource *self);
 static Entry *browser_get_prev (TrackSource *self);
 
 // Signals from media-store
-static void on_store_add (Browser *self, Entry *entry, MediaStore *ms);
-static void on_store_remove (Browser *self, Entry *entry, MediaStore *ms);
+static void on_entries_added (Browser *self, guint len, Entry **entries, MediaStore *ms);
+static void on_entries_removed (Browser *self, guint len, Entry **entries, MediaStore *ms);
+static void on_entry_update (Browser *self, Entry *entry, gchar **changes, MediaStore *ms);
+static void browser_panes_remove (Browser *self, const gchar *pane1, const gchar *pane2,
+    gboolean *last_p1, gboolean *last_p2);
+static void browser_reselect (Browser *self, gboolean last_p1, gboolean last_p2);
+static gboolean browser_catch_up (Browser *self, MediaStore *store);
+
+// Changes collected while catching up with a store
+typedef struct {
+    Browser *self;
+    GPtrArray *added;
+    gboolean last_p1, last_p2;
+} BrowserDelta;
+
+static inline void
+browser_set_row (Browser *self, Entry *entry, GtkTreeIter *iter)
+{
+    g_hash_table_insert (self->priv->rows, entry, gtk_tree_iter_copy (iter));
+}
+
+static inline gboolean
+browser_tag_equal (gboolean pooled, const gchar *s1, const gchar *s2)
+{
+    return pooled ? s1 == s2 : !g_strcmp0 (s1, s2);
+}
+
+static inline gboolean
+browser_search_match (Browser *self, Entry *entry)
+{
+    return !self->priv->hits || g_hash_table_lookup (self->priv->hits, entry);
+}
+
+// Whether an entry belongs in the track list with the current pane selection
+// and search
+static gboolean
+browser_entry_visible (Browser *self, Entry *entry)
+{
+    if (self->priv->p1_tag && self->priv->s_p1 &&
+        !browser_tag_equal (self->priv->p1_pooled, self->priv->s_p1,
+            entry_get_tag_str (entry, self->priv->p1_tag))) {
+        return FALSE;
+    }
+
+    if (self->priv->p2_tag && self->priv->s_p2 &&
+        !browser_tag_equal (self->priv->p2_pooled, self->priv->s_p2,
+            entry_get_tag_str (entry, self->priv->p2_tag))) {
+        return FALSE;
+    }
+
+    return browser_search_match (self, entry);
+}
 
 static void
 track_source_init (TrackSourceInterface *iface)
@@ -128,9 +202,37 @@ browser_finalize (GObject *object)
     Browser *self = BROWSER (object);
 
     //TODO: Free memory
+    entry_remove_states_func ((EntryStatesFunc) on_entries_state, self);
+
+    if (self->priv->rows) {
+        g_hash_table_unref (self->priv->rows);
+        self->priv->rows = NULL;
+    }
+
+    if (self->priv->hits) {
+        g_hash_table_unref (self->priv->hits);
+        self->priv->hits = NULL;
+    }
+
+    if (self->priv->detached) {
+        g_object_unref (self->priv->detached);
+        self->priv->detached = NULL;
+    }
+
+    if (self->priv->vis_p1) {
+        string_pool_unref (self->priv->vis_p1);
+        self->priv->vis_p1 = NULL;
+    }
+
+    if (self->priv->vis_p2) {
+        string_pool_unref (self->priv->vis_p2);
+        self->priv->vis_p2 = NULL;
+    }
+
     if (self->priv->store) {
         g_signal_handler_disconnect (self->priv->store, self->priv->ss_add);
         g_signal_handler_disconnect (self->priv->store, self->priv->ss_remove);
+        g_signal_handler_disconnect (self->priv->store, self->priv->ss_update);
 
         g_object_unref (self->priv->store);
         self->priv->store = NULL;
@@ -166,6 +268,11 @@ browser_init (Browser *self)
     self->priv->cmp_func = browser_default_cmp_func;
     self->priv->ss_add = -1;
     self->priv->ss_remove = -1;
+    self->priv->ss_update = -1;
+
+    self->priv->rows = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) gtk_tree_iter_free);
+    entry_add_states_func ((EntryStatesFunc) on_entries_state, self);
 
     // Build UI
     self->priv->top_box = gtk_hbox_new (TRUE, 5);
@@ -187,15 +294,24 @@ browser_init (Browser *self)
 
     gtk_paned_add1 (GTK_PANED (self), self->priv->top_box);
 
+    GtkWidget *bottom_box = gtk_vbox_new (FALSE, 5);
+    GtkWidget *search_box = gtk_hbox_new (FALSE, 5);
+
+    self->priv->search = gtk_entry_new ();
+    gtk_box_pack_end (GTK_BOX (search_box), self->priv->search, FALSE, FALSE, 0);
+    gtk_box_pack_end (GTK_BOX (search_box), gtk_label_new ("Search:"), FALSE, FALSE, 0);
+    gtk_box_pack_start (GTK_BOX (bottom_box), search_box, FALSE, FALSE, 0);
+
     self->priv->sw3 = gtk_scrolled_window_new (NULL, NULL);
     gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (self->priv->sw3),
         GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
     self->priv->pane3 = gtk_tree_view_new ();
     gtk_container_add (GTK_CONTAINER (self->priv->sw3), self->priv->pane3);
+    gtk_box_pack_start (GTK_BOX (bottom_box), self->priv->sw3, TRUE, TRUE, 0);
 
-    gtk_paned_add2 (GTK_PANED (self), self->priv->sw3);
+    gtk_paned_add2 (GTK_PANED (self), bottom_box);
 
-    gtk_widget_show_all (self->priv->sw3);
+    gtk_widget_show_all (bottom_box);
 
     // Create Internal GtkListStores
     self->priv->p1_store = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_UINT);
@@ -235,6 +351,9 @@ browser_init (Browser *self)
     g_signal_connect_swapped (self->priv->pane3, "button-press-event",
         G_CALLBACK (on_pane3_click), self);
 
+    g_signal_connect_swapped (self->priv->search, "changed",
+        G_CALLBACK (on_search_changed), self);
+
     // Setup main widget as a drag destination for filenames
     GtkTargetEntry dest_te = { "text/uri-list", 0, 1 };
     gtk_drag_dest_set (GTK_WIDGET (self), GTK_DEST_DEFAULT_ALL, &dest_te, 1,
@@ -269,35 +388,148 @@ browser_set_model (Browser *self, MediaStore *store)
     if (self->priv->store) {
         g_signal_handler_disconnect (self->priv->store, self->priv->ss_add);
         g_signal_handler_disconnect (self->priv->store, self->priv->ss_remove);
+        g_signal_handler_disconnect (self->priv->store, self->priv->ss_update);
+
+        // Keep the panes around in case the same store comes back
+        if (!store) {
+            self->priv->detached = g_object_ref (self->priv->store);
+            self->priv->seq = media_store_get_sequence (self->priv->store);
+        }
 
         g_object_unref (self->priv->store);
         self->priv->store = NULL;
     }
 
+    if (self->priv->detached && store) {
+        gboolean same = self->priv->detached == store;
+
+        g_object_unref (self->priv->detached);
+        self->priv->detached = NULL;
+
+        if (same && browser_catch_up (self, store)) {
+            return;
+        }
+    }
+
     if (store) {
         self->priv->store = g_object_ref (store);
 
         self->priv->ss_add = g_signal_connect_data (self->priv->store,
-            "add-entry", G_CALLBACK (on_store_add), self,
+            "entries-added", G_CALLBACK (on_entries_added), self,
             NULL, G_CONNECT_SWAPPED);
 
         self->priv->ss_remove = g_signal_connect_data (self->priv->store,
-            "remove-entry", G_CALLBACK (on_store_remove), self,
+            "entries-removed", G_CALLBACK (on_entries_removed), self,
+            NULL, G_CONNECT_SWAPPED);
+
+        self->priv->ss_update = g_signal_connect_data (self->priv->store,
+            "update-entry", G_CALLBACK (on_entry_update), self,
             NULL, G_CONNECT_SWAPPED);
     }
 
     if (!store) {
-        gtk_list_store_clear (self->priv->p1_store);
-        gtk_list_store_clear (self->priv->p2_store);
-        gtk_list_store_clear (self->priv->p3_store);
+        gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane1), NULL);
+        gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane2), NULL);
+        gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane3), NULL);
         return;
     }
 
+    gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane1),
+        GTK_TREE_MODEL (self->priv->p1_store));
+
     browser_populate_pane1 (self);
     browser_populate_pane2 (self);
     browser_populate_pane3 (self);
 }
 
+static void
+browser_apply_change (Entry *entry, MediaStoreChangeType type, gchar **changes,
+    BrowserDelta *delta)
+{
+    Browser *self = delta->self;
+    const gchar *old1, *old2;
+    GtkTreeIter *row;
+    gint i;
+
+    switch (type) {
+    case MEDIA_STORE_ADDED:
+        g_ptr_array_add (delta->added, entry);
+        break;
+    case MEDIA_STORE_UPDATED:
+        on_entry_update (self, entry, changes, self->priv->store);
+        break;
+    case MEDIA_STORE_REMOVED:
+        if (!(row = g_hash_table_lookup (self->priv->rows, entry))) {
+            break;
+        }
+
+        // The panes counted the entry under the values it had back then
+        old1 = entry_get_tag_str (entry, self->priv->p1_tag);
+        old2 = entry_get_tag_str (entry, self->priv->p2_tag);
+
+        for (i = 0; changes[i]; i += 2) {
+            if (!g_strcmp0 (changes[i], self->priv->p1_tag)) {
+                old1 = changes[i + 1];
+            } else if (!g_strcmp0 (changes[i], self->priv->p2_tag)) {
+                old2 = changes[i + 1];
+            }
+        }
+
+        browser_panes_remove (self, old1, old2, &delta->last_p1, &delta->last_p2);
+
+        gtk_list_store_remove (self->priv->p3_store, row);
+        g_hash_table_remove (self->priv->rows, entry);
+        break;
+    }
+}
+
+/*
+ * Brings the panes kept from the last time store was shown up to date by
+ * applying only what changed since. Returns FALSE when the store no longer
+ * remembers that far back, the panes then have to be rebuilt.
+ */
+static gboolean
+browser_catch_up (Browser *self, MediaStore *store)
+{
+    BrowserDelta delta = { self, NULL, FALSE, FALSE };
+
+    self->priv->store = g_object_ref (store);
+    delta.added = g_ptr_array_new ();
+
+    if (!media_store_get_changes (store, self->priv->seq,
+            (MediaStoreChangeFunc) browser_apply_change, &delta)) {
+        g_ptr_array_free (delta.added, TRUE);
+
+        g_object_unref (self->priv->store);
+        self->priv->store = NULL;
+
+        return FALSE;
+    }
+
+    on_entries_added (self, delta.added->len, (Entry**) delta.added->pdata, store);
+    g_ptr_array_free (delta.added, TRUE);
+
+    browser_reselect (self, delta.last_p1, delta.last_p2);
+
+    self->priv->ss_add = g_signal_connect_data (store,
+        "entries-added", G_CALLBACK (on_entries_added), self,
+        NULL, G_CONNECT_SWAPPED);
+    self->priv->ss_remove = g_signal_connect_data (store,
+        "entries-removed", G_CALLBACK (on_entries_removed), self,
+        NULL, G_CONNECT_SWAPPED);
+    self->priv->ss_update = g_signal_connect_data (store,
+        "update-entry", G_CALLBACK (on_entry_update), self,
+        NULL, G_CONNECT_SWAPPED);
+
+    gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane1),
+        GTK_TREE_MODEL (self->priv->p1_store));
+    gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane2),
+        GTK_TREE_MODEL (self->priv->p2_store));
+    gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane3), self->priv->p3_filter);
+
+    return TRUE;
+}
+
 MediaStore*
 browser_get_model (Browser *self)
 {
@@ -315,6 +547,7 @@ browser_set_pane1_tag (Browser *self,
     if (self->priv->p1_tag) {
         g_free (self->priv->p1_tag);
         self->priv->p1_tag = NULL;
+        self->priv->vis_valid = FALSE;
 
         g_free (self->priv->p1_label);
         self->priv->p1_label = NULL;
@@ -323,6 +556,7 @@ browser_set_pane1_tag (Browser *self,
     if (tag) {
         self->priv->p1_tag = g_strdup (tag);
         self->priv->p1_label = g_strdup (label);
+        self->priv->p1_pooled = entry_tag_is_pooled (tag);
 
         if (column = gtk_tree_view_get_column (GTK_TREE_VIEW (self->priv->pane1), 0)) {
             gtk_tree_view_column_set_title (column, label);
@@ -345,7 +579,7 @@ browser_set_pane1_tag (Browser *self,
         }
 
         if (self->priv->s_p1) {
-            g_free (self->priv->s_p1);
+            string_pool_unref (self->priv->s_p1);
             self->priv->s_p1 = NULL;
 
             browser_populate_pane2 (self);
@@ -375,6 +609,7 @@ browser_set_pane2_tag (Browser *self,
     if (self->priv->p2_tag) {
         g_free (self->priv->p2_tag);
         self->priv->p2_tag = NULL;
+        self->priv->vis_valid = FALSE;
 
         g_free (self->priv->p2_label);
         self->priv->p2_label = NULL;
@@ -383,6 +618,7 @@ browser_set_pane2_tag (Browser *self,
     if (tag) {
         self->priv->p2_tag = g_strdup (tag);
         self->priv->p2_label = g_strdup (label);
+        self->priv->p2_pooled = entry_tag_is_pooled (tag);
 
         if (column = gtk_tree_view_get_column (GTK_TREE_VIEW (self->priv->pane2), 0)) {
             gtk_tree_view_column_set_title (column, label);
@@ -405,7 +641,7 @@ browser_set_pane2_tag (Browser *self,
         }
 
         if (self->priv->s_p2) {
-            g_free (self->priv->s_p2);
+            string_pool_unref (self->priv->s_p2);
             self->priv->s_p2 = NULL;
 
             browser_update_pane3 (self);
@@ -466,25 +702,19 @@ browser_set_compare_func (Browser *self, EntryCompareFunc func)
             return;
         }
 
+        g_hash_table_remove_all (self->priv->rows);
+        browser_set_vis_selection (self);
+
         do {
             gtk_tree_model_get (GTK_TREE_MODEL (self->priv->p3_store), &oi, 0, &e, -1);
 
-            gboolean vis = TRUE;
-
-            if (self->priv->p1_tag) {
-                vis &= (!self->priv->s_p1 ||
-                        !g_strcmp0 (self->priv->s_p1, entry_get_tag_str (e, self->priv->p1_tag)));
-            }
-
-            if (self->priv->p2_tag) {
-                vis &= (!self->priv->s_p2 ||
-                        !g_strcmp0 (self->priv->s_p2, entry_get_tag_str (e, self->priv->p2_tag)));
-            }
+            gboolean vis = browser_entry_visible (self, e);
 
             browser_insert_iter (p3_store, &ni, e,
                 self->priv->cmp_func, 0, TRUE, g_object_unref);
 
             gtk_list_store_set (p3_store, &ni, 0, e, 1, vis, -1);
+            browser_set_row (self, e, &ni);
 
             g_object_unref (e);
         } while (gtk_tree_model_iter_next (GTK_TREE_MODEL (self->priv->p3_store), &oi));
@@ -534,11 +764,167 @@ browser_set_pane_visibility (Browser *self)
     }
 }
 
+static gboolean
+browser_pane_add (GtkListStore *store, const gchar *val, gint num)
+{
+    GtkTreeIter iter;
+    gint cnt;
+
+    gboolean res = browser_insert_iter (store, &iter, (gpointer) val,
+        (EntryCompareFunc) g_strcmp0, 0, FALSE, g_free);
+
+    gtk_tree_model_get (GTK_TREE_MODEL (store), &iter, 1, &cnt, -1);
+    gtk_list_store_set (store, &iter, 0, val, 1, cnt + num, -1);
+
+    return res;
+}
+
+static Artist**
+browser_get_artists (Browser *self)
+{
+    // Artist records can only stand in for a pane showing the artist tag
+    if (entry_tag_lookup (self->priv->p1_tag) != ENTRY_TAG_ARTIST) {
+        return NULL;
+    }
+
+    return media_store_get_artists (self->priv->store);
+}
+
+static const gchar**
+browser_get_column (Browser *self, const gchar *tag, guint *len)
+{
+    EntryTag slot = entry_tag_lookup (tag);
+
+    if (slot >= ENTRY_TAG_FIRST_INT) {
+        return NULL;
+    }
+
+    return media_store_get_column (self->priv->store, slot, len);
+}
+
+// Counts the values of col in one linear pass, rows whose filter value does
+// not match s_p1 are skipped when filter is set. Returns the number of rows.
+static gint
+browser_pane_add_column (Browser *self, GtkListStore *store, const gchar **col,
+    gboolean pooled, const gchar **filter, guint len, gint *num_vals)
+{
+    GHashTable *counts;
+    GHashTableIter iter;
+    gpointer key, cnt;
+    gint nulls = 0, total = 0;
+    guint i;
+
+    // Pooled values are unique pointers, so they can be counted by address
+    counts = pooled ? g_hash_table_new (g_direct_hash, g_direct_equal) :
+        g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (i = 0; i < len; i++) {
+        if (filter && !browser_tag_equal (self->priv->p1_pooled, self->priv->s_p1, filter[i])) {
+            continue;
+        }
+
+        total++;
+
+        if (!col[i]) {
+            nulls++;
+            continue;
+        }
+
+        cnt = g_hash_table_lookup (counts, col[i]);
+        g_hash_table_insert (counts, (gpointer) col[i],
+            GINT_TO_POINTER (GPOINTER_TO_INT (cnt) + 1));
+    }
+
+    g_hash_table_iter_init (&iter, counts);
+    while (g_hash_table_iter_next (&iter, &key, &cnt)) {
+        if (browser_pane_add (store, key, GPOINTER_TO_INT (cnt))) {
+            (*num_vals)++;
+        }
+    }
+
+    if (nulls && browser_pane_add (store, NULL, nulls)) {
+        (*num_vals)++;
+    }
+
+    g_hash_table_unref (counts);
+
+    return total;
+}
+
+// State of a walk over the store filling one of the list stores
+typedef struct {
+    Browser *self;
+    GtkListStore *store;
+    gint total, rows;
+} BrowserCount;
+
+static gboolean
+browser_count_pane1 (Entry *entry, BrowserCount *count)
+{
+    if (browser_pane_add (count->store,
+            entry_get_tag_str (entry, count->self->priv->p1_tag), 1)) {
+        count->rows++;
+    }
+
+    count->total++;
+
+    return TRUE;
+}
+
+static gboolean
+browser_count_pane2 (Entry *entry, BrowserCount *count)
+{
+    Browser *self = count->self;
+
+    if (self->priv->s_p1 &&
+        !browser_tag_equal (self->priv->p1_pooled, self->priv->s_p1,
+            entry_get_tag_str (entry, self->priv->p1_tag))) {
+        return TRUE;
+    }
+
+    if (browser_pane_add (count->store, entry_get_tag_str (entry, self->priv->p2_tag), 1)) {
+        count->rows++;
+    }
+
+    count->total++;
+
+    return TRUE;
+}
+
+static gboolean
+browser_add_row (Entry *walked, BrowserCount *fill)
+{
+    // The row outlives the walk, so it holds the entry the store keeps
+    Entry *entry = media_store_get_entry (fill->self->priv->store, entry_get_id (walked));
+    GtkTreeIter iter;
+    gboolean vis;
+
+    if (!entry) {
+        return TRUE;
+    }
+
+    vis = browser_entry_visible (fill->self, entry);
+
+    browser_insert_iter (fill->store, &iter, entry,
+        fill->self->priv->cmp_func, 0, TRUE, g_object_unref);
+
+    gtk_list_store_set (fill->store, &iter, 0, entry, 1, vis, -1);
+    browser_set_row (fill->self, entry, &iter);
+
+    fill->total++;
+
+    g_object_unref (entry);
+
+    return TRUE;
+}
+
 static void
 browser_populate_pane1 (Browser *self)
 {
-    GtkTreeIter iter;
-    gint i, cnt, num_p1 = 0;
+    Artist **artists;
+    const gchar **col;
+    guint len;
+    gint i, num = 0, num_p1 = 0;
 
     gtk_list_store_clear (self->priv->p1_store);
 
@@ -546,32 +932,36 @@ browser_populate_pane1 (Browser *self)
         return;
     }
 
-    Entry **entries = media_store_get_all_entries (self->priv->store);
+    if ((artists = browser_get_artists (self))) {
+        for (i = 0; artists[i]; i++) {
+            if (browser_pane_add (self->priv->p1_store,
+                    artist_get_name (artists[i]),
+                    artist_get_num_entries (artists[i]))) {
+                num_p1++;
+            }
 
-    for (i = 0; entries[i]; i++) {
-        const gchar *pane1 = entry_get_tag_str (entries[i], self->priv->p1_tag);
+            num += artist_get_num_entries (artists[i]);
+        }
 
-        gint res = browser_insert_iter (self->priv->p1_store, &iter,
-            (gpointer) pane1, (EntryCompareFunc) g_strcmp0, 0, FALSE, g_free);
+        g_free (artists);
+    } else if ((col = browser_get_column (self, self->priv->p1_tag, &len))) {
+        num = browser_pane_add_column (self, self->priv->p1_store, col,
+            self->priv->p1_pooled, NULL, len, &num_p1);
+    } else {
+        BrowserCount count = { self, self->priv->p1_store, 0, 0 };
 
-        gtk_tree_model_get (GTK_TREE_MODEL (self->priv->p1_store),
-            &iter, 1, &cnt, -1);
-        gtk_list_store_set (self->priv->p1_store, &iter,
-            0, pane1, 1, cnt + 1, -1);
+        media_store_foreach (self->priv->store, (MediaStoreFunc) browser_count_pane1, &count);
 
-        if (res) {
-            num_p1++;
-        }
+        num = count.total;
+        num_p1 = count.rows;
     }
 
     self->priv->num_p1 = num_p1;
 
-    g_free (entries);
-
     gchar *new_str = g_strdup_printf ("All %d %ss", num_p1, self->priv->p1_label);
 
     gtk_list_store_insert_with_values (self->priv->p1_store, NULL, 0,
-        0, new_str, 1, i, -1);
+        0, new_str, 1, num, -1);
 
     g_free (new_str);
 
@@ -585,6 +975,8 @@ static void
 browser_populate_pane2 (Browser *self)
 {
     GtkTreeIter iter;
+    const gchar **col, **filter = NULL;
+    guint len;
     gint i, cnt, num_p2 = 0, tcnt = 0;
 
     if (!self->priv->store || !self->priv->p2_tag) {
@@ -605,34 +997,55 @@ browser_populate_pane2 (Browser *self)
 
     GtkListStore *p2_store = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_INT);
 
-    Entry **entries = media_store_get_all_entries (self->priv->store);
+    Artist **artists = NULL;
+    if (entry_tag_lookup (self->priv->p2_tag) == ENTRY_TAG_ALBUM) {
+        artists = browser_get_artists (self);
+    }
 
-    for (i = 0; entries[i]; i++) {
-        const gchar *pane1 = entry_get_tag_str (entries[i], self->priv->p1_tag);
-        const gchar *pane2 = entry_get_tag_str (entries[i], self->priv->p2_tag);
+    if (artists) {
+        // Album records carry their own counts, no need to visit every entry
+        for (i = 0; artists[i]; i++) {
+            if (self->priv->s_p1 && self->priv->s_p1 != artist_get_name (artists[i])) {
+                continue;
+            }
 
-        if (self->priv->s_p1 && g_strcmp0 (self->priv->s_p1, pane1)) {
-            continue;
-        }
+            Album **albums = artist_get_albums (artists[i]);
+            gint j;
 
-        gint res = browser_insert_iter (p2_store, &iter, (gpointer) pane2,
-            (EntryCompareFunc) g_strcmp0, 0, FALSE, g_free);
+            for (j = 0; albums[j]; j++) {
+                cnt = album_get_num_entries (albums[j]);
 
-        gtk_tree_model_get (GTK_TREE_MODEL (p2_store),
-            &iter, 1, &cnt, -1);
-        gtk_list_store_set (p2_store, &iter,
-            0, pane2, 1, cnt + 1, -1);
-        tcnt++;
+                if (browser_pane_add (p2_store, album_get_name (albums[j]), cnt)) {
+                    num_p2++;
+                }
 
-        if (res) {
-            num_p2++;
+                tcnt += cnt;
+            }
+
+            g_free (albums);
         }
+
+        g_free (artists);
+    } else if ((col = browser_get_column (self, self->priv->p2_tag, &len)) &&
+               (!self->priv->s_p1 || (filter = browser_get_column (self, self->priv->p1_tag, &len)))) {
+        tcnt = browser_pane_add_column (self, p2_store, col,
+            self->priv->p2_pooled, filter, len, &num_p2);
+    } else {
+        BrowserCount count = { self, p2_store, 0, 0 };
+
+        // With an index on the pane1 tag only the selected entries are visited
+        if (!self->priv->s_p1 ||
+            !media_store_foreach_query (self->priv->store, self->priv->p1_tag,
+                self->priv->s_p1, (MediaStoreFunc) browser_count_pane2, &count)) {
+            media_store_foreach (self->priv->store, (MediaStoreFunc) browser_count_pane2, &count);
+        }
+
+        tcnt = count.total;
+        num_p2 = count.rows;
     }
 
     self->priv->num_p2 = num_p2;
 
-    g_free (entries);
-
     gchar *new_str = g_strdup_printf ("All %d %ss", num_p2, self->priv->p2_label);
 
     gtk_list_store_insert_with_values (p2_store, NULL, 0,
@@ -672,59 +1085,175 @@ browser_populate_pane2 (Browser *self)
 static void
 browser_populate_pane3 (Browser *self)
 {
-    GtkTreeIter iter;
-    gint i;
-
     GtkListStore *p3_store = gtk_list_store_new (2, G_TYPE_OBJECT, G_TYPE_BOOLEAN);
 
     if (!self->priv->store) {
         return;
     }
 
-    Entry **entries = media_store_get_all_entries (self->priv->store);
+    g_hash_table_remove_all (self->priv->rows);
+    browser_set_vis_selection (self);
+    browser_search_refresh (self);
 
-    for (i = 0; entries[i]; i++) {
-        gboolean vis = TRUE;
+    BrowserCount fill = { self, p3_store, 0, 0 };
+    media_store_foreach (self->priv->store, (MediaStoreFunc) browser_add_row, &fill);
+
+    g_object_unref (self->priv->p3_store);
+    g_object_unref (self->priv->p3_filter);
+    self->priv->p3_store = p3_store;
+    self->priv->p3_filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (self->priv->p3_store), NULL);
+    gtk_tree_model_filter_set_visible_column (GTK_TREE_MODEL_FILTER (self->priv->p3_filter), 1);
+
+    gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane3), self->priv->p3_filter);
+}
+
+static void
+browser_set_vis_selection (Browser *self)
+{
+    if (self->priv->vis_p1) {
+        string_pool_unref (self->priv->vis_p1);
+    }
+    if (self->priv->vis_p2) {
+        string_pool_unref (self->priv->vis_p2);
+    }
+
+    self->priv->vis_p1 = self->priv->s_p1 ? string_pool_ref (self->priv->s_p1) : NULL;
+    self->priv->vis_p2 = self->priv->s_p2 ? string_pool_ref (self->priv->s_p2) : NULL;
+    self->priv->vis_valid = TRUE;
+}
+
+/*
+ * Looks up the entries matching a pane selection through the store indexes.
+ * Returns FALSE when that is not possible, *entries is left NULL when
+ * nothing is selected and everything matches.
+ */
+static gboolean
+browser_query_selection (Browser *self, const gchar *p1, const gchar *p2, Entry ***entries)
+{
+    Entry **res;
+    gint i, n = 0;
 
-        if (self->priv->p1_tag) {
-            const gchar *pane1 = entry_get_tag_str (entries[i], self->priv->p1_tag);
-            if (self->priv->s_p1 && g_strcmp0 (self->priv->s_p1, pane1)) {
-                vis = FALSE;
+    *entries = NULL;
+
+    if (p1) {
+        res = media_store_query (self->priv->store, self->priv->p1_tag, p1);
+    } else if (p2) {
+        res = media_store_query (self->priv->store, self->priv->p2_tag, p2);
+    } else {
+        return TRUE;
+    }
+
+    if (!res) {
+        return FALSE;
+    }
+
+    if (p1 && p2) {
+        for (i = 0; res[i]; i++) {
+            if (browser_tag_equal (self->priv->p2_pooled, p2,
+                    entry_get_tag_str (res[i], self->priv->p2_tag))) {
+                res[n++] = res[i];
             }
         }
+        res[n] = NULL;
+    }
 
-        if (self->priv->p2_tag) {
-            const gchar *pane2 = entry_get_tag_str (entries[i], self->priv->p2_tag);
-            if (self->priv->s_p2 && g_strcmp0 (self->priv->s_p2, pane2)) {
-                vis = FALSE;
-            }
+    *entries = res;
+
+    return TRUE;
+}
+
+static void
+browser_set_visible (Browser *self, Entry **entries, gboolean vis)
+{
+    GtkTreeIter *row;
+    gint i;
+
+    for (i = 0; entries[i]; i++) {
+        if ((row = g_hash_table_lookup (self->priv->rows, entries[i]))) {
+            gtk_list_store_set (self->priv->p3_store, row,
+                1, vis && browser_search_match (self, entries[i]), -1);
         }
+    }
+}
 
-//        if (vis) {
-            browser_insert_iter (p3_store, &iter, entries[i],
-                self->priv->cmp_func, 0, TRUE, g_object_unref);
+static void
+browser_search_refresh (Browser *self)
+{
+    const gchar *text = gtk_entry_get_text (GTK_ENTRY (self->priv->search));
+    Entry **entries;
+    gint i;
 
-            gtk_list_store_set (p3_store, &iter, 0, entries[i], 1, vis, -1);
-//        }
+    if (self->priv->hits) {
+        g_hash_table_unref (self->priv->hits);
+        self->priv->hits = NULL;
     }
 
-    g_object_unref (self->priv->p3_store);
-    g_object_unref (self->priv->p3_filter);
-    self->priv->p3_store = p3_store;
-    self->priv->p3_filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (self->priv->p3_store), NULL);
-    gtk_tree_model_filter_set_visible_column (GTK_TREE_MODEL_FILTER (self->priv->p3_filter), 1);
+    if (!self->priv->store || !*text ||
+        !(entries = media_store_search (self->priv->store, text, 0))) {
+        return;
+    }
 
-    gtk_tree_view_set_model (GTK_TREE_VIEW (self->priv->pane3), self->priv->p3_filter);
+    self->priv->hits = g_hash_table_new (g_direct_hash, g_direct_equal);
+    for (i = 0; entries[i]; i++) {
+        g_hash_table_insert (self->priv->hits, entries[i], entries[i]);
+    }
 
     g_free (entries);
 }
 
+// Updates the search hits for one added or changed entry
+static void
+browser_search_check (Browser *self, Entry *entry)
+{
+    const gchar *text = gtk_entry_get_text (GTK_ENTRY (self->priv->search));
+
+    if (!self->priv->hits) {
+        return;
+    }
+
+    if (media_store_search_match (self->priv->store, entry, text)) {
+        g_hash_table_insert (self->priv->hits, entry, entry);
+    } else {
+        g_hash_table_remove (self->priv->hits, entry);
+    }
+}
+
+static void
+on_search_changed (Browser *self, GtkEditable *editable)
+{
+    browser_search_refresh (self);
+
+    self->priv->vis_valid = FALSE;
+    browser_update_pane3 (self);
+}
+
 static void
 browser_update_pane3 (Browser *self)
 {
     GtkTreeIter iter;
+    Entry **old_vis = NULL, **new_vis = NULL;
     Entry *e;
 
+    // Going from one selection to another only touches the rows of both
+    if (self->priv->vis_valid &&
+        browser_query_selection (self, self->priv->vis_p1, self->priv->vis_p2, &old_vis) &&
+        browser_query_selection (self, self->priv->s_p1, self->priv->s_p2, &new_vis) &&
+        old_vis && new_vis) {
+        browser_set_visible (self, old_vis, FALSE);
+        browser_set_visible (self, new_vis, TRUE);
+
+        g_free (old_vis);
+        g_free (new_vis);
+
+        browser_set_vis_selection (self);
+        return;
+    }
+
+    g_free (old_vis);
+    g_free (new_vis);
+
+    browser_set_vis_selection (self);
+
     if (!gtk_tree_model_get_iter_first (GTK_TREE_MODEL (self->priv->p3_store), &iter)) {
         return;
     }
@@ -732,17 +1261,7 @@ browser_update_pane3 (Browser *self)
     do {
         gtk_tree_model_get (GTK_TREE_MODEL (self->priv->p3_store), &iter, 0, &e, -1);
 
-        gboolean vis = TRUE;
-
-        if (self->priv->p1_tag) {
-            vis &= (!self->priv->s_p1 ||
-                    !g_strcmp0 (self->priv->s_p1, entry_get_tag_str (e, self->priv->p1_tag)));
-        }
-
-        if (self->priv->p2_tag) {
-            vis &= (!self->priv->s_p2 ||
-                    !g_strcmp0 (self->priv->s_p2, entry_get_tag_str (e, self->priv->p2_tag)));
-        }
+        gboolean vis = browser_entry_visible (self, e);
 
         gtk_list_store_set (self->priv->p3_store, &iter, 1, vis, -1);
         g_object_unref (e);
@@ -902,26 +1421,25 @@ browser_get_prev (TrackSource *self)
 }
 
 static void
-entry_changed (Browser *self, Entry *entry)
+on_entries_state (Entry **entries, guint len, Browser *self)
 {
-    GtkTreeIter iter;
-    Entry *e;
+    GtkTreeIter *iter;
+    GtkTreePath *path;
+    guint i;
 
-    if (!gtk_tree_model_get_iter_first (self->priv->p3_filter, &iter)) {
-        return;
-    }
+    gdk_threads_enter ();
 
-    do {
-        gtk_tree_model_get (self->priv->p3_filter, &iter, 0, &e, -1);
+    for (i = 0; i < len; i++) {
+        if (!(iter = g_hash_table_lookup (self->priv->rows, entries[i]))) {
+            continue;
+        }
 
-        if (e == entry) {
-            GtkTreePath *path = gtk_tree_model_get_path (self->priv->p3_filter, &iter);
+        path = gtk_tree_model_get_path (GTK_TREE_MODEL (self->priv->p3_store), iter);
+        gtk_tree_model_row_changed (GTK_TREE_MODEL (self->priv->p3_store), path, iter);
+        gtk_tree_path_free (path);
+    }
 
-            gtk_tree_model_row_changed (self->priv->p3_filter, path, &iter);
-            gtk_tree_path_free (path);
-            return;
-        }
-    } while (gtk_tree_model_iter_next (self->priv->p3_filter, &iter));
+    gdk_threads_leave ();
 }
 
 static gint
@@ -972,13 +1490,13 @@ pane1_cursor_changed (Browser *self, GtkTreeView *view)
 
     if (path == NULL || !g_strcmp0 (path_str, "0")) {
         if (self->priv->s_p1) {
-            g_free (self->priv->s_p1);
+            string_pool_unref (self->priv->s_p1);
             self->priv->s_p1 = NULL;
             update = TRUE;
         }
 
         if (self->priv->s_p2 && self->priv->p2_single) {
-            g_free (self->priv->s_p2);
+            string_pool_unref (self->priv->s_p2);
             self->priv->s_p2 = NULL;
         }
     } else {
@@ -989,13 +1507,13 @@ pane1_cursor_changed (Browser *self, GtkTreeView *view)
 
         if (g_strcmp0 (self->priv->s_p1, pane1)) {
             if (self->priv->s_p1) {
-                g_free (self->priv->s_p1);
+                string_pool_unref (self->priv->s_p1);
             }
 
-            self->priv->s_p1 = g_strdup (pane1);
+            self->priv->s_p1 = string_pool_ref (pane1);
 
             if (self->priv->s_p2) {
-                g_free (self->priv->s_p2);
+                string_pool_unref (self->priv->s_p2);
                 self->priv->s_p2 = NULL;
             }
 
@@ -1036,7 +1554,7 @@ pane2_cursor_changed (Browser *self, GtkTreeView *view)
 
     if (path == NULL || !g_strcmp0 (path_str, "0")) {
         if (self->priv->s_p2) {
-            g_free (self->priv->s_p2);
+            string_pool_unref (self->priv->s_p2);
             self->priv->s_p2 = NULL;
         }
     } else {
@@ -1047,10 +1565,10 @@ pane2_cursor_changed (Browser *self, GtkTreeView *view)
 
         if (g_strcmp0 (self->priv->s_p2, pane2)) {
             if (self->priv->s_p2) {
-                g_free (self->priv->s_p2);
+                string_pool_unref (self->priv->s_p2);
             }
 
-            self->priv->s_p2 = g_strdup (pane2);
+            self->priv->s_p2 = string_pool_ref (pane2);
         }
 
         if (pane2) {
@@ -1105,8 +1623,10 @@ pane3_row_activated (Browser *self,
     track_source_emit_play (TRACK_SOURCE (self), entry);
 }
 
-static void
-on_store_add (Browser *self, Entry *entry, MediaStore *ms)
+// Counts an entry with the given pane values in the browse panes, returns
+// whether its track row should be visible under the current selection
+static gboolean
+browser_panes_add (Browser *self, const gchar *pane1, const gchar *pane2)
 {
     GtkTreeIter first, iter;
     gint cnt;
@@ -1114,12 +1634,9 @@ on_store_add (Browser *self, Entry *entry, MediaStore *ms)
     gboolean res;
     gboolean tv = TRUE;
 
-    gdk_threads_enter ();
-
     if (self->priv->p1_tag) {
-        const gchar *pane1 = entry_get_tag_str (entry, self->priv->p1_tag);
-
-        tv = self->priv->s_p1 == NULL || !g_strcmp0 (self->priv->s_p1, pane1);
+        tv = self->priv->s_p1 == NULL ||
+            browser_tag_equal (self->priv->p1_pooled, self->priv->s_p1, pane1);
 
         // Add pane1 to view
         res = browser_insert_iter (self->priv->p1_store, &iter, (gpointer) pane1,
@@ -1144,9 +1661,8 @@ on_store_add (Browser *self, Entry *entry, MediaStore *ms)
         }
 
         if (self->priv->p2_tag) {
-            const gchar *pane2 = entry_get_tag_str (entry, self->priv->p2_tag);
-
-            tv &= (self->priv->s_p2 == NULL || !g_strcmp0 (self->priv->s_p2, pane2));
+            tv &= (self->priv->s_p2 == NULL ||
+                browser_tag_equal (self->priv->p2_pooled, self->priv->s_p2, pane2));
 
             if (tv && !(self->priv->p2_single && self->priv->s_p2 == NULL)) {
                 // Add pane2 to view
@@ -1177,34 +1693,126 @@ on_store_add (Browser *self, Entry *entry, MediaStore *ms)
         }
     }
 
-    browser_insert_iter (self->priv->p3_store, &iter, entry, self->priv->cmp_func,
-                         0, TRUE, g_object_unref);
+    return tv;
+}
+
+static gint
+browser_batch_cmp (gconstpointer a, gconstpointer b, gpointer cmp)
+{
+    return ((EntryCompareFunc) cmp) (*(Entry**) a, *(Entry**) b);
+}
+
+// Sorts the new entries once and merges them into the track list in a single
+// pass, small batches are cheaper with a binary search per entry
+static void
+browser_merge_entries (Browser *self, Entry **entries, gboolean *vis, guint len)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL (self->priv->p3_store);
+    GtkTreeIter iter, ni;
+    Entry *e = NULL;
+    gboolean valid;
+    guint i = 0;
+
+    if (len < BROWSER_MERGE_MIN) {
+        for (i = 0; i < len; i++) {
+            browser_insert_iter (self->priv->p3_store, &iter, entries[i],
+                self->priv->cmp_func, 0, TRUE, g_object_unref);
+
+            gtk_list_store_set (self->priv->p3_store, &iter, 0, entries[i], 1, vis[i], -1);
+            browser_set_row (self, entries[i], &iter);
+        }
+
+        return;
+    }
+
+    valid = gtk_tree_model_get_iter_first (model, &iter);
+    if (valid) {
+        gtk_tree_model_get (model, &iter, 0, &e, -1);
+    }
+
+    while (i < len) {
+        if (!valid) {
+            gtk_list_store_append (self->priv->p3_store, &ni);
+        } else if (self->priv->cmp_func (entries[i], e) < 0) {
+            gtk_list_store_insert_before (self->priv->p3_store, &ni, &iter);
+        } else {
+            g_object_unref (e);
+            e = NULL;
+
+            if ((valid = gtk_tree_model_iter_next (model, &iter))) {
+                gtk_tree_model_get (model, &iter, 0, &e, -1);
+            }
+
+            continue;
+        }
+
+        gtk_list_store_set (self->priv->p3_store, &ni, 0, entries[i], 1, vis[i], -1);
+        browser_set_row (self, entries[i], &ni);
+        i++;
+    }
+
+    if (e) {
+        g_object_unref (e);
+    }
+}
+
+static void
+on_entries_added (Browser *self, guint len, Entry **entries, MediaStore *ms)
+{
+    Entry **added;
+    gboolean *vis;
+    guint i, j, n = 0;
+
+    gdk_threads_enter ();
+
+    added = g_new (Entry*, len);
+    for (i = 0; i < len; i++) {
+        // Already listed if the track list was rebuilt after the add
+        if (!g_hash_table_lookup (self->priv->rows, entries[i])) {
+            added[n++] = entries[i];
+        }
+    }
+
+    g_qsort_with_data (added, n, sizeof (Entry*), browser_batch_cmp,
+        (gpointer) self->priv->cmp_func);
+
+    vis = g_new (gboolean, n);
+    for (j = 0; j < n; j++) {
+        // New entries might match the search
+        browser_search_check (self, added[j]);
+
+        vis[j] = browser_panes_add (self,
+            entry_get_tag_str (added[j], self->priv->p1_tag),
+            entry_get_tag_str (added[j], self->priv->p2_tag)) &&
+            browser_search_match (self, added[j]);
+    }
+
+    browser_merge_entries (self, added, vis, n);
 
-    gtk_list_store_set (self->priv->p3_store, &iter, 0, entry, 1, tv, -1);
+    g_free (added);
+    g_free (vis);
 
     gdk_threads_leave ();
 }
 
+// Uncounts an entry with the given pane values from the browse panes,
+// last_p1 and last_p2 are set when it was the last entry of its pane row
 static void
-on_store_remove (Browser *self, Entry *entry, MediaStore *ms)
+browser_panes_remove (Browser *self, const gchar *pane1, const gchar *pane2,
+    gboolean *last_p1, gboolean *last_p2)
 {
     GtkTreeIter first, iter;
     gint cnt;
     gchar *new_str;
-    gboolean last_p1 = FALSE, last_p2 = FALSE;
-
-    gdk_threads_enter ();
 
     if (self->priv->p1_tag) {
-        const gchar *pane1 = entry_get_tag_str (entry, self->priv->p1_tag);
-
         browser_insert_iter (self->priv->p1_store, &iter,
             (gpointer) pane1, (EntryCompareFunc) g_strcmp0, 1, FALSE, g_free);
 
         gtk_tree_model_get (GTK_TREE_MODEL (self->priv->p1_store), &iter, 1, &cnt, -1);
 
         if (cnt == 1) {
-            last_p1 = TRUE;
+            *last_p1 = TRUE;
 
             gtk_list_store_remove (self->priv->p1_store, &iter);
 
@@ -1224,10 +1832,11 @@ on_store_remove (Browser *self, Entry *entry, MediaStore *ms)
         }
 
         if ( self->priv->p2_tag) {
-            const gchar *pane2 = entry_get_tag_str (entry, self->priv->p2_tag);
+            gboolean p1_match = browser_tag_equal (self->priv->p1_pooled,
+                self->priv->s_p1, pane1);
 
-            if ((self->priv->s_p1 == NULL || !g_strcmp0 (self->priv->s_p1, pane1)) &&
-                !(self->priv->p2_single && g_strcmp0 (self->priv->s_p1, pane1))) {
+            if ((self->priv->s_p1 == NULL || p1_match) &&
+                !(self->priv->p2_single && !p1_match)) {
 
                 browser_insert_iter (self->priv->p2_store, &iter, (gpointer) pane2,
                          (EntryCompareFunc) g_strcmp0, 1, FALSE, g_free);
@@ -1235,7 +1844,7 @@ on_store_remove (Browser *self, Entry *entry, MediaStore *ms)
                 gtk_tree_model_get (GTK_TREE_MODEL (self->priv->p2_store), &iter, 1, &cnt, -1);
 
                 if (cnt == 1) {
-                    last_p2 = TRUE;
+                    *last_p2 = TRUE;
 
                     gtk_list_store_remove (self->priv->p2_store, &iter);
 
@@ -1258,11 +1867,12 @@ on_store_remove (Browser *self, Entry *entry, MediaStore *ms)
         }
     }
 
-    browser_insert_iter (self->priv->p3_store, &iter, entry,
-                         self->priv->cmp_func, 0, FALSE, g_object_unref);
-
-    gtk_list_store_remove (self->priv->p3_store, &iter);
+}
 
+// Selects the "All" row of a pane whose selected row went away
+static void
+browser_reselect (Browser *self, gboolean last_p1, gboolean last_p2)
+{
     if (last_p1) {
         GtkTreePath *root = gtk_tree_path_new_from_string ("0");
         gtk_tree_selection_select_path (gtk_tree_view_get_selection (
@@ -1278,6 +1888,139 @@ on_store_remove (Browser *self, Entry *entry, MediaStore *ms)
 
         pane2_cursor_changed (self, GTK_TREE_VIEW (self->priv->pane2));
     }
+}
+
+// Drops an entry from the browse panes and the track list
+static void
+browser_remove_entry (Browser *self, Entry *entry, gboolean *last_p1, gboolean *last_p2)
+{
+    GtkTreeIter *row = g_hash_table_lookup (self->priv->rows, entry);
+
+    browser_panes_remove (self,
+        entry_get_tag_str (entry, self->priv->p1_tag),
+        entry_get_tag_str (entry, self->priv->p2_tag), last_p1, last_p2);
+
+    if (row) {
+        gtk_list_store_remove (self->priv->p3_store, row);
+        g_hash_table_remove (self->priv->rows, entry);
+    }
+}
+
+static void
+on_entries_removed (Browser *self, guint len, Entry **entries, MediaStore *ms)
+{
+    gboolean last_p1 = FALSE, last_p2 = FALSE;
+    guint i;
+
+    gdk_threads_enter ();
+
+    for (i = 0; i < len; i++) {
+        if (g_hash_table_lookup (self->priv->rows, entries[i])) {
+            browser_remove_entry (self, entries[i], &last_p1, &last_p2);
+        }
+
+        // Hits are kept up to date entry by entry, not by searching again
+        if (self->priv->hits) {
+            g_hash_table_remove (self->priv->hits, entries[i]);
+        }
+    }
+
+    // Reselect once for the whole batch, this rebuilds the lower panes
+    browser_reselect (self, last_p1, last_p2);
+
+    gdk_threads_leave ();
+}
+
+// Whether the row still sorts between its neighbours
+static gboolean
+browser_row_in_order (Browser *self, GtkTreeIter *row, Entry *entry)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL (self->priv->p3_store);
+    GtkTreePath *path = gtk_tree_model_get_path (model, row);
+    GtkTreeIter iter;
+    gboolean res = TRUE;
+    Entry *e;
+
+    if (gtk_tree_path_prev (path) && gtk_tree_model_get_iter (model, &iter, path)) {
+        gtk_tree_model_get (model, &iter, 0, &e, -1);
+        res = self->priv->cmp_func (e, entry) <= 0;
+        g_object_unref (e);
+    }
+
+    gtk_tree_path_free (path);
+
+    iter = *row;
+    if (res && gtk_tree_model_iter_next (model, &iter)) {
+        gtk_tree_model_get (model, &iter, 0, &e, -1);
+        res = self->priv->cmp_func (entry, e) <= 0;
+        g_object_unref (e);
+    }
+
+    return res;
+}
+
+static void
+on_entry_update (Browser *self, Entry *entry, gchar **changes, MediaStore *ms)
+{
+    GtkTreeIter *row, iter;
+    GtkTreePath *path;
+    const gchar *old1, *old2;
+    gboolean last_p1 = FALSE, last_p2 = FALSE, panes = FALSE, vis;
+    gint i;
+
+    gdk_threads_enter ();
+
+    if (!(row = g_hash_table_lookup (self->priv->rows, entry))) {
+        gdk_threads_leave ();
+        return;
+    }
+
+    old1 = entry_get_tag_str (entry, self->priv->p1_tag);
+    old2 = entry_get_tag_str (entry, self->priv->p2_tag);
+
+    for (i = 0; changes[i]; i += 2) {
+        if (!g_strcmp0 (changes[i], self->priv->p1_tag)) {
+            old1 = changes[i + 1];
+            panes = TRUE;
+        } else if (!g_strcmp0 (changes[i], self->priv->p2_tag)) {
+            old2 = changes[i + 1];
+            panes = TRUE;
+        }
+    }
+
+    browser_search_check (self, entry);
+
+    // Only move the entry between pane rows when one of their tags changed
+    if (panes) {
+        browser_panes_remove (self, old1, old2, &last_p1, &last_p2);
+
+        vis = browser_panes_add (self,
+            entry_get_tag_str (entry, self->priv->p1_tag),
+            entry_get_tag_str (entry, self->priv->p2_tag)) &&
+            browser_search_match (self, entry);
+
+        gtk_list_store_set (self->priv->p3_store, row, 1, vis, -1);
+    } else if (self->priv->hits) {
+        gtk_list_store_set (self->priv->p3_store, row,
+            1, browser_entry_visible (self, entry), -1);
+    }
+
+    if (browser_row_in_order (self, row, entry)) {
+        path = gtk_tree_model_get_path (GTK_TREE_MODEL (self->priv->p3_store), row);
+        gtk_tree_model_row_changed (GTK_TREE_MODEL (self->priv->p3_store), path, row);
+        gtk_tree_path_free (path);
+    } else {
+        gtk_tree_model_get (GTK_TREE_MODEL (self->priv->p3_store), row, 1, &vis, -1);
+        gtk_list_store_remove (self->priv->p3_store, row);
+
+        browser_insert_iter (self->priv->p3_store, &iter, entry,
+            self->priv->cmp_func, 0, TRUE, g_object_unref);
+
+        gtk_list_store_set (self->priv->p3_store, &iter, 0, entry, 1, vis, -1);
+        browser_set_row (self, entry, &iter);
+    }
+
+    browser_reselect (self, last_p1, last_p2);
 
     gdk_threads_leave ();
 }
@@ -1420,15 +2163,13 @@ on_pane3_move (Browser *self, GtkWidget *item)
     g_list_foreach (rows, (GFunc) gtk_tree_path_free, NULL);
     g_list_free (rows);
 
-    for (i = 0; i < size; i++) {
-        gchar **kvs = entry_get_kvs (entries[i]);
-
-        media_store_remove_entry (self->priv->store, entries[i]);
+    // The copies in the target store need every tag, not just the loaded ones
+    media_store_hydrate_entries (self->priv->store, entries, size);
+    shell_move_entries_to (self->priv->shell, entries, size, label);
 
-        shell_move_to (self->priv->shell, kvs, label);
-
-        g_strfreev (kvs);
+    media_store_remove_entries (self->priv->store, entries, size);
 
+    for (i = 0; i < size; i++) {
         g_object_unref (entries[i]);
     }
 
@@ -1455,8 +2196,10 @@ on_pane3_remove (Browser *self, GtkWidget *item)
     g_list_foreach (rows, (GFunc) gtk_tree_path_free, NULL);
     g_list_free (rows);
 
+    media_store_remove_entries (self->priv->store, entries, size);
+
     for (i = 0; i < size; i++) {
-        media_store_remove_entry (self->priv->store, entries[i]);
+        g_object_unref (entries[i]);
     }
 
     g_free (entries);
@@ -1466,25 +2209,34 @@ static void
 on_pane3_info (Browser *self, GtkWidget *item)
 {
     GList *rows, *ri;
-    Entry *e;
+    Entry **entries;
     GtkTreeIter iter;
+    guint size, i;
 
     TagDialog *td = tag_dialog_new ();
     g_signal_connect_swapped (td, "completed", G_CALLBACK (on_info_completed), self);
 
     rows = gtk_tree_selection_get_selected_rows (self->priv->p3_sel, NULL);
-    for (ri = rows; ri; ri = ri->next) {
-        gtk_tree_model_get_iter (self->priv->p3_filter, &iter, ri->data);
-        gtk_tree_model_get (self->priv->p3_filter, &iter, 0, &e, -1);
+    size = g_list_length (rows);
 
-        gchar **kvs = entry_get_kvs (e);
-        tag_dialog_add_entry (td, kvs);
-        g_strfreev (kvs);
+    entries = g_new0 (Entry*, size);
+    for (ri = rows, i = 0; ri; ri = ri->next, i++) {
+        gtk_tree_model_get_iter (self->priv->p3_filter, &iter, ri->data);
+        gtk_tree_model_get (self->priv->p3_filter, &iter, 0, &entries[i], -1);
     }
 
     g_list_foreach (rows, (GFunc) gtk_tree_path_free, NULL);
     g_list_free (rows);
 
+    media_store_hydrate_entries (self->priv->store, entries, size);
+    tag_dialog_add_entries (td, entries, size);
+
+    for (i = 0; i < size; i++) {
+        g_object_unref (entries[i]);
+    }
+
+    g_free (entries);
+
     tag_dialog_show (td);
 }
 
@@ -0,0 +1,193 @@
+/*
+ *      entry-table.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "entry-table.h"
+
+#define PAGE_BITS 8
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+typedef struct {
+    guint used;
+    Entry *entries[PAGE_SIZE];
+} EntryPage;
+
+struct _EntryTable {
+    EntryPage **pages;
+    guint num_pages;
+
+    guint size;
+};
+
+EntryTable*
+entry_table_new (void)
+{
+    return g_new0 (EntryTable, 1);
+}
+
+void
+entry_table_free (EntryTable *self)
+{
+    guint i, j;
+
+    for (i = 0; i < self->num_pages; i++) {
+        EntryPage *page = self->pages[i];
+
+        if (!page) {
+            continue;
+        }
+
+        for (j = 0; j < PAGE_SIZE; j++) {
+            if (page->entries[j]) {
+                g_object_unref (page->entries[j]);
+            }
+        }
+
+        g_free (page);
+    }
+
+    g_free (self->pages);
+    g_free (self);
+}
+
+// Takes over the caller's reference to entry
+void
+entry_table_insert (EntryTable *self, guint id, Entry *entry)
+{
+    guint p = id >> PAGE_BITS;
+    EntryPage *page;
+
+    if (p >= self->num_pages) {
+        guint num_pages = MAX (p + 1, self->num_pages * 2);
+
+        self->pages = g_renew (EntryPage*, self->pages, num_pages);
+        memset (self->pages + self->num_pages, 0,
+            (num_pages - self->num_pages) * sizeof (EntryPage*));
+        self->num_pages = num_pages;
+    }
+
+    if (!(page = self->pages[p])) {
+        page = self->pages[p] = g_new0 (EntryPage, 1);
+    }
+
+    if (page->entries[id & PAGE_MASK]) {
+        g_object_unref (page->entries[id & PAGE_MASK]);
+    } else {
+        page->used++;
+        self->size++;
+    }
+
+    page->entries[id & PAGE_MASK] = entry;
+}
+
+gboolean
+entry_table_remove (EntryTable *self, guint id)
+{
+    guint p = id >> PAGE_BITS;
+    EntryPage *page;
+
+    if (p >= self->num_pages || !(page = self->pages[p]) ||
+        !page->entries[id & PAGE_MASK]) {
+        return FALSE;
+    }
+
+    g_object_unref (page->entries[id & PAGE_MASK]);
+    page->entries[id & PAGE_MASK] = NULL;
+    self->size--;
+
+    if (--page->used == 0) {
+        g_free (page);
+        self->pages[p] = NULL;
+    }
+
+    return TRUE;
+}
+
+Entry*
+entry_table_lookup (EntryTable *self, guint id)
+{
+    guint p = id >> PAGE_BITS;
+
+    if (p >= self->num_pages || !self->pages[p]) {
+        return NULL;
+    }
+
+    return self->pages[p]->entries[id & PAGE_MASK];
+}
+
+guint
+entry_table_size (EntryTable *self)
+{
+    return self->size;
+}
+
+// Returns a NULL terminated array of the entries in id order, the entries
+// themselves are not referenced
+Entry**
+entry_table_get_all (EntryTable *self)
+{
+    Entry **all = g_new (Entry*, self->size + 1);
+    guint i, j, n = 0;
+
+    for (i = 0; i < self->num_pages; i++) {
+        EntryPage *page = self->pages[i];
+
+        if (!page) {
+            continue;
+        }
+
+        for (j = 0; j < PAGE_SIZE; j++) {
+            if (page->entries[j]) {
+                all[n++] = page->entries[j];
+            }
+        }
+    }
+
+    all[n] = NULL;
+
+    return all;
+}
+
+// Walks the entries in id order, returns FALSE when func stopped the walk.
+// The table must not change until it returns.
+gboolean
+entry_table_foreach (EntryTable *self, EntryTableFunc func, gpointer user_data)
+{
+    guint i, j;
+
+    for (i = 0; i < self->num_pages; i++) {
+        EntryPage *page = self->pages[i];
+
+        if (!page) {
+            continue;
+        }
+
+        for (j = 0; j < PAGE_SIZE; j++) {
+            if (page->entries[j] && !func (page->entries[j], user_data)) {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
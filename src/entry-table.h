@@ -0,0 +1,50 @@
+/*
+ *      entry-table.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __ENTRY_TABLE_H__
+#define __ENTRY_TABLE_H__
+
+#include <glib.h>
+
+#include "entry.h"
+
+G_BEGIN_DECLS
+
+// Sparse, paged array of entries indexed directly by entry id
+typedef struct _EntryTable EntryTable;
+
+// Return FALSE to stop the walk
+typedef gboolean (*EntryTableFunc) (Entry *entry, gpointer user_data);
+
+EntryTable *entry_table_new (void);
+void entry_table_free (EntryTable *self);
+
+void entry_table_insert (EntryTable *self, guint id, Entry *entry);
+gboolean entry_table_remove (EntryTable *self, guint id);
+Entry *entry_table_lookup (EntryTable *self, guint id);
+
+guint entry_table_size (EntryTable *self);
+Entry **entry_table_get_all (EntryTable *self);
+gboolean entry_table_foreach (EntryTable *self, EntryTableFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __ENTRY_TABLE_H__ */
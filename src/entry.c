@@ -21,29 +21,121 @@
 
 #include <gtk/gtk.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "entry.h"
+#include "string-pool.h"
+#include "art-cache.h"
+#include "library-table.h"
 
 G_DEFINE_TYPE(Entry, entry, G_TYPE_OBJECT)
 
 struct _EntryPrivate {
-    GHashTable *table;
+    gchar *tags[ENTRY_TAG_FIRST_INT];
+    GHashTable *extra;
+
+    gint nums[ENTRY_TAG_NUM_INTS];
+    guint num_set;
+
+    // Numbers rendered for entry_get_tag, under the num_strs lock
+    gchar **num_strs;
 
     guint id;
-    gchar *location;
+    Album *album;
+
+    // Views keep their tags in a row of a columnar table instead
+    LibraryTable *table;
+
+    guint8 *sort_key;
 
     EntryType type;
     EntryState state;
+    gboolean state_queued;
+    gboolean partial;
 };
 
 static guint signal_state;
 
+typedef struct {
+    EntryStatesFunc func;
+    gpointer user_data;
+} StatesFunc;
+
+// Entries whose state changed since the last flush, and the batch listeners
+G_LOCK_DEFINE_STATIC (states);
+static GPtrArray *pending_states = NULL;
+static GSList *states_funcs = NULL;
+
+// Getters on any thread fill num_strs, setters under the store lock clear it
+G_LOCK_DEFINE_STATIC (num_strs);
+
+static void entry_set_num (Entry *self, EntryTag slot, gint value);
+
+static const gchar *tag_names[ENTRY_TAG_LAST] = {
+    "title",
+    "artist",
+    "album",
+    "location",
+    "show",
+    "duration",
+    "tracknumber",
+    "season",
+    "year",
+    "disc",
+    "bitrate",
+    "playcount",
+};
+
+static inline void
+entry_free_slot (Entry *self, EntryTag slot)
+{
+    if (ENTRY_TAG_IS_POOLED (slot)) {
+        string_pool_unref (self->priv->tags[slot]);
+    } else {
+        g_free (self->priv->tags[slot]);
+    }
+}
+
+// Tags making up the sort key of each media type, most significant first
+static const EntryTag song_sort[] = {
+    ENTRY_TAG_ARTIST, ENTRY_TAG_ALBUM, ENTRY_TAG_TRACKNUMBER, ENTRY_TAG_TITLE, ENTRY_TAG_LAST
+};
+static const EntryTag tvshow_sort[] = {
+    ENTRY_TAG_SHOW, ENTRY_TAG_SEASON, ENTRY_TAG_TRACKNUMBER, ENTRY_TAG_TITLE, ENTRY_TAG_LAST
+};
+static const EntryTag music_video_sort[] = {
+    ENTRY_TAG_ARTIST, ENTRY_TAG_TITLE, ENTRY_TAG_LAST
+};
+static const EntryTag title_sort[] = {
+    ENTRY_TAG_TITLE, ENTRY_TAG_LAST
+};
+
 static void
 entry_finalize (GObject *object)
 {
     Entry *self = ENTRY (object);
+    gint i;
 
-    g_hash_table_unref (self->priv->table);
+    for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+        entry_free_slot (self, i);
+    }
+
+    if (self->priv->num_strs) {
+        for (i = 0; i < ENTRY_TAG_NUM_INTS; i++) {
+            g_free (self->priv->num_strs[i]);
+        }
+        g_free (self->priv->num_strs);
+    }
+
+    if (self->priv->extra) {
+        g_hash_table_unref (self->priv->extra);
+    }
+
+    if (self->priv->album) {
+        album_unref (self->priv->album);
+    }
+
+    g_free (self->priv->sort_key);
 
     G_OBJECT_CLASS (entry_parent_class)->finalize (object);
 }
@@ -68,9 +160,6 @@ entry_init (Entry *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE((self), ENTRY_TYPE, EntryPrivate);
 
-    self->priv->table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-
-    self->priv->location = "";
     self->priv->state = ENTRY_STATE_NONE;
 }
 
@@ -84,6 +173,57 @@ _entry_new (guint id)
     return self;
 }
 
+// Creates an entry reading and writing its tags through the row for id
+Entry*
+_entry_new_view (guint id, LibraryTable *table)
+{
+    Entry *self = _entry_new (id);
+
+    self->priv->table = table;
+
+    return self;
+}
+
+// Copies the row into the entry, the row may be removed afterwards
+void
+_entry_detach_view (Entry *self)
+{
+    LibraryTable *table = self->priv->table;
+    const gchar **extras;
+    gint i, row, num;
+
+    if (!table || (row = library_table_get_row (table, self->priv->id)) < 0) {
+        self->priv->table = NULL;
+        return;
+    }
+
+    self->priv->table = NULL;
+
+    for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+        const gchar *val = library_table_get_str (table, row, i);
+        if (val) {
+            _entry_set_tag_str (self, tag_names[i], val);
+        }
+    }
+
+    for (i = ENTRY_TAG_FIRST_INT; i < ENTRY_TAG_LAST; i++) {
+        if (library_table_get_num (table, row, i, &num)) {
+            entry_set_num (self, i, num);
+        }
+    }
+
+    extras = library_table_get_extras (table, row);
+    for (i = 0; extras && extras[i]; i += 2) {
+        _entry_set_tag_str (self, extras[i], extras[i+1]);
+    }
+}
+
+static inline gint
+entry_get_row (Entry *self)
+{
+    return library_table_get_row (self->priv->table, self->priv->id);
+}
+
 const gchar*
 entry_get_location (Entry *self)
 {
@@ -93,43 +233,44 @@ entry_get_location (Entry *self)
 gchar*
 entry_get_art (Entry *self)
 {
-    GFile *location = g_file_new_for_path (entry_get_location (self));
-    GFile *parent = g_file_get_parent (location);
-    gchar *ppath = g_file_get_path (parent);
-    GDir *dir = g_dir_open (ppath, 0, NULL);
-    const gchar *file;
-    gchar *ret = NULL;
-
-    while (dir && (file = g_dir_read_name (dir))) {
-        if (g_str_has_suffix (file, ".jpg")) {
-            ret = g_strdup_printf ("%s/%s", ppath, file);
-            break;
-        }
+    Album *album = self->priv->album;
+    gchar *ret;
 
-        if (g_str_has_suffix (file, ".bmp")) {
-            ret = g_strdup_printf ("%s/%s", ppath, file);
-            break;
-        }
+    // The art cache checks the directory each time, tracks in a folder
+    // without artwork share whatever the rest of their album found
+    ret = art_cache_lookup (entry_get_location (self));
 
-        if (g_str_has_suffix (file, ".png")) {
-            ret = g_strdup_printf ("%s/%s", ppath, file);
-            break;
-        }
+    if (ret && album) {
+        _album_set_art (album, ret);
+    } else if (!ret && album && album_get_art (album)) {
+        ret = g_strdup (album_get_art (album));
     }
 
-    if (dir) {
-        g_dir_close (dir);
+    if (!ret) {
+        ret = g_strdup (SHARE_DIR "/imgs/rhythmbox-missing-artwork.svg");
     }
 
-    g_object_unref (G_OBJECT (location));
-    g_object_unref (G_OBJECT (parent));
-    g_free (ppath);
+    return ret;
+}
 
-    if (ret) {
-        return ret;
-    } else {
-        return g_strdup (SHARE_DIR "/imgs/rhythmbox-missing-artwork.svg");
+Album*
+entry_get_album (Entry *self)
+{
+    return self->priv->album;
+}
+
+void
+_entry_set_album (Entry *self, Album *album)
+{
+    if (album) {
+        album_ref (album);
     }
+
+    if (self->priv->album) {
+        album_unref (self->priv->album);
+    }
+
+    self->priv->album = album;
 }
 
 void
@@ -156,12 +297,93 @@ entry_get_state (Entry *self)
     return self->priv->state;
 }
 
+static gboolean
+entry_flush_states (gpointer data)
+{
+    GPtrArray *entries;
+    GSList *iter;
+    guint i;
+
+    G_LOCK (states);
+
+    entries = pending_states;
+    pending_states = NULL;
+
+    for (i = 0; i < entries->len; i++) {
+        ENTRY (g_ptr_array_index (entries, i))->priv->state_queued = FALSE;
+    }
+
+    G_UNLOCK (states);
+
+    for (i = 0; i < entries->len; i++) {
+        g_signal_emit (g_ptr_array_index (entries, i), signal_state, 0);
+    }
+
+    for (iter = states_funcs; iter; iter = iter->next) {
+        StatesFunc *sf = iter->data;
+        sf->func ((Entry**) entries->pdata, entries->len, sf->user_data);
+    }
+
+    for (i = 0; i < entries->len; i++) {
+        g_object_unref (g_ptr_array_index (entries, i));
+    }
+
+    g_ptr_array_free (entries, TRUE);
+
+    return FALSE;
+}
+
 void
 entry_set_state (Entry *self, EntryState state)
 {
+    if (self->priv->state == state) {
+        return;
+    }
+
     self->priv->state = state;
 
-    g_signal_emit (G_OBJECT (self), signal_state, 0);
+    // Players flip states several times per action, so only queue the entry
+    // and let listeners see it once from the main loop
+    G_LOCK (states);
+
+    if (!self->priv->state_queued) {
+        if (!pending_states) {
+            pending_states = g_ptr_array_new ();
+            g_idle_add (entry_flush_states, NULL);
+        }
+
+        g_ptr_array_add (pending_states, g_object_ref (self));
+        self->priv->state_queued = TRUE;
+    }
+
+    G_UNLOCK (states);
+}
+
+void
+entry_add_states_func (EntryStatesFunc func, gpointer user_data)
+{
+    StatesFunc *sf = g_new0 (StatesFunc, 1);
+
+    sf->func = func;
+    sf->user_data = user_data;
+
+    states_funcs = g_slist_append (states_funcs, sf);
+}
+
+void
+entry_remove_states_func (EntryStatesFunc func, gpointer user_data)
+{
+    GSList *iter;
+
+    for (iter = states_funcs; iter; iter = iter->next) {
+        StatesFunc *sf = iter->data;
+
+        if (sf->func == func && sf->user_data == user_data) {
+            states_funcs = g_slist_delete_link (states_funcs, iter);
+            g_free (sf);
+            return;
+        }
+    }
 }
 
 gchar*
@@ -179,30 +401,273 @@ entry_get_state_string (Entry *self)
     }
 }
 
+EntryTag
+entry_tag_lookup (const gchar *tag)
+{
+    EntryTag ret;
+
+    if (!tag) {
+        return ENTRY_TAG_LAST;
+    }
+
+    // Dispatch on the first character so a miss costs at most two strcmp
+    switch (tag[0]) {
+        case 't':
+            ret = tag[1] == 'i' ? ENTRY_TAG_TITLE : ENTRY_TAG_TRACKNUMBER;
+            break;
+        case 'a':
+            ret = tag[1] && tag[2] == 't' ? ENTRY_TAG_ARTIST : ENTRY_TAG_ALBUM;
+            break;
+        case 'l':
+            ret = ENTRY_TAG_LOCATION;
+            break;
+        case 'd':
+            ret = tag[1] == 'u' ? ENTRY_TAG_DURATION : ENTRY_TAG_DISC;
+            break;
+        case 's':
+            ret = tag[1] == 'h' ? ENTRY_TAG_SHOW : ENTRY_TAG_SEASON;
+            break;
+        case 'y':
+            ret = ENTRY_TAG_YEAR;
+            break;
+        case 'b':
+            ret = ENTRY_TAG_BITRATE;
+            break;
+        case 'p':
+            ret = ENTRY_TAG_PLAYCOUNT;
+            break;
+        default:
+            return ENTRY_TAG_LAST;
+    }
+
+    return strcmp (tag, tag_names[ret]) ? ENTRY_TAG_LAST : ret;
+}
+
+const gchar*
+entry_tag_get_name (EntryTag tag)
+{
+    return tag < ENTRY_TAG_LAST ? tag_names[tag] : NULL;
+}
+
+static void
+entry_set_num (Entry *self, EntryTag slot, gint value)
+{
+    gint i = slot - ENTRY_TAG_FIRST_INT;
+
+    if (self->priv->table) {
+        library_table_set_num (self->priv->table, entry_get_row (self), slot, value);
+    } else {
+        self->priv->nums[i] = value;
+        self->priv->num_set |= 1 << i;
+    }
+
+    G_LOCK (num_strs);
+    if (self->priv->num_strs && self->priv->num_strs[i]) {
+        g_free (self->priv->num_strs[i]);
+        self->priv->num_strs[i] = NULL;
+    }
+    G_UNLOCK (num_strs);
+}
+
 void
 _entry_set_tag_str (Entry *self, const gchar *tag, const gchar *value)
 {
-    g_hash_table_insert (self->priv->table, g_strdup (tag), value ? g_strdup (value) : g_strdup (""));
+    EntryTag slot = entry_tag_lookup (tag);
+
+    if (ENTRY_TAG_IS_INT (slot)) {
+        // Values like "3/12" keep their leading number
+        entry_set_num (self, slot, value ? (gint) strtol (value, NULL, 10) : 0);
+        return;
+    }
+
+    if (!value) {
+        value = "";
+    }
+
+    if (self->priv->table) {
+        library_table_set (self->priv->table, entry_get_row (self), tag, value);
+        return;
+    }
+
+    if (slot != ENTRY_TAG_LAST) {
+        entry_free_slot (self, slot);
+        self->priv->tags[slot] = ENTRY_TAG_IS_POOLED (slot) ?
+            (gchar*) string_pool_ref (value) : g_strdup (value);
+        return;
+    }
+
+    if (!self->priv->extra) {
+        self->priv->extra = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify) string_pool_unref);
+    }
+
+    g_hash_table_insert (self->priv->extra,
+        GUINT_TO_POINTER (g_quark_from_string (tag)),
+        (gpointer) string_pool_ref (value));
+}
+
+gboolean
+entry_tag_is_pooled (const gchar *tag)
+{
+    EntryTag slot = entry_tag_lookup (tag);
+
+    return ENTRY_TAG_IS_POOLED (slot);
 }
 
 void
 _entry_set_tag_int (Entry *self, const gchar *tag, gint value)
 {
-    gchar *val = g_strdup_printf ("%d", value);
+    EntryTag slot = entry_tag_lookup (tag);
+    gchar *val;
+
+    if (ENTRY_TAG_IS_INT (slot)) {
+        entry_set_num (self, slot, value);
+        return;
+    }
+
+    val = g_strdup_printf ("%d", value);
+
+    _entry_set_tag_str (self, tag, val);
 
-    g_hash_table_insert (self->priv->table, g_strdup (tag), val);
+    g_free (val);
+}
+
+// Reads an integer slot, returns FALSE when it is not set
+static gboolean
+entry_get_num (Entry *self, EntryTag tag, gint *num)
+{
+    if (self->priv->table) {
+        return library_table_get_num (self->priv->table, entry_get_row (self), tag, num);
+    }
+
+    if (!(self->priv->num_set & (1 << (tag - ENTRY_TAG_FIRST_INT)))) {
+        return FALSE;
+    }
+
+    *num = self->priv->nums[tag - ENTRY_TAG_FIRST_INT];
+
+    return TRUE;
+}
+
+const gchar*
+entry_get_tag (Entry *self, EntryTag tag)
+{
+    const gchar *ret;
+    gint i, num;
+
+    if (tag >= ENTRY_TAG_LAST) {
+        return NULL;
+    }
+
+    if (tag < ENTRY_TAG_FIRST_INT) {
+        return self->priv->table ?
+            library_table_get_str (self->priv->table, entry_get_row (self), tag) :
+            self->priv->tags[tag];
+    }
+
+    if (!entry_get_num (self, tag, &num)) {
+        return NULL;
+    }
+
+    i = tag - ENTRY_TAG_FIRST_INT;
+
+    // Numbers are only rendered when somebody asks for them as a string, and
+    // kept until the number changes. Walks over every tag use entry_format_tag.
+    G_LOCK (num_strs);
+
+    if (!self->priv->num_strs) {
+        self->priv->num_strs = g_new0 (gchar*, ENTRY_TAG_NUM_INTS);
+    }
+
+    if (!self->priv->num_strs[i]) {
+        self->priv->num_strs[i] = g_strdup_printf ("%d", num);
+    }
+
+    ret = self->priv->num_strs[i];
+
+    G_UNLOCK (num_strs);
+
+    return ret;
+}
+
+/*
+ * Like entry_get_tag, but numbers are rendered into buf instead of being kept
+ * on the entry. Returns NULL when the tag is not set.
+ */
+const gchar*
+entry_format_tag (Entry *self, EntryTag tag, gchar *buf, gsize len)
+{
+    gint num;
+
+    if (!ENTRY_TAG_IS_INT (tag)) {
+        return entry_get_tag (self, tag);
+    }
+
+    if (!entry_get_num (self, tag, &num)) {
+        return NULL;
+    }
+
+    g_snprintf (buf, len, "%d", num);
+
+    return buf;
+}
+
+gint
+entry_get_tag_num (Entry *self, EntryTag tag)
+{
+    const gchar *val;
+    gint num;
+
+    if (self->priv->table) {
+        if (ENTRY_TAG_IS_INT (tag)) {
+            library_table_get_num (self->priv->table, entry_get_row (self), tag, &num);
+            return num;
+        }
+        val = entry_get_tag (self, tag);
+        return val ? atoi (val) : 0;
+    }
+
+    if (ENTRY_TAG_IS_INT (tag)) {
+        return self->priv->nums[tag - ENTRY_TAG_FIRST_INT];
+    } else if (tag < ENTRY_TAG_FIRST_INT && self->priv->tags[tag]) {
+        return atoi (self->priv->tags[tag]);
+    }
+
+    return 0;
 }
 
 const gchar*
 entry_get_tag_str (Entry *self, const gchar *tag)
 {
-    return g_hash_table_lookup (self->priv->table, tag);
+    EntryTag slot = entry_tag_lookup (tag);
+    GQuark quark;
+
+    if (slot != ENTRY_TAG_LAST) {
+        return entry_get_tag (self, slot);
+    }
+
+    if (self->priv->table) {
+        return library_table_get_extra (self->priv->table, entry_get_row (self), tag);
+    }
+
+    if (!self->priv->extra || !(quark = g_quark_try_string (tag))) {
+        return NULL;
+    }
+
+    return g_hash_table_lookup (self->priv->extra, GUINT_TO_POINTER (quark));
 }
 
 gint
 entry_get_tag_int (Entry *self, const gchar *tag)
 {
-    gchar *val = (gchar*) g_hash_table_lookup (self->priv->table, tag);
+    EntryTag slot = entry_tag_lookup (tag);
+    const gchar *val;
+
+    if (slot != ENTRY_TAG_LAST) {
+        return entry_get_tag_num (self, slot);
+    }
+
+    val = entry_get_tag_str (self, tag);
     return val ? atoi (val) : 0;
 }
 
@@ -212,56 +677,233 @@ entry_get_media_type (Entry *self)
     return self->priv->type;
 }
 
+gboolean
+entry_is_partial (Entry *self)
+{
+    return self->priv->partial;
+}
+
+void
+_entry_set_partial (Entry *self, gboolean partial)
+{
+    self->priv->partial = partial;
+}
+
 void
 _entry_set_media_type (Entry *self, EntryType type)
 {
     self->priv->type = type;
 }
 
-guint
-entry_get_key_value_pairs (Entry *self, gchar ***keys, gchar ***vals)
+/*
+ * The sort key is a sequence of components, each a 16 bit length followed
+ * by that many bytes. Strings are stored as their g_utf8_collate_key and
+ * numbers as big endian with the sign bit flipped, so every component
+ * orders correctly under memcmp and numbers sort naturally.
+ */
+void
+_entry_update_sort_key (Entry *self)
 {
-    guint size = g_hash_table_size (self->priv->table);
-    gchar **tkeys = g_new0 (gchar*, size+1);
-    gchar **tvals = g_new0 (gchar*, size+1);
+    guint8 *old = self->priv->sort_key;
+    const EntryTag *tags;
+    GByteArray *key = g_byte_array_new ();
     gint i;
 
-    GList *lkeys = g_hash_table_get_keys (self->priv->table);
-    for (i = 0; i < size; i++)
-        tkeys[i] = g_strdup ((gchar*) g_list_nth_data (lkeys, i));
-    g_list_free (lkeys);
+    switch (self->priv->type) {
+        case MEDIA_SONG:
+            tags = song_sort;
+            break;
+        case MEDIA_TVSHOW:
+            tags = tvshow_sort;
+            break;
+        case MEDIA_MUSIC_VIDEO:
+            tags = music_video_sort;
+            break;
+        default:
+            tags = title_sort;
+            break;
+    }
+
+    for (i = 0; tags[i] != ENTRY_TAG_LAST; i++) {
+        guint16 len;
+
+        if (ENTRY_TAG_IS_INT (tags[i])) {
+            guint32 num = (guint32) entry_get_tag_num (self, tags[i]) ^ 0x80000000;
+            guint8 buf[4] = { num >> 24, num >> 16, num >> 8, num };
+
+            len = sizeof (buf);
+            g_byte_array_append (key, (guint8*) &len, sizeof (len));
+            g_byte_array_append (key, buf, sizeof (buf));
+        } else {
+            const gchar *val = entry_get_tag (self, tags[i]);
+            gchar *ckey = g_utf8_collate_key (val ? val : "", -1);
+            gsize clen = strlen (ckey);
+
+            len = MIN (clen, G_MAXUINT16 - 1);
+            g_byte_array_append (key, (guint8*) &len, sizeof (len));
+            g_byte_array_append (key, (guint8*) ckey, len);
+
+            g_free (ckey);
+        }
+    }
+
+    // Terminate with an empty component
+    guint16 end = G_MAXUINT16;
+    g_byte_array_append (key, (guint8*) &end, sizeof (end));
+
+    self->priv->sort_key = g_byte_array_free (key, FALSE);
+    g_free (old);
+}
+
+static gint
+entry_sort_key_compare (const guint8 *k1, const guint8 *k2)
+{
+    guint16 l1, l2;
+    gint res;
+
+    for (;;) {
+        memcpy (&l1, k1, sizeof (l1));
+        memcpy (&l2, k2, sizeof (l2));
+
+        if (l1 == G_MAXUINT16 || l2 == G_MAXUINT16) {
+            return l1 == l2 ? 0 : (l1 == G_MAXUINT16 ? -1 : 1);
+        }
+
+        k1 += sizeof (l1);
+        k2 += sizeof (l2);
+
+        res = memcmp (k1, k2, MIN (l1, l2));
+        if (res != 0) {
+            return res;
+        }
+
+        if (l1 != l2) {
+            return l1 < l2 ? -1 : 1;
+        }
+
+        k1 += l1;
+        k2 += l2;
+    }
+}
+
+// Entries whose store never built their key sort first
+static const guint8 entry_empty_sort_key[] = { 0xFF, 0xFF };
+
+gint
+entry_sort_key_cmp (Entry *e1, Entry *e2)
+{
+    return entry_sort_key_compare (
+        e1->priv->sort_key ? e1->priv->sort_key : entry_empty_sort_key,
+        e2->priv->sort_key ? e2->priv->sort_key : entry_empty_sort_key);
+}
+
+static inline gboolean
+entry_has_tag (Entry *self, EntryTag tag)
+{
+    gint num;
+
+    if (self->priv->table) {
+        if (tag < ENTRY_TAG_FIRST_INT) {
+            return library_table_get_str (self->priv->table, entry_get_row (self), tag) != NULL;
+        }
+        return library_table_get_num (self->priv->table, entry_get_row (self), tag, &num);
+    }
 
-    GList *lvals = g_hash_table_get_values (self->priv->table);
-    for (i = 0; i < size; i++)
-        tvals[i] = g_strdup ((gchar*) g_list_nth_data (lvals, i));
-    g_list_free (lvals);
+    if (tag < ENTRY_TAG_FIRST_INT) {
+        return self->priv->tags[tag] != NULL;
+    }
 
-    *keys = tkeys;
-    *vals = tvals;
+    return (self->priv->num_set & (1 << (tag - ENTRY_TAG_FIRST_INT))) != 0;
+}
 
-    return size;
+void
+entry_tag_iter_init (EntryTagIter *iter, Entry *entry)
+{
+    iter->entry = entry;
+    iter->slot = 0;
 }
 
-gchar**
-entry_get_kvs (Entry *self)
+gboolean
+entry_tag_iter_next (EntryTagIter *iter, const gchar **key, const gchar **value)
 {
-    GList *keys, *vals, *ki, *vi;
-    guint i, size;
-    gchar **kvs;
+    EntryPrivate *priv = iter->entry->priv;
+    gpointer k, v;
+
+    for (; iter->slot < ENTRY_TAG_LAST; iter->slot++) {
+        if (entry_has_tag (iter->entry, iter->slot)) {
+            *key = tag_names[iter->slot];
+            *value = ENTRY_TAG_IS_INT (iter->slot) ?
+                entry_format_tag (iter->entry, iter->slot,
+                    iter->nums[iter->slot - ENTRY_TAG_FIRST_INT], sizeof (iter->nums[0])) :
+                entry_get_tag (iter->entry, iter->slot);
+            iter->slot++;
+            return TRUE;
+        }
+    }
+
+    // Extras of a view are an array of pairs, slot counts past ENTRY_TAG_LAST
+    if (priv->table) {
+        const gchar **extras = library_table_get_extras (priv->table, entry_get_row (iter->entry));
+        gint i = (iter->slot - ENTRY_TAG_LAST) * 2;
+
+        if (!extras || !extras[i]) {
+            return FALSE;
+        }
+
+        *key = extras[i];
+        *value = extras[i+1];
+        iter->slot++;
+
+        return TRUE;
+    }
+
+    if (!priv->extra) {
+        return FALSE;
+    }
+
+    // Slots are done, continue with the fallback table
+    if (iter->slot == ENTRY_TAG_LAST) {
+        g_hash_table_iter_init (&iter->extra, priv->extra);
+        iter->slot++;
+    }
+
+    if (!g_hash_table_iter_next (&iter->extra, &k, &v)) {
+        return FALSE;
+    }
+
+    *key = g_quark_to_string (GPOINTER_TO_UINT (k));
+    *value = v;
 
-    size = g_hash_table_size (self->priv->table);
+    return TRUE;
+}
 
-    kvs = g_new0 (gchar*, 2 * size + 1);
+void
+entry_foreach_tag (Entry *self, EntryTagFunc func, gpointer user_data)
+{
+    EntryTagIter iter;
+    const gchar *key, *value;
 
-    keys = g_hash_table_get_keys (self->priv->table);
-    vals = g_hash_table_get_values (self->priv->table);
-    for (ki = keys, vi = vals, i = 0; ki && vi; ki = ki->next, vi = vi->next) {
-        kvs[i++] = g_strdup ((gchar*) ki->data);
-        kvs[i++] = g_strdup ((gchar*) vi->data);
+    entry_tag_iter_init (&iter, self);
+    while (entry_tag_iter_next (&iter, &key, &value)) {
+        func (key, value, user_data);
     }
+}
 
-    g_list_free (keys);
-    g_list_free (vals);
+// Appends borrowed key, value pairs to kvs and returns the number of pairs,
+// the array can be reused between entries with g_ptr_array_set_size. Numbers
+// are rendered into iter, the pairs are only valid as long as it is.
+guint
+entry_get_tags (Entry *self, EntryTagIter *iter, GPtrArray *kvs)
+{
+    const gchar *key, *value;
+    guint n = 0;
+
+    entry_tag_iter_init (iter, self);
+    while (entry_tag_iter_next (iter, &key, &value)) {
+        g_ptr_array_add (kvs, (gpointer) key);
+        g_ptr_array_add (kvs, (gpointer) value);
+        n++;
+    }
 
-    return kvs;
+    return n;
 }
@@ -24,6 +24,8 @@
 
 #include <glib-object.h>
 
+#include "album.h"
+
 #define ENTRY_TYPE (entry_get_type ())
 #define ENTRY(object) (G_TYPE_CHECK_INSTANCE_CAST ((object), ENTRY_TYPE, Entry))
 #define ENTRY_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), ENTRY_TYPE, EntryClass))
@@ -46,12 +48,52 @@ typedef enum {
     MEDIA_TVSHOW,
 } EntryType;
 
+// Tags with a fixed slot inside every Entry, anything else is kept in a
+// per-entry fallback table keyed by GQuark. Tags from ENTRY_TAG_FIRST_INT
+// on are stored as native integers.
+typedef enum {
+    ENTRY_TAG_TITLE = 0,
+    ENTRY_TAG_ARTIST,
+    ENTRY_TAG_ALBUM,
+    ENTRY_TAG_LOCATION,
+    ENTRY_TAG_SHOW,
+    ENTRY_TAG_DURATION,
+    ENTRY_TAG_TRACKNUMBER,
+    ENTRY_TAG_SEASON,
+    ENTRY_TAG_YEAR,
+    ENTRY_TAG_DISC,
+    ENTRY_TAG_BITRATE,
+    ENTRY_TAG_PLAYCOUNT,
+    ENTRY_TAG_LAST,
+} EntryTag;
+
+#define ENTRY_TAG_FIRST_INT ENTRY_TAG_DURATION
+#define ENTRY_TAG_NUM_INTS (ENTRY_TAG_LAST - ENTRY_TAG_FIRST_INT)
+#define ENTRY_TAG_IS_INT(tag) ((tag) >= ENTRY_TAG_FIRST_INT && (tag) < ENTRY_TAG_LAST)
+
+// Values of these slots, and of every tag outside the fixed slots, are shared
+// through the string pool since they repeat across many entries
+#define ENTRY_TAG_IS_POOLED(tag) ((tag) == ENTRY_TAG_ARTIST || \
+    (tag) == ENTRY_TAG_ALBUM || (tag) == ENTRY_TAG_SHOW || (tag) == ENTRY_TAG_LAST)
+
 G_BEGIN_DECLS
 
 typedef struct _Entry Entry;
 typedef struct _EntryClass EntryClass;
 typedef struct _EntryPrivate EntryPrivate;
+struct _LibraryTable;
 typedef gint (*EntryCompareFunc) (Entry *e1, Entry *e2);
+typedef void (*EntryTagFunc) (const gchar *key, const gchar *value, gpointer user_data);
+typedef void (*EntryStatesFunc) (Entry **entries, guint len, gpointer user_data);
+
+// Walks the tags of an entry, keys and values are borrowed from the entry
+// except numbers, which are rendered into the iterator
+typedef struct {
+    Entry *entry;
+    gint slot;
+    GHashTableIter extra;
+    gchar nums[ENTRY_TAG_NUM_INTS][12];
+} EntryTagIter;
 
 struct _Entry {
     GObject parent;
@@ -67,21 +109,43 @@ GType entry_get_type (void);
 
 guint entry_get_id (Entry *self);
 
+EntryTag entry_tag_lookup (const gchar *tag);
+const gchar *entry_tag_get_name (EntryTag tag);
+// Values of pooled tags are shared between entries and compare by pointer
+gboolean entry_tag_is_pooled (const gchar *tag);
+
 const gchar *entry_get_tag_str (Entry *self, const gchar *tag);
 gint entry_get_tag_int (Entry *self, const gchar *tag);
+const gchar *entry_get_tag (Entry *self, EntryTag tag);
+const gchar *entry_format_tag (Entry *self, EntryTag tag, gchar *buf, gsize len);
+gint entry_get_tag_num (Entry *self, EntryTag tag);
 
 const gchar *entry_get_location (Entry *self);
 
 gchar *entry_get_art (Entry *self);
+Album *entry_get_album (Entry *self);
 
 EntryState entry_get_state (Entry *self);
 void entry_set_state (Entry *self, EntryState state);
 gchar *entry_get_state_image (Entry *self);
 
+// State changes are collected and delivered once per main loop iteration
+void entry_add_states_func (EntryStatesFunc func, gpointer user_data);
+void entry_remove_states_func (EntryStatesFunc func, gpointer user_data);
+
 EntryType entry_get_media_type (Entry *self);
 
-guint entry_get_key_value_pairs (Entry *self, gchar ***keys, gchar ***vals);
-gchar **entry_get_kvs (Entry *self);
+// Partial entries only carry the tags their store loaded at startup, use
+// media_store_hydrate_entries before reading all of their tags
+gboolean entry_is_partial (Entry *self);
+
+gint entry_sort_key_cmp (Entry *e1, Entry *e2);
+
+void entry_tag_iter_init (EntryTagIter *iter, Entry *entry);
+gboolean entry_tag_iter_next (EntryTagIter *iter, const gchar **key, const gchar **value);
+
+void entry_foreach_tag (Entry *self, EntryTagFunc func, gpointer user_data);
+guint entry_get_tags (Entry *self, EntryTagIter *iter, GPtrArray *kvs);
 
 // These functions should only be used inside the MediaStore object
 Entry *_entry_new (guint id);
@@ -90,6 +154,15 @@ void   _entry_set_tag_str (Entry *self, const gchar *tag, const gchar *value);
 void   _entry_set_tag_int (Entry *self, const gchar *tag, gint value);
 void   _entry_set_location (Entry *self, const gchar *location);
 void   _entry_set_media_type (Entry *self, guint type);
+void   _entry_set_album (Entry *self, Album *album);
+void   _entry_set_partial (Entry *self, gboolean partial);
+
+// Sort keys are not kept up to date by the setters, stores rebuild them once
+// the tags of a new or changed entry are written, under the same lock
+void   _entry_update_sort_key (Entry *self);
+
+Entry *_entry_new_view (guint id, struct _LibraryTable *table);
+void   _entry_detach_view (Entry *self);
 
 G_END_DECLS
 
@@ -0,0 +1,512 @@
+/*
+ *      folder-watcher.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "../config.h"
+
+#include <string.h>
+#include <gtk/gtk.h>
+#include <gio/gio.h>
+
+#include "folder-watcher.h"
+#include "media-store.h"
+#include "stat-cache.h"
+
+// Changes are handed on once the folders were quiet for this many ms...
+#define FOLDER_WATCHER_QUIET 2000
+
+// ...or once they have been piling up for this many seconds
+#define FOLDER_WATCHER_MAX_WAIT 10.0
+
+G_DEFINE_TYPE(FolderWatcher, folder_watcher, G_TYPE_OBJECT)
+
+typedef enum {
+    FOLDER_CHANGE_ADD,
+    FOLDER_CHANGE_DELETE
+} FolderChangeType;
+
+typedef struct {
+    FolderChangeType type;
+
+    // Adds: the store to import into, and the old location of a renamed file
+    gchar *mtype;
+    gchar *moved_from;
+
+    // Deletes: the location was a directory
+    gboolean dir;
+} FolderChange;
+
+struct _FolderWatcherPrivate {
+    Shell *shell;
+    TagReader *reader;
+
+    // Watched root -> media type, "" to let the reader decide
+    GHashTable *roots;
+
+    // Directory -> GFileMonitor, inotify does not watch subdirectories
+    GHashTable *monitors;
+
+    // Location -> FolderChange, only the last change to a file counts
+    GHashTable *pending;
+    guint flush_id;
+    GTimer *waiting;
+};
+
+static void folder_watcher_changed (GFileMonitor *monitor, GFile *file, GFile *other,
+    GFileMonitorEvent event, FolderWatcher *self);
+
+static void
+folder_watcher_free_change (FolderChange *fc)
+{
+    g_free (fc->mtype);
+    g_free (fc->moved_from);
+    g_free (fc);
+}
+
+static void
+folder_watcher_free_monitor (GFileMonitor *monitor)
+{
+    g_file_monitor_cancel (monitor);
+    g_object_unref (monitor);
+}
+
+static void
+folder_watcher_free_list (GPtrArray *list)
+{
+    g_ptr_array_free (list, TRUE);
+}
+
+static GHashTable*
+folder_watcher_new_pending (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) folder_watcher_free_change);
+}
+
+static void
+folder_watcher_finalize (GObject *object)
+{
+    FolderWatcher *self = FOLDER_WATCHER (object);
+
+    if (self->priv->flush_id) {
+        g_source_remove (self->priv->flush_id);
+    }
+
+    g_hash_table_unref (self->priv->monitors);
+    g_hash_table_unref (self->priv->roots);
+    g_hash_table_unref (self->priv->pending);
+    g_timer_destroy (self->priv->waiting);
+
+    if (self->priv->reader) {
+        g_object_unref (self->priv->reader);
+    }
+
+    if (self->priv->shell) {
+        g_object_unref (self->priv->shell);
+    }
+
+    G_OBJECT_CLASS (folder_watcher_parent_class)->finalize (object);
+}
+
+static void
+folder_watcher_class_init (FolderWatcherClass *klass)
+{
+    GObjectClass *object_class;
+    object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private ((gpointer) klass, sizeof (FolderWatcherPrivate));
+
+    object_class->finalize = folder_watcher_finalize;
+}
+
+static void
+folder_watcher_init (FolderWatcher *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE((self), FOLDER_WATCHER_TYPE, FolderWatcherPrivate);
+
+    self->priv->roots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    self->priv->monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) folder_watcher_free_monitor);
+    self->priv->pending = folder_watcher_new_pending ();
+    self->priv->waiting = g_timer_new ();
+}
+
+FolderWatcher*
+folder_watcher_new (Shell *shell, TagReader *reader)
+{
+    FolderWatcher *self = g_object_new (FOLDER_WATCHER_TYPE, NULL);
+
+    self->priv->shell = g_object_ref (shell);
+    self->priv->reader = g_object_ref (reader);
+
+    return self;
+}
+
+// Paths are compared as GIO reports them, without trailing or double slashes
+static gchar*
+folder_watcher_canonical (const gchar *path)
+{
+    GFile *file = g_file_new_for_path (path);
+    gchar *res = g_file_get_path (file);
+
+    g_object_unref (file);
+
+    return res;
+}
+
+static gboolean
+folder_watcher_is_below (const gchar *path, const gchar *dir)
+{
+    gsize len = strlen (dir);
+
+    return !strncmp (path, dir, len) && (path[len] == '/' || path[len] == '\0');
+}
+
+static const gchar*
+folder_watcher_get_mtype (FolderWatcher *self, const gchar *path)
+{
+    GHashTableIter iter;
+    const gchar *root, *mtype;
+
+    g_hash_table_iter_init (&iter, self->priv->roots);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &root, (gpointer*) &mtype)) {
+        if (folder_watcher_is_below (path, root)) {
+            return *mtype ? mtype : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Hands the pending changes on in one go: renamed files keep their entries,
+ * deleted ones leave the library together, and the rest is queued on the tag
+ * reader, which batches the adds it makes to the stores.
+ */
+static gboolean
+folder_watcher_flush (FolderWatcher *self)
+{
+    StatCache *stats = tag_reader_get_stat_cache (self->priv->reader);
+    GHashTable *pending, *removed, *stores;
+    GHashTableIter iter;
+    const gchar *location;
+    FolderChange *fc;
+    MediaStore *ms;
+    Entry *entry;
+    GPtrArray *list;
+    guint id;
+    gint i;
+
+    // Renames and deletes need the whole library, try again once it is in
+    if (!shell_is_loaded (self->priv->shell)) {
+        return TRUE;
+    }
+
+    pending = self->priv->pending;
+    self->priv->pending = folder_watcher_new_pending ();
+    self->priv->flush_id = 0;
+
+    gdk_threads_enter ();
+
+    // Renames first, so the deletes of the old locations find nothing
+    g_hash_table_iter_init (&iter, pending);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &location, (gpointer*) &fc)) {
+        if (fc->type != FOLDER_CHANGE_ADD || !fc->moved_from) {
+            continue;
+        }
+
+        if ((ms = shell_find_location (self->priv->shell, fc->moved_from, &id, NULL))) {
+            gchar *kvs[] = { "location", (gchar*) location, NULL };
+            media_store_update_entry (ms, id, kvs);
+        }
+
+        stat_cache_remove (stats, fc->moved_from);
+    }
+
+    // Entry -> MediaStore, a file can go both on its own and with its folder.
+    // Holds the references media_store_get_entry returns.
+    removed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        g_object_unref, NULL);
+
+    g_hash_table_iter_init (&iter, pending);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &location, (gpointer*) &fc)) {
+        GPtrArray *gone;
+
+        if (fc->type != FOLDER_CHANGE_DELETE) {
+            continue;
+        }
+
+        if (fc->dir) {
+            GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+            gone = stat_cache_sweep (stats, location, seen);
+            g_hash_table_unref (seen);
+        } else {
+            gone = g_ptr_array_new ();
+            g_ptr_array_add (gone, g_strdup (location));
+            stat_cache_remove (stats, location);
+        }
+
+        for (i = 0; i < gone->len; i++) {
+            ms = shell_find_location (self->priv->shell, g_ptr_array_index (gone, i), &id, NULL);
+            if (ms && (entry = media_store_get_entry (ms, id))) {
+                g_hash_table_insert (removed, entry, ms);
+            }
+        }
+
+        g_ptr_array_foreach (gone, (GFunc) g_free, NULL);
+        g_ptr_array_free (gone, TRUE);
+    }
+
+    // MediaStore -> GPtrArray of its removed entries
+    stores = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+        (GDestroyNotify) folder_watcher_free_list);
+
+    g_hash_table_iter_init (&iter, removed);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &entry, (gpointer*) &ms)) {
+        if (!(list = g_hash_table_lookup (stores, ms))) {
+            list = g_ptr_array_new ();
+            g_hash_table_insert (stores, ms, list);
+        }
+
+        g_ptr_array_add (list, entry);
+    }
+
+    g_hash_table_iter_init (&iter, stores);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &ms, (gpointer*) &list)) {
+        media_store_remove_entries (ms, (Entry**) list->pdata, list->len);
+    }
+
+    g_hash_table_unref (stores);
+    g_hash_table_unref (removed);
+
+    gdk_threads_leave ();
+
+    // Renamed files are found unchanged at their new location and skipped
+    g_hash_table_iter_init (&iter, pending);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &location, (gpointer*) &fc)) {
+        if (fc->type == FOLDER_CHANGE_ADD) {
+            tag_reader_queue_entry (self->priv->reader, location, fc->mtype);
+        }
+    }
+
+    g_hash_table_unref (pending);
+
+    return FALSE;
+}
+
+/*
+ * Records a change and pushes the flush back until the folders settle, so a
+ * whole album landing at once is handed on as one batch. A steady trickle of
+ * changes still gets flushed every FOLDER_WATCHER_MAX_WAIT seconds.
+ */
+static void
+folder_watcher_queue (FolderWatcher *self,
+                      const gchar *location,
+                      FolderChangeType type,
+                      const gchar *moved_from,
+                      gboolean dir)
+{
+    FolderChange *fc = g_new0 (FolderChange, 1);
+    FolderChange *old = g_hash_table_lookup (self->priv->pending, location);
+
+    fc->type = type;
+    fc->dir = dir;
+
+    if (type == FOLDER_CHANGE_ADD) {
+        fc->mtype = g_strdup (folder_watcher_get_mtype (self, location));
+        fc->moved_from = g_strdup (moved_from);
+
+        // A renamed file that is then written to is still a rename
+        if (!moved_from && old && old->type == FOLDER_CHANGE_ADD) {
+            fc->moved_from = g_strdup (old->moved_from);
+        }
+    }
+
+    g_hash_table_insert (self->priv->pending, g_strdup (location), fc);
+
+    if (!self->priv->flush_id) {
+        g_timer_start (self->priv->waiting);
+    } else if (g_timer_elapsed (self->priv->waiting, NULL) < FOLDER_WATCHER_MAX_WAIT) {
+        g_source_remove (self->priv->flush_id);
+    } else {
+        return;
+    }
+
+    self->priv->flush_id = g_timeout_add (FOLDER_WATCHER_QUIET,
+        (GSourceFunc) folder_watcher_flush, self);
+}
+
+static gboolean
+folder_watcher_is_dir (const gchar *path)
+{
+    return g_file_test (path, G_FILE_TEST_IS_DIR) &&
+        !g_file_test (path, G_FILE_TEST_IS_SYMLINK);
+}
+
+/*
+ * Starts monitoring a directory and those below it. With queue set, the files
+ * found are queued as well, those of a renamed directory as renames from
+ * below moved_from.
+ */
+static void
+folder_watcher_watch_dir (FolderWatcher *self,
+                          const gchar *path,
+                          gboolean queue,
+                          const gchar *moved_from)
+{
+    GFileMonitor *monitor;
+    GFile *file;
+    GDir *dir;
+    const gchar *name;
+
+    if (g_hash_table_lookup (self->priv->monitors, path)) {
+        return;
+    }
+
+    file = g_file_new_for_path (path);
+    monitor = g_file_monitor_directory (file, G_FILE_MONITOR_SEND_MOVED, NULL, NULL);
+    g_object_unref (file);
+
+    if (!monitor) {
+        return;
+    }
+
+    g_signal_connect (monitor, "changed", G_CALLBACK (folder_watcher_changed), self);
+    g_hash_table_insert (self->priv->monitors, g_strdup (path), monitor);
+
+    if (!(dir = g_dir_open (path, 0, NULL))) {
+        return;
+    }
+
+    while ((name = g_dir_read_name (dir))) {
+        gchar *child = g_build_filename (path, name, NULL);
+        gchar *old = moved_from ? g_build_filename (moved_from, name, NULL) : NULL;
+
+        if (folder_watcher_is_dir (child)) {
+            folder_watcher_watch_dir (self, child, queue, old);
+        } else if (queue) {
+            folder_watcher_queue (self, child, FOLDER_CHANGE_ADD, old, FALSE);
+        }
+
+        g_free (child);
+        g_free (old);
+    }
+
+    g_dir_close (dir);
+}
+
+static void
+folder_watcher_unwatch_dir (FolderWatcher *self, const gchar *path)
+{
+    GHashTableIter iter;
+    const gchar *dir;
+
+    g_hash_table_iter_init (&iter, self->priv->monitors);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &dir, NULL)) {
+        if (folder_watcher_is_below (dir, path)) {
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+}
+
+static void
+folder_watcher_changed (GFileMonitor *monitor,
+                        GFile *file,
+                        GFile *other,
+                        GFileMonitorEvent event,
+                        FolderWatcher *self)
+{
+    gchar *path = g_file_get_path (file);
+    gchar *new_path;
+    gboolean was_dir;
+
+    if (!path) {
+        return;
+    }
+
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+        if (folder_watcher_is_dir (path)) {
+            folder_watcher_watch_dir (self, path, TRUE, NULL);
+        } else {
+            folder_watcher_queue (self, path, FOLDER_CHANGE_ADD, NULL, FALSE);
+        }
+        break;
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        if (!g_hash_table_lookup (self->priv->monitors, path)) {
+            folder_watcher_queue (self, path, FOLDER_CHANGE_ADD, NULL, FALSE);
+        }
+        break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+        was_dir = g_hash_table_lookup (self->priv->monitors, path) != NULL;
+        if (was_dir) {
+            folder_watcher_unwatch_dir (self, path);
+        }
+        folder_watcher_queue (self, path, FOLDER_CHANGE_DELETE, NULL, was_dir);
+        break;
+    case G_FILE_MONITOR_EVENT_MOVED:
+        if (!other || !(new_path = g_file_get_path (other))) {
+            break;
+        }
+
+        was_dir = g_hash_table_lookup (self->priv->monitors, path) != NULL;
+        if (was_dir) {
+            folder_watcher_unwatch_dir (self, path);
+        }
+        folder_watcher_queue (self, path, FOLDER_CHANGE_DELETE, NULL, was_dir);
+
+        if (folder_watcher_is_dir (new_path)) {
+            folder_watcher_watch_dir (self, new_path, TRUE, path);
+        } else {
+            folder_watcher_queue (self, new_path, FOLDER_CHANGE_ADD, path, FALSE);
+        }
+
+        g_free (new_path);
+        break;
+    default:
+        break;
+    }
+
+    g_free (path);
+}
+
+void
+folder_watcher_add (FolderWatcher *self, const gchar *path, const gchar *media_type)
+{
+    gchar *root = folder_watcher_canonical (path);
+
+    g_hash_table_insert (self->priv->roots, g_strdup (root),
+        g_strdup (media_type ? media_type : ""));
+    folder_watcher_watch_dir (self, root, FALSE, NULL);
+
+    g_free (root);
+}
+
+void
+folder_watcher_remove (FolderWatcher *self, const gchar *path)
+{
+    gchar *root = folder_watcher_canonical (path);
+
+    g_hash_table_remove (self->priv->roots, root);
+    folder_watcher_unwatch_dir (self, root);
+
+    g_free (root);
+}
@@ -0,0 +1,63 @@
+/*
+ *      folder-watcher.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __FOLDER_WATCHER_H__
+#define __FOLDER_WATCHER_H__
+
+#include <glib-object.h>
+#include "shell.h"
+#include "tag-reader.h"
+
+#define FOLDER_WATCHER_TYPE (folder_watcher_get_type ())
+#define FOLDER_WATCHER(object) (G_TYPE_CHECK_INSTANCE_CAST ((object), FOLDER_WATCHER_TYPE, FolderWatcher))
+#define FOLDER_WATCHER_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), FOLDER_WATCHER_TYPE, FolderWatcherClass))
+#define IS_FOLDER_WATCHER(object) (G_TYPE_CHECK_INSTANCE_TYPE ((object), FOLDER_WATCHER_TYPE))
+#define IS_FOLDER_WATCHER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FOLDER_WATCHER_TYPE))
+#define FOLDER_WATCHER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), FOLDER_WATCHER_TYPE, FolderWatcherClass))
+
+G_BEGIN_DECLS
+
+typedef struct _FolderWatcher FolderWatcher;
+typedef struct _FolderWatcherClass FolderWatcherClass;
+typedef struct _FolderWatcherPrivate FolderWatcherPrivate;
+
+struct _FolderWatcher {
+    GObject parent;
+
+    FolderWatcherPrivate *priv;
+};
+
+struct _FolderWatcherClass {
+    GObjectClass parent;
+};
+
+FolderWatcher *folder_watcher_new (Shell *shell, TagReader *reader);
+GType folder_watcher_get_type (void);
+
+// Follows a library root and every directory below it, feeding changed files
+// to the tag reader and dropping deleted ones from the library. media_type
+// may be NULL to let the reader pick the store.
+void folder_watcher_add (FolderWatcher *self, const gchar *path, const gchar *media_type);
+void folder_watcher_remove (FolderWatcher *self, const gchar *path);
+
+G_END_DECLS
+
+#endif /* __FOLDER_WATCHER_H__ */
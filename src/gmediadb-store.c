@@ -20,11 +20,19 @@
  */
 
 #include <gmediadb.h>
+#include <string.h>
 
 #include "gmediadb-store.h"
 #include "media-store.h"
+#include "entry-table.h"
+#include "library-table.h"
+#include "string-pool.h"
+#include "library-snapshot.h"
 #include "shell.h"
 
+// Number of entries announced at once while loading in the background
+#define GMEDIADB_STORE_CHUNK 512
+
 static void media_store_init (MediaStoreInterface *iface);
 G_DEFINE_TYPE_WITH_CODE (GMediaDBStore, gmediadb_store, G_TYPE_OBJECT,
     G_IMPLEMENT_INTERFACE (MEDIA_STORE_TYPE, media_store_init)
@@ -37,27 +45,84 @@ struct _GMediaDBStorePrivate {
     gint mtype;
     gchar *media_type;
 
-    GHashTable *entries;
+    EntryTable *entries;
+
+    // Held while entries, table or artists change and during walks, entries
+    // are added from the tag reader thread. Never held while taking the
+    // media store indexes lock, which comes first.
+    GStaticRecMutex lock;
+
+    // Set in columnar mode, entries then only hold views into it
+    LibraryTable *table;
+
+    // Tags loaded at startup, NULL when entries are loaded whole
+    gchar **load_tags;
+
+    // Bumped on the first change seen after a snapshot was written, so a
+    // crash before the next one leaves it unused. Changes made elsewhere are
+    // caught by the rows in the signature instead.
+    guint64 generation;
+    gboolean dirty;
+
+    // Background loading, see GMEDIADB_STORE_ASYNC. published is set once
+    // every loaded entry is announced, loaded once the changes held back
+    // meanwhile are applied too, from replay_source on the main loop.
+    GThread *loader;
+    gboolean published, loaded, cancel, high;
+    guint replay_source;
+
+    // Changes seen from gmediadb before the load finished, applied in order
+    // once it has. Guarded by defer_mutex, ready is set after the last one.
+    GArray *deferred;
+    GMutex *defer_mutex;
+    gboolean ready;
+
+    // Artist name (pooled pointer) -> Artist
+    GHashTable *artists;
 };
 
 static void gmediadb_store_class_init (GMediaDBStoreClass *klass);
 static void gmediadb_store_init (GMediaDBStore *self);
 static void gmediadb_store_finalize (GObject *object);
 
+// Stores loading with high priority, the others wait between chunks until
+// they are done
+static GMutex *load_mutex = NULL;
+static GCond *load_cond = NULL;
+static gint num_high = 0;
+
+static void gmediadb_store_load (GMediaDBStore *self, gboolean publish);
+static gpointer gmediadb_store_load_thread (GMediaDBStore *self);
+
 // Interface methods
 static void gmediadb_store_add_entry (MediaStore *self, gchar **entry);
 static void gmediadb_store_update_entry (MediaStore *self, guint id, gchar **entry);
 static void gmediadb_store_remove_entry (MediaStore *self, Entry *entry);
+static void gmediadb_store_add_entries (MediaStore *self, gchar ***entries, guint len);
+static void gmediadb_store_remove_entries (MediaStore *self, Entry **entries, guint len);
 static guint gmediadb_store_get_mtype (MediaStore *self);
 static gchar *gmediadb_store_get_name (MediaStore *self);
 static Entry **gmediadb_store_get_all_entries (MediaStore *self);
+static void gmediadb_store_foreach (MediaStore *self, MediaStoreFunc func, gpointer user_data);
 static Entry *gmediadb_store_get_entry (MediaStore *self, guint id);
+static Artist **gmediadb_store_get_artists (MediaStore *self);
+static const gchar **gmediadb_store_get_column (MediaStore *self, EntryTag tag, guint *len);
+static void gmediadb_store_hydrate (MediaStore *self, Entry **entries, guint len);
 
 // Signals from GMediaDB
 static void gmediadb_store_gmediadb_add (GMediaDBStore *self, guint id, GMediaDB *db);
 static void gmediadb_store_gmediadb_remove (GMediaDBStore *self, guint id, GMediaDB *db);
 static void gmediadb_store_gmediadb_update (GMediaDBStore *self, guint id, GMediaDB *db);
 
+static void gmediadb_store_apply_add (GMediaDBStore *self, guint id);
+static void gmediadb_store_apply_remove (GMediaDBStore *self, guint id);
+static void gmediadb_store_apply_update (GMediaDBStore *self, guint id);
+
+typedef struct {
+    MediaStoreChangeType type;
+    guint id;
+} DeferredChange;
+
 static void
 gmediadb_store_class_init (GMediaDBStoreClass *klass)
 {
@@ -67,6 +132,9 @@ gmediadb_store_class_init (GMediaDBStoreClass *klass)
     g_type_class_add_private ((gpointer) klass, sizeof (GMediaDBStorePrivate));
 
     object_class->finalize = gmediadb_store_finalize;
+
+    load_mutex = g_mutex_new ();
+    load_cond = g_cond_new ();
 }
 
 static void
@@ -75,11 +143,17 @@ media_store_init (MediaStoreInterface *iface)
     iface->add_entry = gmediadb_store_add_entry;
     iface->up_entry = gmediadb_store_update_entry;
     iface->rem_entry = gmediadb_store_remove_entry;
+    iface->add_entries = gmediadb_store_add_entries;
+    iface->rem_entries = gmediadb_store_remove_entries;
     iface->get_mtype = gmediadb_store_get_mtype;
     iface->get_name  = gmediadb_store_get_name;
 
     iface->get_all_entries = gmediadb_store_get_all_entries;
+    iface->foreach = gmediadb_store_foreach;
     iface->get_entry = gmediadb_store_get_entry;
+    iface->get_artists = gmediadb_store_get_artists;
+    iface->get_column = gmediadb_store_get_column;
+    iface->hydrate = gmediadb_store_hydrate;
 }
 
 static void
@@ -87,7 +161,12 @@ gmediadb_store_init (GMediaDBStore *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE((self), GMEDIADB_STORE_TYPE, GMediaDBStorePrivate);
 
-    self->priv->entries = g_hash_table_new_full (g_int_hash, g_int_equal, g_free, g_object_unref);
+    self->priv->entries = entry_table_new ();
+    g_static_rec_mutex_init (&self->priv->lock);
+    self->priv->artists = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) artist_unref);
+    self->priv->deferred = g_array_new (FALSE, FALSE, sizeof (DeferredChange));
+    self->priv->defer_mutex = g_mutex_new ();
 }
 
 static void
@@ -95,49 +174,448 @@ gmediadb_store_finalize (GObject *object)
 {
     GMediaDBStore *self = GMEDIADB_STORE (object);
 
+    if (self->priv->loader) {
+        g_mutex_lock (load_mutex);
+        self->priv->cancel = TRUE;
+        g_cond_broadcast (load_cond);
+        g_mutex_unlock (load_mutex);
+
+        g_thread_join (self->priv->loader);
+        self->priv->loader = NULL;
+    }
+
+    if (self->priv->replay_source) {
+        g_source_remove (self->priv->replay_source);
+        self->priv->replay_source = 0;
+    }
+
+    if (self->priv->entries) {
+        gmediadb_store_save_snapshot (self);
+    }
+
     if (self->priv->db) {
         g_object_unref (self->priv->db);
         self->priv->db = NULL;
     }
 
     if (self->priv->entries) {
-        g_hash_table_unref (self->priv->entries);
+        entry_table_free (self->priv->entries);
         self->priv->entries = NULL;
     }
 
+    if (self->priv->table) {
+        library_table_free (self->priv->table);
+        self->priv->table = NULL;
+    }
+
+    g_strfreev (self->priv->load_tags);
+    self->priv->load_tags = NULL;
+
+    if (self->priv->artists) {
+        g_hash_table_unref (self->priv->artists);
+        self->priv->artists = NULL;
+    }
+
+    g_array_free (self->priv->deferred, TRUE);
+    g_mutex_free (self->priv->defer_mutex);
+
+    g_static_rec_mutex_free (&self->priv->lock);
+
     G_OBJECT_CLASS (gmediadb_store_parent_class)->finalize (object);
 }
 
-GMediaDBStore*
-gmediadb_store_new (gchar *media_type, gint mtype)
+static void
+gmediadb_store_attach_album (GMediaDBStore *self, Entry *e)
 {
-    GMediaDBStore *self = g_object_new (GMEDIADB_STORE_TYPE, NULL);
+    // Artist and album values are pooled, so the records are keyed by pointer
+    const gchar *artist_name = entry_get_tag (e, ENTRY_TAG_ARTIST);
+    const gchar *album_name = entry_get_tag (e, ENTRY_TAG_ALBUM);
+    Artist *artist;
+    Album *album;
 
-    self->priv->mtype = mtype;
-    self->priv->media_type = g_strdup (media_type);
+    artist = g_hash_table_lookup (self->priv->artists, artist_name);
+    if (!artist) {
+        artist = _artist_new (artist_name);
+        g_hash_table_insert (self->priv->artists,
+            (gpointer) artist_get_name (artist), artist);
+    }
 
-    self->priv->db = gmediadb_new (media_type);
+    album = _artist_get_album (artist, album_name);
+    if (!album) {
+        album = _artist_add_album (artist, album_name);
+        _album_set_year (album, entry_get_tag_num (e, ENTRY_TAG_YEAR));
+        _album_set_genre (album, entry_get_tag_str (e, "genre"));
+    }
+
+    _album_add_entry (album);
+    _entry_set_album (e, album);
+}
+
+static void
+gmediadb_store_detach_album (GMediaDBStore *self, Entry *e)
+{
+    Album *album = entry_get_album (e);
+    Artist *artist;
+
+    if (!album) {
+        return;
+    }
+
+    artist = album_get_artist (album);
+    _album_remove_entry (album);
+
+    if (artist && album_get_num_entries (album) == 0) {
+        _artist_remove_album (artist, album);
+
+        if (artist_get_num_entries (artist) == 0) {
+            g_hash_table_remove (self->priv->artists, artist_get_name (artist));
+        }
+    }
+
+    _entry_set_album (e, NULL);
+}
+
+/*
+ * Returns a new reference to the entry for id. In columnar mode rows without
+ * a view get one that is not kept by the store, so walks that only read tags
+ * do not leave a view behind for every row. Anything holding on to the entry
+ * has to get it through gmediadb_store_lookup instead. Call with the lock held.
+ */
+static Entry*
+gmediadb_store_peek (GMediaDBStore *self, guint id)
+{
+    Entry *e = entry_table_lookup (self->priv->entries, id);
 
-    GPtrArray *entries = gmediadb_get_all_entries (self->priv->db, NULL);
+    if (e) {
+        return g_object_ref (e);
+    }
+
+    if (!self->priv->table || library_table_get_row (self->priv->table, id) < 0) {
+        return NULL;
+    }
+
+    e = _entry_new_view (id, self->priv->table);
+    _entry_set_media_type (e, self->priv->mtype);
+    _entry_set_partial (e, self->priv->load_tags != NULL);
+    _entry_update_sort_key (e);
+
+    return e;
+}
+
+// Returns the entry for id, creating a view on the row in columnar mode
+static Entry*
+gmediadb_store_lookup (GMediaDBStore *self, guint id)
+{
+    Entry *e;
+
+    g_static_rec_mutex_lock (&self->priv->lock);
+
+    e = entry_table_lookup (self->priv->entries, id);
+
+    if (!e && (e = gmediadb_store_peek (self, id))) {
+        entry_table_insert (self->priv->entries, id, e);
+    }
+
+    g_static_rec_mutex_unlock (&self->priv->lock);
+
+    return e;
+}
+
+// Adds an entry from NULL terminated key, value pairs
+static void
+gmediadb_store_load_tags (GMediaDBStore *self, guint nid, gchar **kvs, gboolean partial)
+{
+    gint j, row;
+
+    g_static_rec_mutex_lock (&self->priv->lock);
+
+    if (self->priv->table) {
+        row = library_table_add_row (self->priv->table, nid);
+
+        for (j = 0; kvs[j]; j += 2) {
+            library_table_set (self->priv->table, row, kvs[j], kvs[j + 1]);
+        }
+
+        g_static_rec_mutex_unlock (&self->priv->lock);
+        return;
+    }
 
-    int i, j;
-    for (i = 0; i < entries->len; i++) {
+    Entry *e = _entry_new (nid);
+    _entry_set_media_type (e, self->priv->mtype);
+    _entry_set_partial (e, partial);
+
+    for (j = 0; kvs[j]; j += 2) {
+        _entry_set_tag_str (e, kvs[j], kvs[j + 1]);
+    }
+
+    _entry_update_sort_key (e);
+    gmediadb_store_attach_album (self, e);
+
+    entry_table_insert (self->priv->entries, nid, e);
+
+    g_static_rec_mutex_unlock (&self->priv->lock);
+}
+
+static guint
+gmediadb_store_load_entry (GMediaDBStore *self, gchar **entry, gboolean partial)
+{
+    guint nid = entry[1] ? atoi (entry[1]) : 0;
+
+    gmediadb_store_load_tags (self, nid, entry + 2, partial);
+
+    return nid;
+}
+
+static gchar*
+gmediadb_store_get_cache_path (GMediaDBStore *self, const gchar *ext)
+{
+    gchar *dir = g_build_filename (g_get_user_cache_dir (), "gmediamp", NULL);
+    gchar *name = g_strdup_printf ("%s.%s", self->priv->media_type, ext);
+    gchar *path = g_build_filename (dir, name, NULL);
+
+    g_mkdir_with_parents (dir, 0755);
+
+    g_free (dir);
+    g_free (name);
+
+    return path;
+}
+
+// Which rows a library holds, the same for the store and gmediadb when they
+// agree. The hash is a sum so rows can be added in any order.
+typedef struct {
+    guint count;
+    guint max_id;
+    guint32 hash;
+} GMediaDBStoreRows;
+
+static void
+gmediadb_store_rows_add (GMediaDBStoreRows *rows, guint id)
+{
+    rows->count++;
+    rows->max_id = MAX (rows->max_id, id);
+    rows->hash += (guint32) id * 2654435761u;
+}
+
+// Reads the rows gmediadb holds, asking for ids only
+static void
+gmediadb_store_get_db_rows (GMediaDBStore *self, GMediaDBStoreRows *rows)
+{
+    static const gchar *no_tags[] = { NULL };
+    GPtrArray *entries = gmediadb_get_all_entries (self->priv->db, (gchar**) no_tags);
+    guint i;
+
+    memset (rows, 0, sizeof (GMediaDBStoreRows));
+
+    for (i = 0; entries && i < entries->len; i++) {
         gchar **entry = g_ptr_array_index (entries, i);
 
-        guint *nid = g_new0 (guint, 1);
+        gmediadb_store_rows_add (rows, entry[1] ? atoi (entry[1]) : 0);
+    }
+}
+
+/*
+ * Identifies what a snapshot holds. Snapshots of another tag set are
+ * unusable, and so are snapshots of other rows than gmediadb has now, which
+ * catches rows added or removed by other programs or while not running.
+ */
+static gchar*
+gmediadb_store_get_signature (GMediaDBStore *self, GMediaDBStoreRows *rows)
+{
+    gchar *tags = self->priv->load_tags ?
+        g_strjoinv (",", self->priv->load_tags) : g_strdup ("*");
+    gchar *ret = g_strdup_printf ("%d:%s:%u:%u:%08x", self->priv->mtype, tags,
+        rows->count, rows->max_id, rows->hash);
+
+    g_free (tags);
+
+    return ret;
+}
+
+static void
+gmediadb_store_read_generation (GMediaDBStore *self)
+{
+    gchar *path = gmediadb_store_get_cache_path (self, "generation");
+    gchar *contents;
+
+    if (g_file_get_contents (path, &contents, NULL, NULL)) {
+        self->priv->generation = g_ascii_strtoull (contents, NULL, 10);
+        g_free (contents);
+    }
+
+    g_free (path);
+}
+
+// Called for every change seen from gmediadb, invalidates the snapshot once
+static void
+gmediadb_store_changed (GMediaDBStore *self)
+{
+    gchar *path, *contents;
+
+    if (self->priv->dirty) {
+        return;
+    }
+
+    self->priv->dirty = TRUE;
+    self->priv->generation++;
+
+    path = gmediadb_store_get_cache_path (self, "generation");
+    contents = g_strdup_printf ("%" G_GUINT64_FORMAT "\n", self->priv->generation);
+
+    g_file_set_contents (path, contents, -1, NULL);
+
+    g_free (contents);
+    g_free (path);
+}
+
+static gboolean
+gmediadb_store_load_snapshot (GMediaDBStore *self)
+{
+    gchar *path = gmediadb_store_get_cache_path (self, "snapshot");
+    GMediaDBStoreRows rows;
+    LibrarySnapshot *snap;
+    gchar *sig;
+    GPtrArray *kvs;
+    gboolean partial;
+    guint i, n, id;
+
+    gmediadb_store_get_db_rows (self, &rows);
+    sig = gmediadb_store_get_signature (self, &rows);
+
+    snap = library_snapshot_open (path, self->priv->generation, sig);
+
+    g_free (path);
+    g_free (sig);
+
+    if (!snap) {
+        return FALSE;
+    }
+
+    kvs = g_ptr_array_new ();
+    n = library_snapshot_get_num_entries (snap);
+
+    for (i = 0; i < n; i++) {
+        g_ptr_array_set_size (kvs, 0);
+
+        if (!library_snapshot_get_entry (snap, i, &id, &partial, kvs)) {
+            break;
+        }
+
+        gmediadb_store_load_tags (self, id, (gchar**) kvs->pdata, partial);
+    }
 
-        *nid = entry[1] ? atoi (entry[1]) : 0;
+    g_ptr_array_free (kvs, TRUE);
+    library_snapshot_close (snap);
 
-        Entry *e = _entry_new (*nid);
-        _entry_set_media_type (e, self->priv->mtype);
+    if (i < n) {
+        // Damaged snapshot, start over from gmediadb
+        entry_table_free (self->priv->entries);
+        self->priv->entries = entry_table_new ();
+        g_hash_table_remove_all (self->priv->artists);
 
-        for (j = 2; entry[j]; j += 2) {
-            _entry_set_tag_str (e, entry[j], entry[j + 1]);
+        if (self->priv->table) {
+            library_table_free (self->priv->table);
+            self->priv->table = library_table_new ();
         }
 
-        g_hash_table_insert (self->priv->entries, nid, e);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Writes the entries to the snapshot file if they changed since the last one
+gboolean
+gmediadb_store_save_snapshot (GMediaDBStore *self)
+{
+    GMediaDBStoreRows rows;
+    gchar *path, *sig;
+    Entry **entries;
+    gboolean res;
+    guint i, n = 0;
+
+    if (!self->priv->dirty) {
+        return TRUE;
+    }
+
+    // A half loaded store would pass for the whole library next time
+    if (!self->priv->loaded) {
+        return FALSE;
+    }
+
+    path = gmediadb_store_get_cache_path (self, "snapshot");
+
+    g_static_rec_mutex_lock (&self->priv->lock);
+
+    // Rows are written through short lived views in columnar mode
+    if (self->priv->table) {
+        const guint *ids = library_table_get_ids (self->priv->table);
+        n = library_table_get_num_rows (self->priv->table);
+
+        entries = g_new0 (Entry*, n + 1);
+        for (i = 0; i < n; i++) {
+            entries[i] = gmediadb_store_peek (self, ids[i]);
+        }
+    } else {
+        entries = entry_table_get_all (self->priv->entries);
     }
 
+    // The store is in step with gmediadb here, so its rows stand for the
+    // rows gmediadb will report at the next start
+    memset (&rows, 0, sizeof (rows));
+    for (i = 0; entries[i]; i++) {
+        gmediadb_store_rows_add (&rows, entry_get_id (entries[i]));
+    }
+
+    sig = gmediadb_store_get_signature (self, &rows);
+
+    res = library_snapshot_write (path, self->priv->generation, sig, entries);
+    if (res) {
+        self->priv->dirty = FALSE;
+    }
+
+    if (self->priv->table) {
+        for (i = 0; i < n; i++) {
+            g_object_unref (entries[i]);
+        }
+    }
+
+    g_static_rec_mutex_unlock (&self->priv->lock);
+
+    g_free (entries);
+    g_free (path);
+    g_free (sig);
+
+    return res;
+}
+
+GMediaDBStore*
+gmediadb_store_new (gchar *media_type, gint mtype)
+{
+    return gmediadb_store_new_full (media_type, mtype, 0, NULL);
+}
+
+// Only load_tags are read for existing entries when it is not NULL, the
+// rest is fetched by media_store_hydrate_entries when somebody needs it
+GMediaDBStore*
+gmediadb_store_new_full (gchar *media_type, gint mtype,
+    GMediaDBStoreFlags flags, const gchar **load_tags)
+{
+    GMediaDBStore *self = g_object_new (GMEDIADB_STORE_TYPE, NULL);
+
+    self->priv->mtype = mtype;
+    self->priv->media_type = g_strdup (media_type);
+
+    if (flags & GMEDIADB_STORE_COLUMNAR) {
+        self->priv->table = library_table_new ();
+    }
+
+    self->priv->load_tags = g_strdupv ((gchar**) load_tags);
+
+    self->priv->db = gmediadb_new (media_type);
+
+    // Connected before loading so nothing written meanwhile is missed, the
+    // handlers hold changes back until the load is done
     g_signal_connect_swapped (self->priv->db, "add-entry",
         G_CALLBACK (gmediadb_store_gmediadb_add), self);
     g_signal_connect_swapped (self->priv->db, "remove-entry",
@@ -145,9 +623,317 @@ gmediadb_store_new (gchar *media_type, gint mtype)
     g_signal_connect_swapped (self->priv->db, "update-entry",
         G_CALLBACK (gmediadb_store_gmediadb_update), self);
 
+    if (!(flags & GMEDIADB_STORE_ASYNC)) {
+        gmediadb_store_load (self, FALSE);
+    }
+
     return self;
 }
 
+// Starts loading a store created with GMEDIADB_STORE_ASYNC, indexes and
+// listeners should be set up first
+void
+gmediadb_store_start_load (GMediaDBStore *self)
+{
+    if (self->priv->loaded || self->priv->loader) {
+        return;
+    }
+
+    self->priv->loader = g_thread_create (
+        (GThreadFunc) gmediadb_store_load_thread, self, TRUE, NULL);
+}
+
+/*
+ * Loads with high priority while high is TRUE, background loaders of other
+ * stores then wait for this one. Has no effect once the store is loaded.
+ */
+void
+gmediadb_store_set_load_priority (GMediaDBStore *self, gboolean high)
+{
+    g_mutex_lock (load_mutex);
+
+    if (!self->priv->published && self->priv->high != high) {
+        self->priv->high = high;
+        num_high += high ? 1 : -1;
+        g_cond_broadcast (load_cond);
+    }
+
+    g_mutex_unlock (load_mutex);
+}
+
+gboolean
+gmediadb_store_is_loaded (GMediaDBStore *self)
+{
+    gboolean ret;
+
+    g_mutex_lock (load_mutex);
+    ret = self->priv->loaded;
+    g_mutex_unlock (load_mutex);
+
+    return ret;
+}
+
+/*
+ * Blocks until the store is loaded, including the changes made while it was
+ * loading. Must not be called from the main loop while a background load is
+ * running, and returns early only when the load is cancelled.
+ */
+void
+gmediadb_store_wait_loaded (GMediaDBStore *self)
+{
+    g_mutex_lock (load_mutex);
+
+    while (!self->priv->loaded && !self->priv->cancel) {
+        g_cond_wait (load_cond, load_mutex);
+    }
+
+    g_mutex_unlock (load_mutex);
+}
+
+typedef struct {
+    GMediaDBStore *store;
+    guint *id;
+    gchar **mtime;
+    gboolean found;
+} FindLocation;
+
+// Called with the indexes lock held, the store lock is taken inside it
+static gboolean
+gmediadb_store_find_location_func (Entry *e, FindLocation *fl)
+{
+    g_static_rec_mutex_lock (&fl->store->priv->lock);
+
+    fl->found = TRUE;
+
+    if (fl->id) {
+        *fl->id = entry_get_id (e);
+    }
+    if (fl->mtime) {
+        *fl->mtime = g_strdup (entry_get_tag_str (e, "mtime"));
+    }
+
+    g_static_rec_mutex_unlock (&fl->store->priv->lock);
+
+    return FALSE;
+}
+
+/*
+ * Looks up the entry with the given location through the location index,
+ * filling in its id and recorded mtime, which has to be freed. Entries stay
+ * in the index until after they are removed, and the store lock keeps the
+ * entry from changing while it is read, so this is safe to call from any
+ * thread. Returns FALSE when there is none.
+ */
+gboolean
+gmediadb_store_find_location (GMediaDBStore *self, const gchar *location,
+    guint *id, gchar **mtime)
+{
+    FindLocation fl = { self, id, mtime, FALSE };
+
+    media_store_foreach_query (MEDIA_STORE (self), "location", location,
+        (MediaStoreFunc) gmediadb_store_find_location_func, &fl);
+
+    return fl.found;
+}
+
+// Holds a change from gmediadb back while the store is loading, returns FALSE
+// when it should be applied right away
+static gboolean
+gmediadb_store_defer (GMediaDBStore *self, MediaStoreChangeType type, guint id)
+{
+    DeferredChange change = { type, id };
+    gboolean deferred;
+
+    g_mutex_lock (self->priv->defer_mutex);
+
+    if ((deferred = !self->priv->ready)) {
+        g_array_append_val (self->priv->deferred, change);
+    }
+
+    g_mutex_unlock (self->priv->defer_mutex);
+
+    if (deferred) {
+        // The snapshot no longer matches gmediadb, whatever the load read
+        gmediadb_store_changed (self);
+    }
+
+    return deferred;
+}
+
+// Applies the changes held back during the load, in the order they came in.
+// No lock is held while applying, changes still coming in queue up behind.
+static void
+gmediadb_store_replay (GMediaDBStore *self)
+{
+    GArray *changes;
+    guint i;
+
+    for (;;) {
+        g_mutex_lock (self->priv->defer_mutex);
+
+        if (self->priv->deferred->len == 0) {
+            self->priv->ready = TRUE;
+            g_mutex_unlock (self->priv->defer_mutex);
+            return;
+        }
+
+        changes = self->priv->deferred;
+        self->priv->deferred = g_array_new (FALSE, FALSE, sizeof (DeferredChange));
+
+        g_mutex_unlock (self->priv->defer_mutex);
+
+        for (i = 0; i < changes->len; i++) {
+            DeferredChange *change = &g_array_index (changes, DeferredChange, i);
+
+            switch (change->type) {
+            case MEDIA_STORE_ADDED:
+                gmediadb_store_apply_add (self, change->id);
+                break;
+            case MEDIA_STORE_REMOVED:
+                gmediadb_store_apply_remove (self, change->id);
+                break;
+            case MEDIA_STORE_UPDATED:
+                gmediadb_store_apply_update (self, change->id);
+                break;
+            }
+        }
+
+        g_array_free (changes, TRUE);
+    }
+}
+
+// Applies the held back changes and marks the store loaded, waking up
+// gmediadb_store_wait_loaded. Runs on the main loop like other changes.
+static void
+gmediadb_store_finish_load (GMediaDBStore *self)
+{
+    gmediadb_store_replay (self);
+
+    g_mutex_lock (load_mutex);
+    self->priv->loaded = TRUE;
+    g_cond_broadcast (load_cond);
+    g_mutex_unlock (load_mutex);
+}
+
+static gboolean
+gmediadb_store_finish_load_idle (GMediaDBStore *self)
+{
+    self->priv->replay_source = 0;
+
+    gmediadb_store_finish_load (self);
+
+    return FALSE;
+}
+
+// Announces a chunk of loaded entries, then waits while stores with higher
+// priority are loading. Returns FALSE when loading was cancelled.
+static gboolean
+gmediadb_store_publish (GMediaDBStore *self, Entry **entries, guint len)
+{
+    gboolean ret;
+
+    // Only queued here, listeners hear of them from the main loop
+    _media_store_emit_loaded_entries (MEDIA_STORE (self), entries, len);
+
+    g_mutex_lock (load_mutex);
+
+    while (!self->priv->cancel && !self->priv->high && num_high > 0) {
+        g_cond_wait (load_cond, load_mutex);
+    }
+
+    ret = !self->priv->cancel;
+
+    g_mutex_unlock (load_mutex);
+
+    return ret;
+}
+
+// Fills the store from its snapshot or from gmediadb, entries are announced
+// as they arrive when publish is set
+static void
+gmediadb_store_load (GMediaDBStore *self, gboolean publish)
+{
+    GPtrArray *chunk = g_ptr_array_new ();
+    GTimer *timer = g_timer_new ();
+    gboolean run = TRUE;
+    guint i, n;
+
+    gmediadb_store_read_generation (self);
+
+    if (gmediadb_store_load_snapshot (self)) {
+        Entry **entries = publish ? gmediadb_store_get_all_entries (MEDIA_STORE (self)) : NULL;
+
+        for (n = 0; entries && entries[n]; n++);
+        for (i = 0; run && i < n; i += GMEDIADB_STORE_CHUNK) {
+            run = gmediadb_store_publish (self, entries + i, MIN (GMEDIADB_STORE_CHUNK, n - i));
+        }
+
+        g_free (entries);
+
+        g_debug ("%s: %u entries from snapshot in %.3fs", self->priv->media_type,
+            self->priv->table ? library_table_get_num_rows (self->priv->table) :
+            entry_table_size (self->priv->entries), g_timer_elapsed (timer, NULL));
+    } else {
+        GPtrArray *entries = gmediadb_get_all_entries (self->priv->db, self->priv->load_tags);
+
+        for (i = 0; run && i < entries->len; i++) {
+            guint nid = gmediadb_store_load_entry (self, g_ptr_array_index (entries, i),
+                self->priv->load_tags != NULL);
+
+            if (!publish) {
+                continue;
+            }
+
+            g_ptr_array_add (chunk, gmediadb_store_lookup (self, nid));
+
+            if (chunk->len == GMEDIADB_STORE_CHUNK || i + 1 == entries->len) {
+                run = gmediadb_store_publish (self, (Entry**) chunk->pdata, chunk->len);
+                g_ptr_array_set_size (chunk, 0);
+            }
+        }
+
+        g_debug ("%s: %u entries from gmediadb in %.3fs", self->priv->media_type,
+            entries->len, g_timer_elapsed (timer, NULL));
+
+        // No usable snapshot, write one on the way out
+        gmediadb_store_changed (self);
+    }
+
+    g_timer_destroy (timer);
+    g_ptr_array_free (chunk, TRUE);
+
+    g_mutex_lock (load_mutex);
+
+    self->priv->published = TRUE;
+    if (self->priv->high) {
+        self->priv->high = FALSE;
+        num_high--;
+    }
+    g_cond_broadcast (load_cond);
+
+    // Changes that came in meanwhile count as part of the load, so waiters
+    // see them too. A background load leaves them to the main loop, where
+    // gmediadb changes are applied otherwise.
+    if (run && publish) {
+        self->priv->replay_source = g_idle_add (
+            (GSourceFunc) gmediadb_store_finish_load_idle, self);
+    }
+
+    g_mutex_unlock (load_mutex);
+
+    if (run && !publish) {
+        gmediadb_store_finish_load (self);
+    }
+}
+
+static gpointer
+gmediadb_store_load_thread (GMediaDBStore *self)
+{
+    gmediadb_store_load (self, TRUE);
+
+    return NULL;
+}
+
 static void
 gmediadb_store_add_entry (MediaStore *self, gchar **entry)
 {
@@ -170,6 +956,30 @@ gmediadb_store_remove_entry (MediaStore *self, Entry *entry)
     gmediadb_remove_entry (GMEDIADB_STORE (self)->priv->db, entry_get_id (entry));
 }
 
+// GMediaDB only takes single entries, the resulting add-entry signals are
+// collected into one entries-added batch by the MediaStore
+static void
+gmediadb_store_add_entries (MediaStore *self, gchar ***entries, guint len)
+{
+    GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
+    guint i;
+
+    for (i = 0; i < len; i++) {
+        gmediadb_add_entry (priv->db, entries[i]);
+    }
+}
+
+static void
+gmediadb_store_remove_entries (MediaStore *self, Entry **entries, guint len)
+{
+    GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
+    guint i;
+
+    for (i = 0; i < len; i++) {
+        gmediadb_remove_entry (priv->db, entry_get_id (entries[i]));
+    }
+}
+
 static guint
 gmediadb_store_get_mtype (MediaStore *self)
 {
@@ -187,64 +997,311 @@ gmediadb_store_get_entry (MediaStore *self, guint id)
 {
     GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
 
-    return g_object_ref (g_hash_table_lookup (priv->entries, &id));
+    Entry *e = gmediadb_store_lookup (GMEDIADB_STORE (self), id);
+
+    return e ? g_object_ref (e) : NULL;
 }
 
 static Entry**
 gmediadb_store_get_all_entries (MediaStore *self)
+{
+    GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
+    const guint *ids;
+    Entry **ret;
+    guint i, n;
+
+    g_static_rec_mutex_lock (&priv->lock);
+
+    if (priv->table) {
+        ids = library_table_get_ids (priv->table);
+        n = library_table_get_num_rows (priv->table);
+
+        for (i = 0; i < n; i++) {
+            gmediadb_store_lookup (GMEDIADB_STORE (self), ids[i]);
+        }
+    }
+
+    ret = entry_table_get_all (priv->entries);
+
+    g_static_rec_mutex_unlock (&priv->lock);
+
+    return ret;
+}
+
+static void
+gmediadb_store_foreach (MediaStore *self, MediaStoreFunc func, gpointer user_data)
+{
+    GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
+    const guint *ids;
+    guint i, n;
+
+    g_static_rec_mutex_lock (&priv->lock);
+
+    if (priv->table) {
+        // Rows are walked in table order through peeked views, callbacks
+        // keeping an entry look it up through media_store_get_entry
+        ids = library_table_get_ids (priv->table);
+        n = library_table_get_num_rows (priv->table);
+
+        for (i = 0; i < n; i++) {
+            Entry *e = gmediadb_store_peek (GMEDIADB_STORE (self), ids[i]);
+            gboolean more = func (e, user_data);
+
+            g_object_unref (e);
+
+            if (!more) {
+                break;
+            }
+        }
+    } else {
+        entry_table_foreach (priv->entries, (EntryTableFunc) func, user_data);
+    }
+
+    g_static_rec_mutex_unlock (&priv->lock);
+}
+
+static const gchar**
+gmediadb_store_get_column (MediaStore *self, EntryTag tag, guint *len)
+{
+    GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
+
+    if (!priv->table) {
+        return NULL;
+    }
+
+    *len = library_table_get_num_rows (priv->table);
+
+    return library_table_get_str_column (priv->table, tag);
+}
+
+static Artist**
+gmediadb_store_get_artists (MediaStore *self)
 {
     GMediaDBStorePrivate *priv = GMEDIADB_STORE (self)->priv;
 
-    Entry **le = g_new0 (Entry*, g_hash_table_size (priv->entries) + 1);
+    // Columnar stores are scanned directly instead of keeping records
+    if (priv->table) {
+        return NULL;
+    }
+
+    Artist **la = g_new0 (Artist*, g_hash_table_size (priv->artists) + 1);
 
     GHashTableIter iter;
-    Entry *e;
+    Artist *a;
     gint i = 0;
 
-    g_hash_table_iter_init (&iter, priv->entries);
-    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &e)) {
-        le[i++] = e;
+    g_hash_table_iter_init (&iter, priv->artists);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &a)) {
+        la[i++] = a;
     }
 
-    return le;
+    return la;
 }
 
 static void
 gmediadb_store_gmediadb_add (GMediaDBStore *self, guint id, GMediaDB *db)
 {
-    gchar **entry = gmediadb_get_entry (self->priv->db, id, NULL);
+    if (!gmediadb_store_defer (self, MEDIA_STORE_ADDED, id)) {
+        gmediadb_store_apply_add (self, id);
+    }
+}
+
+static void
+gmediadb_store_gmediadb_remove (GMediaDBStore *self, guint id, GMediaDB *db)
+{
+    if (!gmediadb_store_defer (self, MEDIA_STORE_REMOVED, id)) {
+        gmediadb_store_apply_remove (self, id);
+    }
+}
 
-    gint *nid = g_new0 (gint, 1);
+static void
+gmediadb_store_gmediadb_update (GMediaDBStore *self, guint id, GMediaDB *db)
+{
+    if (!gmediadb_store_defer (self, MEDIA_STORE_UPDATED, id)) {
+        gmediadb_store_apply_update (self, id);
+    }
+}
 
-    *nid = entry[1] ? atoi (entry[1]) : 0;
+static void
+gmediadb_store_apply_add (GMediaDBStore *self, guint id)
+{
+    gchar **entry;
+    guint nid;
 
-    Entry *e = _entry_new (*nid);
-    _entry_set_media_type (e, self->priv->mtype);
+    // A change held back during the load may already have been loaded
+    if (gmediadb_store_lookup (self, id)) {
+        gmediadb_store_apply_update (self, id);
+        return;
+    }
 
-    gint j;
-    for (j = 2; entry[j]; j += 2) {
-        _entry_set_tag_str (e, entry[j], entry[j + 1]);
+    if (!(entry = gmediadb_get_entry (self->priv->db, id, NULL))) {
+        return;
     }
 
-    g_hash_table_insert (self->priv->entries, nid, e);
+    nid = gmediadb_store_load_entry (self, entry, FALSE);
 
-    _media_store_emit_add_entry (MEDIA_STORE (self), e);
+    gmediadb_store_changed (self);
+
+    _media_store_emit_add_entry (MEDIA_STORE (self), gmediadb_store_lookup (self, nid));
 }
 
 static void
-gmediadb_store_gmediadb_remove (GMediaDBStore *self, guint id, GMediaDB *db)
+gmediadb_store_apply_remove (GMediaDBStore *self, guint id)
 {
-    Entry *e = g_hash_table_lookup (self->priv->entries, &id);
-    if (e) {
-        g_hash_table_remove (self->priv->entries, &id);
+    Entry *e = gmediadb_store_lookup (self, id);
+    if (!e) {
+        return;
     }
 
+    gmediadb_store_changed (self);
+
+    // Keep the entry alive for the signal handlers
+    g_object_ref (e);
+
+    g_static_rec_mutex_lock (&self->priv->lock);
+
+    if (self->priv->table) {
+        _entry_detach_view (e);
+        library_table_remove_row (self->priv->table, id);
+    } else {
+        gmediadb_store_detach_album (self, e);
+    }
+
+    entry_table_remove (self->priv->entries, id);
+
+    g_static_rec_mutex_unlock (&self->priv->lock);
+
     _media_store_emit_remove_entry (MEDIA_STORE (self), e);
+
+    g_object_unref (e);
+}
+
+static gboolean
+gmediadb_store_tag_changed (Entry *e, const gchar *tag, const gchar *value)
+{
+    EntryTag slot = entry_tag_lookup (tag);
+    gchar buf[12];
+
+    // Numbers are compared by value, "3/12" and "3" are the same track
+    if (ENTRY_TAG_IS_INT (slot)) {
+        return entry_format_tag (e, slot, buf, sizeof (buf)) == NULL ||
+            entry_get_tag_num (e, slot) != (value ? atoi (value) : 0);
+    }
+
+    return g_strcmp0 (entry_get_tag_str (e, tag), value ? value : "") != 0;
 }
 
 static void
-gmediadb_store_gmediadb_update (GMediaDBStore *self, guint id, GMediaDB *db)
+gmediadb_store_hydrate (MediaStore *self, Entry **entries, guint len)
+{
+    GMediaDBStore *store = GMEDIADB_STORE (self);
+    guint i;
+
+    for (i = 0; i < len; i++) {
+        guint id = entry_get_id (entries[i]);
+
+        // Removed entries are not brought back
+        if (gmediadb_store_lookup (store, id) != entries[i]) {
+            continue;
+        }
+
+        g_static_rec_mutex_lock (&store->priv->lock);
+        _entry_set_partial (entries[i], FALSE);
+        g_static_rec_mutex_unlock (&store->priv->lock);
+
+        // Goes through the update path so indexes, search and listeners see
+        // any loaded tag that has changed since
+        gmediadb_store_apply_update (store, id);
+    }
+}
+
+static void
+gmediadb_store_apply_update (GMediaDBStore *self, guint id)
 {
-    gmediadb_store_gmediadb_remove (self, id, db);
-    gmediadb_store_gmediadb_add (self, id, db);
+    Entry *e = gmediadb_store_lookup (self, id);
+    GPtrArray *changes;
+    gchar **entry;
+    gboolean album_changed = FALSE;
+    const gchar *old;
+    EntryTag slot;
+    gchar num[12];
+    guint j;
+
+    if (!e) {
+        gmediadb_store_apply_add (self, id);
+        return;
+    }
+
+    // Partial entries only follow the tags they were loaded with
+    entry = gmediadb_get_entry (self->priv->db, id,
+        entry_is_partial (e) ? self->priv->load_tags : NULL);
+    if (!entry) {
+        return;
+    }
+
+    // Only the tags that differ are written to the entry, their previous
+    // values go out with the signal as pooled strings
+    changes = g_ptr_array_new ();
+
+    // Readers and walks on other threads must not see the entry or its album
+    // half changed
+    g_static_rec_mutex_lock (&self->priv->lock);
+
+    for (j = 2; entry[j]; j += 2) {
+        if (!gmediadb_store_tag_changed (e, entry[j], entry[j + 1])) {
+            continue;
+        }
+
+        switch (entry_tag_lookup (entry[j])) {
+            case ENTRY_TAG_ARTIST:
+            case ENTRY_TAG_ALBUM:
+                if (!album_changed && !self->priv->table) {
+                    gmediadb_store_detach_album (self, e);
+                }
+                album_changed = TRUE;
+                break;
+            default:
+                break;
+        }
+
+        // Old numbers are rendered here rather than cached on the entry
+        slot = entry_tag_lookup (entry[j]);
+        old = ENTRY_TAG_IS_INT (slot) ? entry_format_tag (e, slot, num, sizeof (num)) :
+            entry_get_tag_str (e, entry[j]);
+
+        g_ptr_array_add (changes, (gpointer) string_pool_ref (entry[j]));
+        g_ptr_array_add (changes, old ? (gpointer) string_pool_ref (old) : NULL);
+
+        _entry_set_tag_str (e, entry[j], entry[j + 1]);
+    }
+
+    if (album_changed && !self->priv->table) {
+        gmediadb_store_attach_album (self, e);
+    }
+
+    // Rebuilt with the tags, compares on other threads never build keys
+    if (changes->len > 0) {
+        _entry_update_sort_key (e);
+    }
+
+    g_static_rec_mutex_unlock (&self->priv->lock);
+
+    if (changes->len == 0) {
+        g_ptr_array_free (changes, TRUE);
+        return;
+    }
+
+    gmediadb_store_changed (self);
+
+    g_ptr_array_add (changes, NULL);
+
+    _media_store_emit_update_entry (MEDIA_STORE (self), e, (gchar**) changes->pdata);
+
+    for (j = 0; j < changes->len; j++) {
+        if (g_ptr_array_index (changes, j)) {
+            string_pool_unref (g_ptr_array_index (changes, j));
+        }
+    }
+
+    g_ptr_array_free (changes, TRUE);
 }
@@ -50,7 +50,25 @@ struct _GMediaDBStoreClass {
     GObjectClass parent;
 };
 
+typedef enum {
+    // Keep tags in a column per tag, entries are only created on request
+    GMEDIADB_STORE_COLUMNAR = 1 << 0,
+    // Load on a worker thread started by gmediadb_store_start_load, entries
+    // are announced in chunks as they arrive
+    GMEDIADB_STORE_ASYNC = 1 << 1,
+} GMediaDBStoreFlags;
+
 GMediaDBStore *gmediadb_store_new (gchar *media_type, gint mtype);
+GMediaDBStore *gmediadb_store_new_full (gchar *media_type, gint mtype,
+    GMediaDBStoreFlags flags, const gchar **load_tags);
+
+gboolean gmediadb_store_save_snapshot (GMediaDBStore *self);
+void gmediadb_store_start_load (GMediaDBStore *self);
+void gmediadb_store_set_load_priority (GMediaDBStore *self, gboolean high);
+gboolean gmediadb_store_is_loaded (GMediaDBStore *self);
+void gmediadb_store_wait_loaded (GMediaDBStore *self);
+gboolean gmediadb_store_find_location (GMediaDBStore *self, const gchar *location,
+    guint *id, gchar **mtime);
 GType gmediadb_store_get_type (void);
 
 G_END_DECLS
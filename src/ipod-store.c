@@ -21,6 +21,7 @@
 
 #include "ipod-store.h"
 #include "media-store.h"
+#include "entry-table.h"
 #include "shell.h"
 
 static void media_store_init (MediaStoreInterface *iface);
@@ -35,7 +36,7 @@ struct _IPodStorePrivate {
 
     gint mtype;
 
-    GHashTable *entries;
+    EntryTable *entries;
 };
 
 static void ipod_store_class_init (IPodStoreClass *klass);
@@ -74,7 +75,7 @@ ipod_store_init (IPodStore *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE((self), IPOD_STORE_TYPE, IPodStorePrivate);
 
-    self->priv->entries = g_hash_table_new_full (g_int_hash, g_int_equal, g_free, g_object_unref);
+    self->priv->entries = entry_table_new ();
 }
 
 static void
@@ -83,7 +84,7 @@ ipod_store_finalize (GObject *object)
     IPodStore *self = IPOD_STORE (object);
 
     if (self->priv->entries) {
-        g_hash_table_unref (self->priv->entries);
+        entry_table_free (self->priv->entries);
         self->priv->entries = NULL;
     }
 
@@ -107,15 +108,25 @@ ipod_store_new (Itdb_iTunesDB *db, gint mtype)
             continue;
         }
 
-        guint *nid = g_new0 (guint, 1);
-
-        *nid = track->id;
-
-        Entry *e = _entry_new (*nid);
+        Entry *e = _entry_new (track->id);
         _entry_set_media_type (e, self->priv->mtype);
         _entry_set_tag_str (e, "title", track->title);
         _entry_set_tag_int (e, "duration", track->tracklen / 1000);
 
+        // Repeated values are shared through the string pool
+        if (track->artist) {
+            _entry_set_tag_str (e, "artist", track->artist);
+        }
+        if (track->album) {
+            _entry_set_tag_str (e, "album", track->album);
+        }
+        if (track->genre) {
+            _entry_set_tag_str (e, "genre", track->genre);
+        }
+        if (track->albumartist) {
+            _entry_set_tag_str (e, "albumartist", track->albumartist);
+        }
+
         gchar *file = itdb_filename_on_ipod (track);
 //        itdb_filename_ipod2fs (file);
 //        gchar *loc = g_strdup_printf ("%s%s", itdb_get_mountpoint (db), file);
@@ -124,7 +135,9 @@ ipod_store_new (Itdb_iTunesDB *db, gint mtype)
         _entry_set_tag_str (e, "location", file);
 //        g_free (loc);
 
-        g_hash_table_insert (self->priv->entries, nid, e);
+        _entry_update_sort_key (e);
+
+        entry_table_insert (self->priv->entries, track->id, e);
     }
 
     return self;
@@ -169,7 +182,9 @@ ipod_store_get_entry (MediaStore *self, guint id)
 {
     IPodStorePrivate *priv = IPOD_STORE (self)->priv;
 
-    return g_object_ref (g_hash_table_lookup (priv->entries, &id));
+    Entry *e = entry_table_lookup (priv->entries, id);
+
+    return e ? g_object_ref (e) : NULL;
 }
 
 static Entry**
@@ -177,16 +192,5 @@ ipod_store_get_all_entries (MediaStore *self)
 {
     IPodStorePrivate *priv = IPOD_STORE (self)->priv;
 
-    Entry **le = g_new0 (Entry*, g_hash_table_size (priv->entries) + 1);
-
-    GHashTableIter iter;
-    Entry *e;
-    gint i = 0;
-
-    g_hash_table_iter_init (&iter, priv->entries);
-    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &e)) {
-        le[i++] = e;
-    }
-
-    return le;
+    return entry_table_get_all (priv->entries);
 }
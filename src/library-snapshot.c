@@ -0,0 +1,298 @@
+/*
+ *      library-snapshot.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "library-snapshot.h"
+
+#define SNAPSHOT_MAGIC "GMSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+#define SNAPSHOT_PARTIAL (1 << 0)
+
+/*
+ * Layout, all numbers in host byte order:
+ *   SnapshotHeader
+ *   SnapshotRecord[num_entries]
+ *   guint32[num_pairs * 2]      key and value string indices
+ *   guint32[num_strings]        offsets into the string data
+ *   gchar[strings_size]         NUL terminated strings, each stored once
+ */
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 byte_order;
+    guint64 generation;
+    guint32 signature;
+    guint32 num_entries;
+    guint32 num_pairs;
+    guint32 num_strings;
+    guint32 strings_size;
+    guint32 reserved;
+} SnapshotHeader;
+
+typedef struct {
+    guint32 id;
+    guint32 flags;
+    guint32 first_pair;
+    guint32 num_pairs;
+} SnapshotRecord;
+
+struct _LibrarySnapshot {
+    GMappedFile *file;
+
+    const SnapshotHeader *header;
+    const SnapshotRecord *records;
+    const guint32 *pairs;
+    const guint32 *offsets;
+    const gchar *strings;
+};
+
+static guint32
+snapshot_add_string (GHashTable *index, GByteArray *offsets, GByteArray *strings,
+    const gchar *str)
+{
+    gpointer res;
+    guint32 i, off;
+
+    if (g_hash_table_lookup_extended (index, str, NULL, &res)) {
+        return GPOINTER_TO_UINT (res);
+    }
+
+    i = offsets->len / sizeof (guint32);
+    off = strings->len;
+
+    g_byte_array_append (offsets, (guint8*) &off, sizeof (off));
+    g_byte_array_append (strings, (guint8*) str, strlen (str) + 1);
+
+    g_hash_table_insert (index, (gpointer) str, GUINT_TO_POINTER (i));
+
+    return i;
+}
+
+gboolean
+library_snapshot_write (const gchar *path, guint64 generation,
+    const gchar *signature, Entry **entries)
+{
+    SnapshotHeader header;
+    SnapshotRecord rec;
+    GByteArray *records, *pairs, *offsets, *strings, *out;
+    GHashTable *index;
+    GStringChunk *nums;
+    EntryTagIter iter;
+    GPtrArray *kvs;
+    gboolean res;
+    guint32 idx;
+    guint i, j;
+
+    // Strings are borrowed from the entries until the file is written
+    index = g_hash_table_new (g_str_hash, g_str_equal);
+    records = g_byte_array_new ();
+    pairs = g_byte_array_new ();
+    offsets = g_byte_array_new ();
+    strings = g_byte_array_new ();
+    kvs = g_ptr_array_new ();
+
+    // Numbers are rendered into iter, which is reused for every entry
+    nums = g_string_chunk_new (4096);
+
+    memset (&header, 0, sizeof (header));
+    strncpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.generation = generation;
+    header.signature = snapshot_add_string (index, offsets, strings, signature);
+
+    for (i = 0; entries[i]; i++) {
+        g_ptr_array_set_size (kvs, 0);
+        entry_get_tags (entries[i], &iter, kvs);
+
+        rec.id = entry_get_id (entries[i]);
+        rec.flags = entry_is_partial (entries[i]) ? SNAPSHOT_PARTIAL : 0;
+        rec.first_pair = pairs->len / (2 * sizeof (guint32));
+        rec.num_pairs = kvs->len / 2;
+
+        for (j = 0; j < kvs->len; j++) {
+            const gchar *str = g_ptr_array_index (kvs, j);
+
+            if (j % 2 && ENTRY_TAG_IS_INT (entry_tag_lookup (g_ptr_array_index (kvs, j - 1)))) {
+                str = g_string_chunk_insert_const (nums, str);
+            }
+
+            idx = snapshot_add_string (index, offsets, strings, str);
+            g_byte_array_append (pairs, (guint8*) &idx, sizeof (idx));
+        }
+
+        g_byte_array_append (records, (guint8*) &rec, sizeof (rec));
+    }
+
+    header.num_entries = i;
+    header.num_pairs = pairs->len / (2 * sizeof (guint32));
+    header.num_strings = offsets->len / sizeof (guint32);
+    header.strings_size = strings->len;
+
+    out = g_byte_array_sized_new (sizeof (header) + records->len +
+        pairs->len + offsets->len + strings->len);
+
+    g_byte_array_append (out, (guint8*) &header, sizeof (header));
+    g_byte_array_append (out, records->data, records->len);
+    g_byte_array_append (out, pairs->data, pairs->len);
+    g_byte_array_append (out, offsets->data, offsets->len);
+    g_byte_array_append (out, strings->data, strings->len);
+
+    res = g_file_set_contents (path, (gchar*) out->data, out->len, NULL);
+
+    g_byte_array_free (out, TRUE);
+    g_byte_array_free (records, TRUE);
+    g_byte_array_free (pairs, TRUE);
+    g_byte_array_free (offsets, TRUE);
+    g_byte_array_free (strings, TRUE);
+    g_ptr_array_free (kvs, TRUE);
+    g_hash_table_unref (index);
+    g_string_chunk_free (nums);
+
+    return res;
+}
+
+static inline const gchar*
+snapshot_get_string (LibrarySnapshot *self, guint32 i)
+{
+    return i < self->header->num_strings ? self->strings + self->offsets[i] : NULL;
+}
+
+LibrarySnapshot*
+library_snapshot_open (const gchar *path, guint64 generation, const gchar *signature)
+{
+    LibrarySnapshot *self;
+    GMappedFile *file;
+    const SnapshotHeader *header;
+    const gchar *data;
+    gsize size, need;
+    guint32 i;
+
+    if (!(file = g_mapped_file_new (path, FALSE, NULL))) {
+        return NULL;
+    }
+
+    data = g_mapped_file_get_contents (file);
+    size = g_mapped_file_get_length (file);
+    header = (const SnapshotHeader*) data;
+
+    // Anything unexpected means the snapshot is rebuilt from gmediadb
+    if (size < sizeof (SnapshotHeader) ||
+        strncmp (header->magic, SNAPSHOT_MAGIC, sizeof (header->magic)) ||
+        header->version != SNAPSHOT_VERSION ||
+        header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->generation != generation ||
+        header->strings_size == 0) {
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    need = sizeof (SnapshotHeader) +
+        (gsize) header->num_entries * sizeof (SnapshotRecord) +
+        (gsize) header->num_pairs * 2 * sizeof (guint32) +
+        (gsize) header->num_strings * sizeof (guint32) +
+        header->strings_size;
+
+    if (size != need) {
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    self = g_new0 (LibrarySnapshot, 1);
+    self->file = file;
+    self->header = header;
+    self->records = (const SnapshotRecord*) (header + 1);
+    self->pairs = (const guint32*) (self->records + header->num_entries);
+    self->offsets = self->pairs + header->num_pairs * 2;
+    self->strings = (const gchar*) (self->offsets + header->num_strings);
+
+    // Every string has to end inside the mapping
+    if (self->strings[header->strings_size - 1] != '\0') {
+        library_snapshot_close (self);
+        return NULL;
+    }
+
+    for (i = 0; i < header->num_strings; i++) {
+        if (self->offsets[i] >= header->strings_size) {
+            library_snapshot_close (self);
+            return NULL;
+        }
+    }
+
+    if (g_strcmp0 (snapshot_get_string (self, header->signature), signature)) {
+        library_snapshot_close (self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void
+library_snapshot_close (LibrarySnapshot *self)
+{
+    g_mapped_file_unref (self->file);
+    g_free (self);
+}
+
+guint
+library_snapshot_get_num_entries (LibrarySnapshot *self)
+{
+    return self->header->num_entries;
+}
+
+// Appends borrowed key, value pairs of entry index to kvs followed by NULL
+gboolean
+library_snapshot_get_entry (LibrarySnapshot *self, guint index,
+    guint *id, gboolean *partial, GPtrArray *kvs)
+{
+    const SnapshotRecord *rec;
+    const gchar *str;
+    guint32 i;
+
+    if (index >= self->header->num_entries) {
+        return FALSE;
+    }
+
+    rec = self->records + index;
+
+    if (rec->first_pair > self->header->num_pairs ||
+        rec->num_pairs > self->header->num_pairs - rec->first_pair) {
+        return FALSE;
+    }
+
+    for (i = rec->first_pair * 2; i < (rec->first_pair + rec->num_pairs) * 2; i++) {
+        if (!(str = snapshot_get_string (self, self->pairs[i]))) {
+            return FALSE;
+        }
+
+        g_ptr_array_add (kvs, (gpointer) str);
+    }
+
+    g_ptr_array_add (kvs, NULL);
+
+    *id = rec->id;
+    *partial = (rec->flags & SNAPSHOT_PARTIAL) != 0;
+
+    return TRUE;
+}
@@ -0,0 +1,48 @@
+/*
+ *      library-snapshot.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __LIBRARY_SNAPSHOT_H__
+#define __LIBRARY_SNAPSHOT_H__
+
+#include <glib.h>
+
+#include "entry.h"
+
+G_BEGIN_DECLS
+
+// Read only view of a library written by library_snapshot_write, strings
+// returned from it point into the mapped file
+typedef struct _LibrarySnapshot LibrarySnapshot;
+
+gboolean library_snapshot_write (const gchar *path, guint64 generation,
+    const gchar *signature, Entry **entries);
+
+LibrarySnapshot *library_snapshot_open (const gchar *path, guint64 generation,
+    const gchar *signature);
+void library_snapshot_close (LibrarySnapshot *self);
+
+guint library_snapshot_get_num_entries (LibrarySnapshot *self);
+gboolean library_snapshot_get_entry (LibrarySnapshot *self, guint index,
+    guint *id, gboolean *partial, GPtrArray *kvs);
+
+G_END_DECLS
+
+#endif /* __LIBRARY_SNAPSHOT_H__ */
@@ -0,0 +1,311 @@
+/*
+ *      library-table.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "library-table.h"
+#include "string-pool.h"
+
+struct _LibraryTable {
+    guint num_rows;
+    guint alloc;
+
+    guint *ids;
+    gchar **strs[ENTRY_TAG_FIRST_INT];
+    gint *nums[ENTRY_TAG_NUM_INTS];
+    guint16 *num_set;
+
+    // Per row NULL terminated key, value pairs of pooled strings
+    gchar ***extras;
+
+    // Entry id -> row + 1, 0 when the id has no row
+    guint *rows;
+    guint rows_alloc;
+};
+
+static void
+library_table_free_str (EntryTag tag, gchar *str)
+{
+    if (ENTRY_TAG_IS_POOLED (tag)) {
+        string_pool_unref (str);
+    } else {
+        g_free (str);
+    }
+}
+
+static void
+library_table_clear_row (LibraryTable *self, gint row)
+{
+    gint i;
+
+    for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+        library_table_free_str (i, self->strs[i][row]);
+    }
+
+    if (self->extras[row]) {
+        for (i = 0; self->extras[row][i]; i++) {
+            string_pool_unref (self->extras[row][i]);
+        }
+        g_free (self->extras[row]);
+    }
+}
+
+LibraryTable*
+library_table_new (void)
+{
+    return g_new0 (LibraryTable, 1);
+}
+
+void
+library_table_free (LibraryTable *self)
+{
+    guint i;
+
+    for (i = 0; i < self->num_rows; i++) {
+        library_table_clear_row (self, i);
+    }
+
+    for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+        g_free (self->strs[i]);
+    }
+    for (i = 0; i < ENTRY_TAG_NUM_INTS; i++) {
+        g_free (self->nums[i]);
+    }
+
+    g_free (self->ids);
+    g_free (self->num_set);
+    g_free (self->extras);
+    g_free (self->rows);
+    g_free (self);
+}
+
+static void
+library_table_grow (LibraryTable *self)
+{
+    guint i, alloc = MAX (self->alloc * 2, 256);
+
+    self->ids = g_renew (guint, self->ids, alloc);
+    self->num_set = g_renew (guint16, self->num_set, alloc);
+    self->extras = g_renew (gchar**, self->extras, alloc);
+
+    for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+        self->strs[i] = g_renew (gchar*, self->strs[i], alloc);
+    }
+    for (i = 0; i < ENTRY_TAG_NUM_INTS; i++) {
+        self->nums[i] = g_renew (gint, self->nums[i], alloc);
+    }
+
+    self->alloc = alloc;
+}
+
+gint
+library_table_add_row (LibraryTable *self, guint id)
+{
+    gint i, row;
+
+    if ((row = library_table_get_row (self, id)) >= 0) {
+        return row;
+    }
+
+    if (self->num_rows == self->alloc) {
+        library_table_grow (self);
+    }
+
+    if (id >= self->rows_alloc) {
+        guint rows_alloc = MAX (id + 1, self->rows_alloc * 2);
+
+        self->rows = g_renew (guint, self->rows, rows_alloc);
+        memset (self->rows + self->rows_alloc, 0,
+            (rows_alloc - self->rows_alloc) * sizeof (guint));
+        self->rows_alloc = rows_alloc;
+    }
+
+    row = self->num_rows++;
+
+    self->ids[row] = id;
+    self->num_set[row] = 0;
+    self->extras[row] = NULL;
+
+    for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+        self->strs[i][row] = NULL;
+    }
+    for (i = 0; i < ENTRY_TAG_NUM_INTS; i++) {
+        self->nums[i][row] = 0;
+    }
+
+    self->rows[id] = row + 1;
+
+    return row;
+}
+
+gboolean
+library_table_remove_row (LibraryTable *self, guint id)
+{
+    gint i, row = library_table_get_row (self, id);
+    guint last;
+
+    if (row < 0) {
+        return FALSE;
+    }
+
+    library_table_clear_row (self, row);
+
+    // Keep the columns packed by moving the last row into the hole
+    last = --self->num_rows;
+    if (row != last) {
+        self->ids[row] = self->ids[last];
+        self->num_set[row] = self->num_set[last];
+        self->extras[row] = self->extras[last];
+
+        for (i = 0; i < ENTRY_TAG_FIRST_INT; i++) {
+            self->strs[i][row] = self->strs[i][last];
+        }
+        for (i = 0; i < ENTRY_TAG_NUM_INTS; i++) {
+            self->nums[i][row] = self->nums[i][last];
+        }
+
+        self->rows[self->ids[row]] = row + 1;
+    }
+
+    self->rows[id] = 0;
+
+    return TRUE;
+}
+
+gint
+library_table_get_row (LibraryTable *self, guint id)
+{
+    if (id >= self->rows_alloc) {
+        return -1;
+    }
+
+    return (gint) self->rows[id] - 1;
+}
+
+void
+library_table_set_num (LibraryTable *self, gint row, EntryTag tag, gint value)
+{
+    self->nums[tag - ENTRY_TAG_FIRST_INT][row] = value;
+    self->num_set[row] |= 1 << (tag - ENTRY_TAG_FIRST_INT);
+}
+
+void
+library_table_set (LibraryTable *self, gint row, const gchar *tag, const gchar *value)
+{
+    EntryTag slot = entry_tag_lookup (tag);
+    gchar **kvs;
+    gint i;
+
+    if (ENTRY_TAG_IS_INT (slot)) {
+        library_table_set_num (self, row, slot, value ? (gint) strtol (value, NULL, 10) : 0);
+        return;
+    }
+
+    if (!value) {
+        value = "";
+    }
+
+    if (slot != ENTRY_TAG_LAST) {
+        library_table_free_str (slot, self->strs[slot][row]);
+        self->strs[slot][row] = ENTRY_TAG_IS_POOLED (slot) ?
+            (gchar*) string_pool_ref (value) : g_strdup (value);
+        return;
+    }
+
+    kvs = self->extras[row];
+
+    for (i = 0; kvs && kvs[i]; i += 2) {
+        if (!strcmp (kvs[i], tag)) {
+            string_pool_unref (kvs[i+1]);
+            kvs[i+1] = (gchar*) string_pool_ref (value);
+            return;
+        }
+    }
+
+    kvs = g_renew (gchar*, kvs, i + 3);
+    kvs[i] = (gchar*) string_pool_ref (tag);
+    kvs[i+1] = (gchar*) string_pool_ref (value);
+    kvs[i+2] = NULL;
+
+    self->extras[row] = kvs;
+}
+
+guint
+library_table_get_num_rows (LibraryTable *self)
+{
+    return self->num_rows;
+}
+
+const guint*
+library_table_get_ids (LibraryTable *self)
+{
+    return self->ids;
+}
+
+const gchar**
+library_table_get_str_column (LibraryTable *self, EntryTag tag)
+{
+    return tag < ENTRY_TAG_FIRST_INT ? (const gchar**) self->strs[tag] : NULL;
+}
+
+const gint*
+library_table_get_num_column (LibraryTable *self, EntryTag tag)
+{
+    return ENTRY_TAG_IS_INT (tag) ? self->nums[tag - ENTRY_TAG_FIRST_INT] : NULL;
+}
+
+const gchar*
+library_table_get_str (LibraryTable *self, gint row, EntryTag tag)
+{
+    return self->strs[tag][row];
+}
+
+gboolean
+library_table_get_num (LibraryTable *self, gint row, EntryTag tag, gint *value)
+{
+    gint i = tag - ENTRY_TAG_FIRST_INT;
+
+    *value = self->nums[i][row];
+
+    return (self->num_set[row] & (1 << i)) != 0;
+}
+
+const gchar*
+library_table_get_extra (LibraryTable *self, gint row, const gchar *tag)
+{
+    gchar **kvs = self->extras[row];
+    gint i;
+
+    for (i = 0; kvs && kvs[i]; i += 2) {
+        if (!strcmp (kvs[i], tag)) {
+            return kvs[i+1];
+        }
+    }
+
+    return NULL;
+}
+
+const gchar**
+library_table_get_extras (LibraryTable *self, gint row)
+{
+    return (const gchar**) self->extras[row];
+}
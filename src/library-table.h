@@ -0,0 +1,58 @@
+/*
+ *      library-table.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __LIBRARY_TABLE_H__
+#define __LIBRARY_TABLE_H__
+
+#include <glib.h>
+
+#include "entry.h"
+
+G_BEGIN_DECLS
+
+// Column oriented storage for a whole library, one contiguous array per
+// well-known tag. Rows are addressed by entry id and stay packed, removing a
+// row moves the last row into its place.
+typedef struct _LibraryTable LibraryTable;
+
+LibraryTable *library_table_new (void);
+void library_table_free (LibraryTable *self);
+
+gint library_table_add_row (LibraryTable *self, guint id);
+gboolean library_table_remove_row (LibraryTable *self, guint id);
+gint library_table_get_row (LibraryTable *self, guint id);
+
+void library_table_set (LibraryTable *self, gint row, const gchar *tag, const gchar *value);
+void library_table_set_num (LibraryTable *self, gint row, EntryTag tag, gint value);
+
+guint library_table_get_num_rows (LibraryTable *self);
+const guint *library_table_get_ids (LibraryTable *self);
+const gchar **library_table_get_str_column (LibraryTable *self, EntryTag tag);
+const gint *library_table_get_num_column (LibraryTable *self, EntryTag tag);
+
+const gchar *library_table_get_str (LibraryTable *self, gint row, EntryTag tag);
+gboolean library_table_get_num (LibraryTable *self, gint row, EntryTag tag, gint *value);
+const gchar *library_table_get_extra (LibraryTable *self, gint row, const gchar *tag);
+const gchar **library_table_get_extras (LibraryTable *self, gint row);
+
+G_END_DECLS
+
+#endif /* __LIBRARY_TABLE_H__ */
@@ -19,10 +19,95 @@
  *      MA 02110-1301, USA.
  */
 
+#include <string.h>
+
 #include "media-store.h"
+#include "search-index.h"
+#include "string-pool.h"
 
 static guint signal_add;
 static guint signal_remove;
+static guint signal_added;
+static guint signal_removed;
+static guint signal_update;
+
+// Entries added or removed in a row, one batch per signal
+typedef struct {
+    GPtrArray *entries;
+    gboolean removed;
+} PendingBatch;
+
+// Batches queued since the last flush, delivered in order from the main loop
+// so listeners always see changes in order
+typedef struct {
+    MediaStore *store;
+    GQueue *batches;
+    guint source;
+} PendingEntries;
+
+G_LOCK_DEFINE_STATIC (pending);
+static GQuark pending_quark = 0;
+
+// Secondary index over one tag, pooled value -> GPtrArray of borrowed Entry*
+typedef struct {
+    gchar *tag;
+    GHashTable *buckets;
+} StoreIndex;
+
+// Recursive so media_store_foreach_query callbacks can query again. Taken
+// before any store lock: media_store_add_index reads the entries with it held.
+static GStaticRecMutex indexes_lock = G_STATIC_REC_MUTEX_INIT;
+static GQuark indexes_quark = 0;
+
+G_LOCK_DEFINE_STATIC (search);
+static GQuark search_quark = 0;
+
+// Number of changes a store remembers for media_store_get_changes
+#define MEDIA_STORE_JOURNAL_SIZE 4096
+
+typedef struct {
+    guint64 seq;
+    MediaStoreChangeType type;
+    Entry *entry;
+    gchar **changes;
+} JournalRecord;
+
+// Ring of the last changes, record seq lives at seq % MEDIA_STORE_JOURNAL_SIZE
+typedef struct {
+    JournalRecord records[MEDIA_STORE_JOURNAL_SIZE];
+    guint64 seq;
+} Journal;
+
+G_LOCK_DEFINE_STATIC (journal);
+static GQuark journal_quark = 0;
+
+static void
+media_store_marshal_VOID__POINTER_POINTER (GClosure *closure,
+                                           GValue *return_value,
+                                           guint n_param_values,
+                                           const GValue *param_values,
+                                           gpointer invocation_hint,
+                                           gpointer marshal_data)
+{
+    typedef void (*MarshalFunc) (gpointer data1, gpointer arg_1,
+        gpointer arg_2, gpointer data2);
+    GCClosure *cc = (GCClosure*) closure;
+    gpointer data1, data2;
+    MarshalFunc callback;
+
+    if (G_CCLOSURE_SWAP_DATA (closure)) {
+        data1 = closure->data;
+        data2 = g_value_peek_pointer (param_values + 0);
+    } else {
+        data1 = g_value_peek_pointer (param_values + 0);
+        data2 = closure->data;
+    }
+
+    callback = (MarshalFunc) (marshal_data ? marshal_data : cc->callback);
+
+    callback (data1, g_value_get_pointer (param_values + 1),
+        g_value_get_pointer (param_values + 2), data2);
+}
 
 static void
 media_store_base_init (gpointer g_iface)
@@ -39,6 +124,26 @@ media_store_base_init (gpointer g_iface)
         signal_remove = g_signal_new ("remove-entry", MEDIA_STORE_TYPE,
             G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__POINTER,
             G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+        // Batched versions carrying the number of entries and an Entry** array
+        signal_added = g_signal_new ("entries-added", MEDIA_STORE_TYPE,
+            G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__UINT_POINTER,
+            G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_POINTER);
+
+        signal_removed = g_signal_new ("entries-removed", MEDIA_STORE_TYPE,
+            G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__UINT_POINTER,
+            G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_POINTER);
+
+        // Carries the Entry, changed in place, and a NULL terminated array of
+        // changed tag names each followed by its previous value
+        signal_update = g_signal_new ("update-entry", MEDIA_STORE_TYPE,
+            G_SIGNAL_RUN_LAST, 0, NULL, NULL, media_store_marshal_VOID__POINTER_POINTER,
+            G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_POINTER);
+
+        pending_quark = g_quark_from_static_string ("media-store-pending");
+        indexes_quark = g_quark_from_static_string ("media-store-indexes");
+        search_quark = g_quark_from_static_string ("media-store-search");
+        journal_quark = g_quark_from_static_string ("media-store-journal");
     }
 }
 
@@ -90,6 +195,36 @@ media_store_remove_entry (MediaStore *self, Entry *entry)
     }
 }
 
+void
+media_store_add_entries (MediaStore *self, gchar ***entries, guint len)
+{
+    MediaStoreInterface *iface = MEDIA_STORE_GET_IFACE (self);
+    guint i;
+
+    if (iface->add_entries) {
+        iface->add_entries (self, entries, len);
+    } else if (iface->add_entry) {
+        for (i = 0; i < len; i++) {
+            iface->add_entry (self, entries[i]);
+        }
+    }
+}
+
+void
+media_store_remove_entries (MediaStore *self, Entry **entries, guint len)
+{
+    MediaStoreInterface *iface = MEDIA_STORE_GET_IFACE (self);
+    guint i;
+
+    if (iface->rem_entries) {
+        iface->rem_entries (self, entries, len);
+    } else if (iface->rem_entry) {
+        for (i = 0; i < len; i++) {
+            iface->rem_entry (self, entries[i]);
+        }
+    }
+}
+
 guint
 media_store_get_media_type (MediaStore *self)
 {
@@ -138,14 +273,779 @@ media_store_get_entry (MediaStore *self, guint id)
     }
 }
 
+/*
+ * Calls func for each entry of the store in place, without the snapshot
+ * array of media_store_get_all_entries. Stores that can walk their entries
+ * keep adds and removes from other threads out until the walk is done, func
+ * must not add or remove entries itself. The entry may only live for the
+ * call, func gets the one to keep through media_store_get_entry.
+ */
+void
+media_store_foreach (MediaStore *self, MediaStoreFunc func, gpointer user_data)
+{
+    MediaStoreInterface *iface = MEDIA_STORE_GET_IFACE (self);
+    Entry **entries;
+    gint i;
+
+    if (iface->foreach) {
+        iface->foreach (self, func, user_data);
+        return;
+    }
+
+    if (!(entries = media_store_get_all_entries (self))) {
+        return;
+    }
+
+    for (i = 0; entries[i] && func (entries[i], user_data); i++);
+
+    g_free (entries);
+}
+
+Artist**
+media_store_get_artists (MediaStore *self)
+{
+    MediaStoreInterface *iface = MEDIA_STORE_GET_IFACE (self);
+
+    if (iface->get_artists) {
+        return iface->get_artists (self);
+    } else {
+        return NULL;
+    }
+}
+
+// Returns a borrowed array holding the value of tag for every entry, or NULL
+// when the store keeps no such column. Valid until the store changes.
+const gchar**
+media_store_get_column (MediaStore *self, EntryTag tag, guint *len)
+{
+    MediaStoreInterface *iface = MEDIA_STORE_GET_IFACE (self);
+
+    if (iface->get_column) {
+        return iface->get_column (self, tag, len);
+    } else {
+        return NULL;
+    }
+}
+
+// Loads every tag of the partial entries among entries. Loaded tags that
+// changed since are emitted as updates.
+void
+media_store_hydrate_entries (MediaStore *self, Entry **entries, guint len)
+{
+    MediaStoreInterface *iface = MEDIA_STORE_GET_IFACE (self);
+    Entry **partial;
+    guint i, n = 0;
+
+    if (!iface->hydrate) {
+        return;
+    }
+
+    partial = g_new (Entry*, len);
+    for (i = 0; i < len; i++) {
+        if (entry_is_partial (entries[i])) {
+            partial[n++] = entries[i];
+        }
+    }
+
+    if (n > 0) {
+        iface->hydrate (self, partial, n);
+    }
+
+    g_free (partial);
+}
+
+static void
+store_index_free_bucket (GPtrArray *bucket)
+{
+    g_ptr_array_free (bucket, TRUE);
+}
+
+static void
+store_index_free (StoreIndex *index)
+{
+    g_hash_table_unref (index->buckets);
+    g_free (index->tag);
+    g_free (index);
+}
+
+static void
+store_index_insert (StoreIndex *index, Entry *entry, const gchar *value)
+{
+    GPtrArray *bucket;
+
+    if (!value) {
+        return;
+    }
+
+    bucket = g_hash_table_lookup (index->buckets, value);
+    if (!bucket) {
+        bucket = g_ptr_array_new ();
+        g_hash_table_insert (index->buckets, (gpointer) string_pool_ref (value), bucket);
+    }
+
+    g_ptr_array_add (bucket, entry);
+}
+
+static void
+store_index_remove (StoreIndex *index, Entry *entry, const gchar *value)
+{
+    GPtrArray *bucket;
+
+    if (!value || !(bucket = g_hash_table_lookup (index->buckets, value))) {
+        return;
+    }
+
+    g_ptr_array_remove_fast (bucket, entry);
+
+    if (bucket->len == 0) {
+        g_hash_table_remove (index->buckets, value);
+    }
+}
+
+// Called with indexes_lock held
+static StoreIndex*
+media_store_find_index (MediaStore *self, const gchar *tag)
+{
+    GPtrArray *indexes = g_object_get_qdata (G_OBJECT (self), indexes_quark);
+    guint i;
+
+    for (i = 0; indexes && i < indexes->len; i++) {
+        StoreIndex *index = g_ptr_array_index (indexes, i);
+
+        if (!strcmp (index->tag, tag)) {
+            return index;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+media_store_free_indexes (GPtrArray *indexes)
+{
+    g_ptr_array_foreach (indexes, (GFunc) store_index_free, NULL);
+    g_ptr_array_free (indexes, TRUE);
+}
+
+/*
+ * Keeps entries findable by the value of tag through media_store_query. The
+ * index follows the store through its add, remove and update signals, so it
+ * only sees tags that are loaded for partial entries.
+ */
+void
+media_store_add_index (MediaStore *self, const gchar *tag)
+{
+    GPtrArray *indexes;
+    StoreIndex *index;
+    Entry **entries;
+    guint i;
+
+    g_static_rec_mutex_lock (&indexes_lock);
+
+    if (media_store_find_index (self, tag)) {
+        g_static_rec_mutex_unlock (&indexes_lock);
+        return;
+    }
+
+    indexes = g_object_get_qdata (G_OBJECT (self), indexes_quark);
+    if (!indexes) {
+        indexes = g_ptr_array_new ();
+        g_object_set_qdata_full (G_OBJECT (self), indexes_quark, indexes,
+            (GDestroyNotify) media_store_free_indexes);
+    }
+
+    index = g_new0 (StoreIndex, 1);
+    index->tag = g_strdup (tag);
+    index->buckets = g_hash_table_new_full (g_str_hash, g_str_equal,
+        (GDestroyNotify) string_pool_unref, (GDestroyNotify) store_index_free_bucket);
+
+    entries = media_store_get_all_entries (self);
+    for (i = 0; entries && entries[i]; i++) {
+        store_index_insert (index, entries[i], entry_get_tag_str (entries[i], tag));
+    }
+    g_free (entries);
+
+    g_ptr_array_add (indexes, index);
+
+    g_static_rec_mutex_unlock (&indexes_lock);
+}
+
+/*
+ * Returns a NULL terminated array of the entries whose tag equals value, the
+ * array has to be freed but the entries are borrowed from the store. Returns
+ * NULL when tag is not indexed, callers then have to scan the entries.
+ */
+Entry**
+media_store_query (MediaStore *self, const gchar *tag, const gchar *value)
+{
+    StoreIndex *index;
+    GPtrArray *bucket;
+    Entry **ret;
+
+    g_static_rec_mutex_lock (&indexes_lock);
+
+    if (!(index = media_store_find_index (self, tag))) {
+        g_static_rec_mutex_unlock (&indexes_lock);
+        return NULL;
+    }
+
+    bucket = value ? g_hash_table_lookup (index->buckets, value) : NULL;
+
+    if (bucket) {
+        ret = g_new (Entry*, bucket->len + 1);
+        memcpy (ret, bucket->pdata, bucket->len * sizeof (Entry*));
+        ret[bucket->len] = NULL;
+    } else {
+        ret = g_new0 (Entry*, 1);
+    }
+
+    g_static_rec_mutex_unlock (&indexes_lock);
+
+    return ret;
+}
+
+/*
+ * Keeps a word index over the titles, artists, albums, shows and file names
+ * of the store for media_store_search.
+ */
+void
+media_store_enable_search (MediaStore *self)
+{
+    SearchIndex *index;
+    Entry **entries;
+    guint i;
+
+    G_LOCK (search);
+
+    if (g_object_get_qdata (G_OBJECT (self), search_quark)) {
+        G_UNLOCK (search);
+        return;
+    }
+
+    index = search_index_new ();
+
+    entries = media_store_get_all_entries (self);
+    for (i = 0; entries && entries[i]; i++) {
+        search_index_add (index, entries[i]);
+    }
+    g_free (entries);
+
+    g_object_set_qdata_full (G_OBJECT (self), search_quark, index,
+        (GDestroyNotify) search_index_free);
+
+    G_UNLOCK (search);
+}
+
+/*
+ * Returns the entries matching every word of query, best matches first and at
+ * most max of them unless max is 0. The array has to be freed, the entries are
+ * borrowed from the store. Returns NULL when search is not enabled.
+ */
+Entry**
+media_store_search (MediaStore *self, const gchar *query, guint max)
+{
+    SearchIndex *index;
+    Entry **ret = NULL;
+
+    G_LOCK (search);
+
+    if ((index = g_object_get_qdata (G_OBJECT (self), search_quark))) {
+        ret = search_index_query (index, query, max);
+    }
+
+    G_UNLOCK (search);
+
+    return ret;
+}
+
+/*
+ * Whether entry would be among the results of media_store_search for query,
+ * checked against that entry alone. Returns FALSE when search is not enabled.
+ */
+gboolean
+media_store_search_match (MediaStore *self, Entry *entry, const gchar *query)
+{
+    SearchIndex *index;
+    gboolean ret = FALSE;
+
+    G_LOCK (search);
+
+    if ((index = g_object_get_qdata (G_OBJECT (self), search_quark))) {
+        ret = search_index_match (index, entry, query);
+    }
+
+    G_UNLOCK (search);
+
+    return ret;
+}
+
+// Copies of tag, old value pairs, values can be NULL so these are not strvs
+static gchar**
+media_store_copy_changes (gchar **changes)
+{
+    gchar **ret;
+    guint i, n;
+
+    if (!changes) {
+        return NULL;
+    }
+
+    for (n = 0; changes[n]; n += 2);
+
+    ret = g_new (gchar*, n + 1);
+    for (i = 0; i < n; i++) {
+        ret[i] = g_strdup (changes[i]);
+    }
+    ret[n] = NULL;
+
+    return ret;
+}
+
+static void
+media_store_free_changes (gchar **changes)
+{
+    guint i;
+
+    if (!changes) {
+        return;
+    }
+
+    for (i = 0; changes[i]; i += 2) {
+        g_free (changes[i]);
+        g_free (changes[i + 1]);
+    }
+
+    g_free (changes);
+}
+
+static void
+media_store_journal_free (Journal *journal)
+{
+    guint i;
+
+    for (i = 0; i < MEDIA_STORE_JOURNAL_SIZE; i++) {
+        if (journal->records[i].entry) {
+            g_object_unref (journal->records[i].entry);
+        }
+        media_store_free_changes (journal->records[i].changes);
+    }
+
+    g_free (journal);
+}
+
+static void
+media_store_journal_add (MediaStore *self, Entry *entry, MediaStoreChangeType type,
+    gchar **changes)
+{
+    JournalRecord *rec;
+    Journal *journal;
+
+    G_LOCK (journal);
+
+    journal = g_object_get_qdata (G_OBJECT (self), journal_quark);
+    if (!journal) {
+        journal = g_new0 (Journal, 1);
+        g_object_set_qdata_full (G_OBJECT (self), journal_quark, journal,
+            (GDestroyNotify) media_store_journal_free);
+    }
+
+    journal->seq++;
+    rec = &journal->records[journal->seq % MEDIA_STORE_JOURNAL_SIZE];
+
+    if (rec->entry) {
+        g_object_unref (rec->entry);
+    }
+    media_store_free_changes (rec->changes);
+
+    rec->seq = journal->seq;
+    rec->type = type;
+    rec->entry = g_object_ref (entry);
+    rec->changes = media_store_copy_changes (changes);
+
+    G_UNLOCK (journal);
+}
+
+// Sequence number of the last change of the store, 0 before the first one
+guint64
+media_store_get_sequence (MediaStore *self)
+{
+    Journal *journal;
+    guint64 ret;
+
+    G_LOCK (journal);
+
+    journal = g_object_get_qdata (G_OBJECT (self), journal_quark);
+    ret = journal ? journal->seq : 0;
+
+    G_UNLOCK (journal);
+
+    return ret;
+}
+
+// Net effect of the journaled changes on one entry
+typedef struct {
+    Entry *entry;
+    gboolean before, after;
+    GPtrArray *old;
+} NetChange;
+
+static void
+media_store_net_change (NetChange *net, JournalRecord *rec)
+{
+    guint i, j;
+
+    if (rec->type == MEDIA_STORE_ADDED) {
+        net->after = TRUE;
+        return;
+    }
+
+    if (rec->type == MEDIA_STORE_REMOVED) {
+        net->after = FALSE;
+        return;
+    }
+
+    // The first old value of a tag is the one the caller last saw
+    for (i = 0; rec->changes && rec->changes[i]; i += 2) {
+        for (j = 0; j < net->old->len; j += 2) {
+            if (!strcmp (g_ptr_array_index (net->old, j), rec->changes[i])) {
+                break;
+            }
+        }
+
+        if (j == net->old->len) {
+            g_ptr_array_add (net->old, g_strdup (rec->changes[i]));
+            g_ptr_array_add (net->old, g_strdup (rec->changes[i + 1]));
+        }
+    }
+}
+
+/*
+ * Calls func once for every entry that changed after sequence number since,
+ * with the net change: entries added and removed again are skipped, and
+ * updates are merged with the old values from before since. Returns FALSE
+ * without calling func when those changes are no longer journaled, callers
+ * then have to start over from the current entries.
+ */
+gboolean
+media_store_get_changes (MediaStore *self, guint64 since,
+    MediaStoreChangeFunc func, gpointer user_data)
+{
+    GPtrArray *order;
+    GHashTable *nets;
+    JournalRecord *recs;
+    Journal *journal;
+    guint64 seq, n, i;
+
+    G_LOCK (journal);
+
+    journal = g_object_get_qdata (G_OBJECT (self), journal_quark);
+    seq = journal ? journal->seq : 0;
+
+    if (since > seq || seq - since > MEDIA_STORE_JOURNAL_SIZE) {
+        G_UNLOCK (journal);
+        return FALSE;
+    }
+
+    n = seq - since;
+    recs = g_new (JournalRecord, n);
+
+    // Slots are reused by writers on other threads once the lock is dropped
+    for (i = 0; i < n; i++) {
+        recs[i] = journal->records[(since + 1 + i) % MEDIA_STORE_JOURNAL_SIZE];
+        g_object_ref (recs[i].entry);
+        recs[i].changes = media_store_copy_changes (recs[i].changes);
+    }
+
+    G_UNLOCK (journal);
+
+    nets = g_hash_table_new (g_direct_hash, g_direct_equal);
+    order = g_ptr_array_new ();
+
+    for (i = 0; i < n; i++) {
+        NetChange *net = g_hash_table_lookup (nets, recs[i].entry);
+
+        if (!net) {
+            net = g_new0 (NetChange, 1);
+            net->entry = recs[i].entry;
+            net->before = net->after = recs[i].type != MEDIA_STORE_ADDED;
+            net->old = g_ptr_array_new ();
+
+            g_hash_table_insert (nets, net->entry, net);
+            g_ptr_array_add (order, net);
+        }
+
+        // Updates while the entry is gone do not matter to the caller
+        if (net->after || recs[i].type == MEDIA_STORE_ADDED) {
+            media_store_net_change (net, &recs[i]);
+        }
+    }
+
+    for (i = 0; i < order->len; i++) {
+        NetChange *net = g_ptr_array_index (order, i);
+
+        g_ptr_array_add (net->old, NULL);
+
+        if (!net->before && net->after) {
+            func (net->entry, MEDIA_STORE_ADDED, NULL, user_data);
+        } else if (net->before && !net->after) {
+            func (net->entry, MEDIA_STORE_REMOVED, (gchar**) net->old->pdata, user_data);
+        } else if (net->before) {
+            func (net->entry, MEDIA_STORE_UPDATED, (gchar**) net->old->pdata, user_data);
+        }
+
+        media_store_free_changes ((gchar**) g_ptr_array_free (net->old, FALSE));
+        g_free (net);
+    }
+
+    for (i = 0; i < n; i++) {
+        g_object_unref (recs[i].entry);
+        media_store_free_changes (recs[i].changes);
+    }
+
+    g_ptr_array_free (order, TRUE);
+    g_hash_table_unref (nets);
+    g_free (recs);
+
+    return TRUE;
+}
+
+static void
+media_store_search_entry (MediaStore *self, Entry *entry, gboolean add)
+{
+    SearchIndex *index;
+
+    G_LOCK (search);
+
+    if ((index = g_object_get_qdata (G_OBJECT (self), search_quark))) {
+        if (add) {
+            search_index_add (index, entry);
+        } else {
+            search_index_remove (index, entry);
+        }
+    }
+
+    G_UNLOCK (search);
+}
+
+/*
+ * Calls func for each entry whose tag equals value, without copying them.
+ * Returns FALSE when tag is not indexed. func must not add or remove entries
+ * of the store.
+ */
+gboolean
+media_store_foreach_query (MediaStore *self, const gchar *tag, const gchar *value,
+    MediaStoreFunc func, gpointer user_data)
+{
+    StoreIndex *index;
+    GPtrArray *bucket;
+    guint i;
+
+    g_static_rec_mutex_lock (&indexes_lock);
+
+    if (!(index = media_store_find_index (self, tag))) {
+        g_static_rec_mutex_unlock (&indexes_lock);
+        return FALSE;
+    }
+
+    bucket = value ? g_hash_table_lookup (index->buckets, value) : NULL;
+
+    for (i = 0; bucket && i < bucket->len; i++) {
+        if (!func (g_ptr_array_index (bucket, i), user_data)) {
+            break;
+        }
+    }
+
+    g_static_rec_mutex_unlock (&indexes_lock);
+
+    return TRUE;
+}
+
+static void
+media_store_index_entry (MediaStore *self, Entry *entry, gboolean add)
+{
+    GPtrArray *indexes;
+    guint i;
+
+    g_static_rec_mutex_lock (&indexes_lock);
+
+    indexes = g_object_get_qdata (G_OBJECT (self), indexes_quark);
+    for (i = 0; indexes && i < indexes->len; i++) {
+        StoreIndex *index = g_ptr_array_index (indexes, i);
+        const gchar *value = entry_get_tag_str (entry, index->tag);
+
+        if (add) {
+            store_index_insert (index, entry, value);
+        } else {
+            store_index_remove (index, entry, value);
+        }
+    }
+
+    g_static_rec_mutex_unlock (&indexes_lock);
+}
+
+static void
+media_store_reindex_entry (MediaStore *self, Entry *entry, gchar **changes)
+{
+    GPtrArray *indexes;
+    guint i, j;
+
+    g_static_rec_mutex_lock (&indexes_lock);
+
+    indexes = g_object_get_qdata (G_OBJECT (self), indexes_quark);
+    for (i = 0; indexes && i < indexes->len; i++) {
+        StoreIndex *index = g_ptr_array_index (indexes, i);
+
+        for (j = 0; changes[j]; j += 2) {
+            if (!strcmp (changes[j], index->tag)) {
+                store_index_remove (index, entry, changes[j + 1]);
+                store_index_insert (index, entry, entry_get_tag_str (entry, index->tag));
+                break;
+            }
+        }
+    }
+
+    g_static_rec_mutex_unlock (&indexes_lock);
+}
+
+static void
+media_store_free_batch (PendingBatch *batch)
+{
+    guint i;
+
+    for (i = 0; i < batch->entries->len; i++) {
+        g_object_unref (g_ptr_array_index (batch->entries, i));
+    }
+
+    g_ptr_array_free (batch->entries, TRUE);
+    g_free (batch);
+}
+
+static gboolean
+media_store_flush_idle (PendingEntries *pe)
+{
+    PendingBatch *batch;
+    GQueue *batches;
+
+    G_LOCK (pending);
+    pe->source = 0;
+    batches = pe->batches;
+    pe->batches = g_queue_new ();
+    G_UNLOCK (pending);
+
+    while ((batch = g_queue_pop_head (batches))) {
+        g_signal_emit (pe->store, batch->removed ? signal_removed : signal_added, 0,
+            batch->entries->len, batch->entries->pdata);
+
+        media_store_free_batch (batch);
+    }
+
+    g_queue_free (batches);
+
+    return FALSE;
+}
+
+static void
+media_store_pending_free (PendingEntries *pe)
+{
+    PendingBatch *batch;
+
+    if (pe->source) {
+        g_source_remove (pe->source);
+    }
+
+    while ((batch = g_queue_pop_head (pe->batches))) {
+        media_store_free_batch (batch);
+    }
+
+    g_queue_free (pe->batches);
+    g_free (pe);
+}
+
+static void
+media_store_queue_entry (MediaStore *self, Entry *entry, gboolean removed)
+{
+    PendingEntries *pe;
+    PendingBatch *batch;
+
+    G_LOCK (pending);
+
+    pe = g_object_get_qdata (G_OBJECT (self), pending_quark);
+    if (!pe) {
+        pe = g_new0 (PendingEntries, 1);
+        pe->store = self;
+        pe->batches = g_queue_new ();
+        g_object_set_qdata_full (G_OBJECT (self), pending_quark, pe,
+            (GDestroyNotify) media_store_pending_free);
+    }
+
+    // A change of the other kind starts a new batch behind the queued ones,
+    // so a remove never overtakes its add
+    batch = g_queue_peek_tail (pe->batches);
+    if (!batch || batch->removed != removed) {
+        batch = g_new0 (PendingBatch, 1);
+        batch->entries = g_ptr_array_new ();
+        batch->removed = removed;
+        g_queue_push_tail (pe->batches, batch);
+    }
+
+    g_ptr_array_add (batch->entries, g_object_ref (entry));
+
+    if (!pe->source) {
+        pe->source = g_idle_add ((GSourceFunc) media_store_flush_idle, pe);
+    }
+
+    G_UNLOCK (pending);
+}
+
 void
 _media_store_emit_add_entry (MediaStore *self, Entry *entry)
 {
+    media_store_index_entry (self, entry, TRUE);
+    media_store_search_entry (self, entry, TRUE);
+    media_store_journal_add (self, entry, MEDIA_STORE_ADDED, NULL);
+
     g_signal_emit (self, signal_add, 0, entry);
+
+    media_store_queue_entry (self, entry, FALSE);
+}
+
+/*
+ * Announces entries loaded in the background. They are indexed like added
+ * entries, but listeners only hear of them through entries-added, which is
+ * emitted from the main loop, so this can be called from the loading thread.
+ */
+void
+_media_store_emit_loaded_entries (MediaStore *self, Entry **entries, guint len)
+{
+    guint i;
+
+    for (i = 0; i < len; i++) {
+        media_store_index_entry (self, entries[i], TRUE);
+        media_store_search_entry (self, entries[i], TRUE);
+        media_store_journal_add (self, entries[i], MEDIA_STORE_ADDED, NULL);
+
+        media_store_queue_entry (self, entries[i], FALSE);
+    }
+}
+
+void
+_media_store_emit_update_entry (MediaStore *self, Entry *entry, gchar **changes)
+{
+    media_store_reindex_entry (self, entry, changes);
+    media_store_search_entry (self, entry, TRUE);
+    media_store_journal_add (self, entry, MEDIA_STORE_UPDATED, changes);
+
+    g_signal_emit (self, signal_update, 0, entry, changes);
 }
 
 void
 _media_store_emit_remove_entry (MediaStore *self, Entry *entry)
 {
+    media_store_index_entry (self, entry, FALSE);
+    media_store_search_entry (self, entry, FALSE);
+    media_store_journal_add (self, entry, MEDIA_STORE_REMOVED, NULL);
+
     g_signal_emit (self, signal_remove, 0, entry);
+
+    media_store_queue_entry (self, entry, TRUE);
 }
@@ -36,17 +36,38 @@ G_BEGIN_DECLS
 typedef struct _MediaStore MediaStore;
 typedef struct _MediaStoreInterface MediaStoreInterface;
 
+// Called for each entry of a walk, return FALSE to stop it
+typedef gboolean (*MediaStoreFunc) (Entry *entry, gpointer user_data);
+
+typedef enum {
+    MEDIA_STORE_ADDED,
+    MEDIA_STORE_REMOVED,
+    MEDIA_STORE_UPDATED,
+} MediaStoreChangeType;
+
+// changes holds tag, old value pairs like the update-entry signal, it is
+// NULL for added entries
+typedef void (*MediaStoreChangeFunc) (Entry *entry, MediaStoreChangeType type,
+    gchar **changes, gpointer user_data);
+
 struct _MediaStoreInterface {
     GTypeInterface parent;
 
     void    (*add_entry) (MediaStore *self, gchar **entry);
     void    (*up_entry)  (MediaStore *self, guint id, gchar **entry);
     void    (*rem_entry) (MediaStore *self, Entry *entry);
+    void    (*add_entries) (MediaStore *self, gchar ***entries, guint len);
+    void    (*rem_entries) (MediaStore *self, Entry **entries, guint len);
     guint   (*get_mtype) (MediaStore *self);
     gchar*  (*get_name)  (MediaStore *self);
 
     Entry** (*get_all_entries) (MediaStore *self);
     Entry*  (*get_entry) (MediaStore *self, guint id);
+    void    (*foreach) (MediaStore *self, MediaStoreFunc func, gpointer user_data);
+
+    Artist** (*get_artists) (MediaStore *self);
+    const gchar** (*get_column) (MediaStore *self, EntryTag tag, guint *len);
+    void    (*hydrate) (MediaStore *self, Entry **entries, guint len);
 };
 
 GType media_store_get_type (void);
@@ -54,15 +75,37 @@ GType media_store_get_type (void);
 void media_store_add_entry (MediaStore *self, gchar **entry);
 void media_store_update_entry (MediaStore *self, guint id, gchar **entry);
 void media_store_remove_entry (MediaStore *self, Entry *entry);
+void media_store_add_entries (MediaStore *self, gchar ***entries, guint len);
+void media_store_remove_entries (MediaStore *self, Entry **entries, guint len);
 
 guint media_store_get_media_type (MediaStore *self);
 gchar *media_store_get_name (MediaStore *self);
 
 Entry **media_store_get_all_entries (MediaStore *self);
 Entry *media_store_get_entry (MediaStore *self, guint id);
+void media_store_foreach (MediaStore *self, MediaStoreFunc func, gpointer user_data);
+
+Artist **media_store_get_artists (MediaStore *self);
+const gchar **media_store_get_column (MediaStore *self, EntryTag tag, guint *len);
+void media_store_hydrate_entries (MediaStore *self, Entry **entries, guint len);
+
+void media_store_add_index (MediaStore *self, const gchar *tag);
+Entry **media_store_query (MediaStore *self, const gchar *tag, const gchar *value);
+gboolean media_store_foreach_query (MediaStore *self, const gchar *tag, const gchar *value,
+    MediaStoreFunc func, gpointer user_data);
+
+guint64 media_store_get_sequence (MediaStore *self);
+gboolean media_store_get_changes (MediaStore *self, guint64 since,
+    MediaStoreChangeFunc func, gpointer user_data);
+
+void media_store_enable_search (MediaStore *self);
+Entry **media_store_search (MediaStore *self, const gchar *query, guint max);
+gboolean media_store_search_match (MediaStore *self, Entry *entry, const gchar *query);
 
 void _media_store_emit_add_entry (MediaStore *self, Entry *entry);
+void _media_store_emit_loaded_entries (MediaStore *self, Entry **entries, guint len);
 void _media_store_emit_remove_entry (MediaStore *self, Entry *entry);
+void _media_store_emit_update_entry (MediaStore *self, Entry *entry, gchar **changes);
 
 G_END_DECLS
 
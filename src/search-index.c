@@ -0,0 +1,491 @@
+/*
+ *      search-index.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "search-index.h"
+#include "string-pool.h"
+
+// A word scores the weight of the best tag it appears in
+static const struct {
+    const gchar *tag;
+    guint weight;
+} search_fields[] = {
+    { "title", 8 },
+    { "artist", 4 },
+    { "show", 4 },
+    { "album", 2 },
+    { "location", 1 },
+};
+
+typedef struct {
+    Entry *entry;
+    guint weight;
+} SearchPosting;
+
+typedef struct {
+    Entry *entry;
+    guint score;
+} SearchResult;
+
+struct _SearchIndex {
+    // Pooled word -> GArray of SearchPosting
+    GHashTable *words;
+
+    // Entry -> NULL terminated array of its pooled words
+    GHashTable *entries;
+
+    // Every word in byte order for prefix lookups, each holding a pool ref.
+    // Words added since the last query wait in added and are merged in then,
+    // removed words stay until that merge finds them gone from words.
+    GPtrArray *sorted;
+    GPtrArray *added;
+    guint removed;
+};
+
+static void
+search_index_free_words (const gchar **words)
+{
+    gint i;
+
+    for (i = 0; words[i]; i++) {
+        string_pool_unref (words[i]);
+    }
+
+    g_free (words);
+}
+
+static void
+search_index_free_postings (GArray *postings)
+{
+    g_array_free (postings, TRUE);
+}
+
+SearchIndex*
+search_index_new (void)
+{
+    SearchIndex *self = g_new0 (SearchIndex, 1);
+
+    self->words = g_hash_table_new_full (g_str_hash, g_str_equal,
+        (GDestroyNotify) string_pool_unref, (GDestroyNotify) search_index_free_postings);
+    self->entries = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) search_index_free_words);
+    self->sorted = g_ptr_array_new ();
+    self->added = g_ptr_array_new ();
+
+    return self;
+}
+
+void
+search_index_free (SearchIndex *self)
+{
+    g_ptr_array_foreach (self->sorted, (GFunc) string_pool_unref, NULL);
+    g_ptr_array_foreach (self->added, (GFunc) string_pool_unref, NULL);
+    g_ptr_array_free (self->sorted, TRUE);
+    g_ptr_array_free (self->added, TRUE);
+    g_hash_table_unref (self->entries);
+    g_hash_table_unref (self->words);
+    g_free (self);
+}
+
+// Splits text into casefolded words made of letters and digits
+static void
+search_index_split (const gchar *text, gssize len, GPtrArray *words)
+{
+    gchar *norm, *fold, *p, *start = NULL;
+    gunichar c;
+
+    if (!text || !(norm = g_utf8_normalize (text, len, G_NORMALIZE_ALL))) {
+        return;
+    }
+
+    fold = g_utf8_casefold (norm, -1);
+    g_free (norm);
+
+    for (p = fold; ; p = g_utf8_next_char (p)) {
+        c = g_utf8_get_char (p);
+
+        if (c && g_unichar_isalnum (c)) {
+            if (!start) {
+                start = p;
+            }
+        } else {
+            if (start) {
+                g_ptr_array_add (words, g_strndup (start, p - start));
+                start = NULL;
+            }
+
+            if (!c) {
+                break;
+            }
+        }
+    }
+
+    g_free (fold);
+}
+
+// Only the file name of a location is searched, without its extension
+static void
+search_index_split_location (const gchar *location, GPtrArray *words)
+{
+    const gchar *name, *ext;
+
+    if (!location) {
+        return;
+    }
+
+    name = (name = strrchr (location, G_DIR_SEPARATOR)) ? name + 1 : location;
+    ext = strrchr (name, '.');
+
+    search_index_split (name, ext ? ext - name : -1, words);
+}
+
+void
+search_index_remove (SearchIndex *self, Entry *entry)
+{
+    const gchar **words = g_hash_table_lookup (self->entries, entry);
+    GArray *postings;
+    guint i, j;
+
+    if (!words) {
+        return;
+    }
+
+    for (i = 0; words[i]; i++) {
+        if (!(postings = g_hash_table_lookup (self->words, words[i]))) {
+            continue;
+        }
+
+        for (j = 0; j < postings->len; j++) {
+            if (g_array_index (postings, SearchPosting, j).entry == entry) {
+                g_array_remove_index_fast (postings, j);
+                break;
+            }
+        }
+
+        if (postings->len == 0) {
+            g_hash_table_remove (self->words, words[i]);
+            self->removed++;
+        }
+    }
+
+    g_hash_table_remove (self->entries, entry);
+}
+
+void
+search_index_add (SearchIndex *self, Entry *entry)
+{
+    GHashTable *weights;
+    GHashTableIter iter;
+    GPtrArray *split;
+    GArray *postings;
+    SearchPosting posting;
+    const gchar **words;
+    gchar *word;
+    gpointer weight;
+    guint i, j;
+
+    search_index_remove (self, entry);
+
+    // Word -> best weight among the tags of this entry
+    weights = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    split = g_ptr_array_new ();
+
+    for (i = 0; i < G_N_ELEMENTS (search_fields); i++) {
+        const gchar *value = entry_get_tag_str (entry, search_fields[i].tag);
+
+        if (!strcmp (search_fields[i].tag, "location")) {
+            search_index_split_location (value, split);
+        } else {
+            search_index_split (value, -1, split);
+        }
+
+        for (j = 0; j < split->len; j++) {
+            word = g_ptr_array_index (split, j);
+
+            if (GPOINTER_TO_UINT (g_hash_table_lookup (weights, word)) < search_fields[i].weight) {
+                g_hash_table_replace (weights, word,
+                    GUINT_TO_POINTER (search_fields[i].weight));
+            } else {
+                g_free (word);
+            }
+        }
+
+        g_ptr_array_set_size (split, 0);
+    }
+
+    g_ptr_array_free (split, TRUE);
+
+    words = g_new (const gchar*, g_hash_table_size (weights) + 1);
+    i = 0;
+
+    g_hash_table_iter_init (&iter, weights);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &word, &weight)) {
+        words[i] = string_pool_ref (word);
+
+        if (!(postings = g_hash_table_lookup (self->words, words[i]))) {
+            postings = g_array_new (FALSE, FALSE, sizeof (SearchPosting));
+            g_hash_table_insert (self->words, (gpointer) string_pool_ref (word), postings);
+            g_ptr_array_add (self->added, (gpointer) string_pool_ref (word));
+        }
+
+        posting.entry = entry;
+        posting.weight = GPOINTER_TO_UINT (weight);
+        g_array_append_val (postings, posting);
+
+        i++;
+    }
+
+    words[i] = NULL;
+    g_hash_table_insert (self->entries, entry, words);
+
+    g_hash_table_unref (weights);
+}
+
+static gint
+search_index_word_cmp (const gchar **w1, const gchar **w2)
+{
+    return strcmp (*w1, *w2);
+}
+
+// Keeps a word of the merge unless it is gone from the index or repeats the
+// previous one, a word can be removed and added again between two merges
+static void
+search_index_merge_word (SearchIndex *self, GPtrArray *merged, const gchar *word)
+{
+    if (!g_hash_table_lookup (self->words, word) ||
+        (merged->len && !strcmp (g_ptr_array_index (merged, merged->len - 1), word))) {
+        string_pool_unref (word);
+        return;
+    }
+
+    g_ptr_array_add (merged, (gpointer) word);
+}
+
+/*
+ * Brings the sorted words up to date. Only the words added since the last
+ * query are sorted, they are then merged with the sorted words in one pass
+ * that also drops the removed ones.
+ */
+static void
+search_index_sort (SearchIndex *self)
+{
+    GPtrArray *merged;
+    guint i = 0, j = 0;
+
+    if (self->added->len == 0 && self->removed == 0) {
+        return;
+    }
+
+    qsort (self->added->pdata, self->added->len, sizeof (gpointer),
+        (GCompareFunc) search_index_word_cmp);
+
+    merged = g_ptr_array_sized_new (g_hash_table_size (self->words));
+
+    while (i < self->sorted->len || j < self->added->len) {
+        if (j == self->added->len || (i < self->sorted->len &&
+                strcmp (g_ptr_array_index (self->sorted, i),
+                    g_ptr_array_index (self->added, j)) <= 0)) {
+            search_index_merge_word (self, merged, g_ptr_array_index (self->sorted, i++));
+        } else {
+            search_index_merge_word (self, merged, g_ptr_array_index (self->added, j++));
+        }
+    }
+
+    g_ptr_array_free (self->sorted, TRUE);
+    self->sorted = merged;
+
+    g_ptr_array_set_size (self->added, 0);
+    self->removed = 0;
+}
+
+// Index of the first sorted word not below prefix
+static guint
+search_index_lower_bound (SearchIndex *self, const gchar *prefix)
+{
+    guint l = 0, r = self->sorted->len, m;
+
+    while (l < r) {
+        m = (l + r) / 2;
+
+        if (strcmp (g_ptr_array_index (self->sorted, m), prefix) < 0) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+
+    return l;
+}
+
+static gint
+search_index_result_cmp (const SearchResult *r1, const SearchResult *r2)
+{
+    if (r1->score != r2->score) {
+        return r1->score > r2->score ? -1 : 1;
+    }
+
+    return entry_sort_key_cmp (r1->entry, r2->entry);
+}
+
+/*
+ * Returns a NULL terminated array of the entries matching every word of query,
+ * each as a whole word or a word prefix, best matches first. Whole words rank
+ * above prefixes, and titles above artists, shows, albums and file names. At
+ * most max entries are returned unless max is 0. The array has to be freed,
+ * the entries are borrowed.
+ */
+Entry**
+search_index_query (SearchIndex *self, const gchar *query, guint max)
+{
+    GHashTable *scores = NULL, *next;
+    GHashTableIter iter;
+    GPtrArray *terms;
+    GArray *results;
+    SearchResult result;
+    gpointer score;
+    Entry **ret;
+    guint i, j, k;
+
+    terms = g_ptr_array_new ();
+    search_index_split (query, -1, terms);
+
+    search_index_sort (self);
+
+    for (i = 0; i < terms->len; i++) {
+        const gchar *term = g_ptr_array_index (terms, i);
+        gsize len = strlen (term);
+
+        next = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+        for (j = search_index_lower_bound (self, term); j < self->sorted->len; j++) {
+            const gchar *word = g_ptr_array_index (self->sorted, j);
+            GArray *postings;
+
+            if (strncmp (word, term, len)) {
+                break;
+            }
+
+            postings = g_hash_table_lookup (self->words, word);
+
+            for (k = 0; k < postings->len; k++) {
+                SearchPosting *p = &g_array_index (postings, SearchPosting, k);
+                guint score = word[len] ? p->weight : 2 * p->weight;
+
+                // Later words only narrow down the matches of earlier ones
+                if (scores) {
+                    guint prev = GPOINTER_TO_UINT (g_hash_table_lookup (scores, p->entry));
+
+                    if (!prev) {
+                        continue;
+                    }
+
+                    score += prev;
+                }
+
+                if (GPOINTER_TO_UINT (g_hash_table_lookup (next, p->entry)) < score) {
+                    g_hash_table_insert (next, p->entry, GUINT_TO_POINTER (score));
+                }
+            }
+        }
+
+        if (scores) {
+            g_hash_table_unref (scores);
+        }
+
+        scores = next;
+
+        if (g_hash_table_size (scores) == 0) {
+            break;
+        }
+    }
+
+    g_ptr_array_foreach (terms, (GFunc) g_free, NULL);
+    g_ptr_array_free (terms, TRUE);
+
+    if (!scores) {
+        return g_new0 (Entry*, 1);
+    }
+
+    results = g_array_sized_new (FALSE, FALSE, sizeof (SearchResult),
+        g_hash_table_size (scores));
+
+    g_hash_table_iter_init (&iter, scores);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &result.entry, &score)) {
+        result.score = GPOINTER_TO_UINT (score);
+        g_array_append_val (results, result);
+    }
+
+    g_hash_table_unref (scores);
+
+    g_array_sort (results, (GCompareFunc) search_index_result_cmp);
+
+    if (max && results->len > max) {
+        g_array_set_size (results, max);
+    }
+
+    ret = g_new (Entry*, results->len + 1);
+    for (i = 0; i < results->len; i++) {
+        ret[i] = g_array_index (results, SearchResult, i).entry;
+    }
+    ret[i] = NULL;
+
+    g_array_free (results, TRUE);
+
+    return ret;
+}
+
+/*
+ * Whether entry matches every word of query the way search_index_query
+ * matches, without looking at any other entry.
+ */
+gboolean
+search_index_match (SearchIndex *self, Entry *entry, const gchar *query)
+{
+    const gchar **words = g_hash_table_lookup (self->entries, entry);
+    GPtrArray *terms;
+    gboolean ret;
+    guint i, j;
+
+    if (!words) {
+        return FALSE;
+    }
+
+    terms = g_ptr_array_new ();
+    search_index_split (query, -1, terms);
+
+    ret = terms->len > 0;
+
+    for (i = 0; ret && i < terms->len; i++) {
+        const gchar *term = g_ptr_array_index (terms, i);
+        gsize len = strlen (term);
+
+        for (j = 0; words[j] && strncmp (words[j], term, len); j++);
+
+        ret = words[j] != NULL;
+    }
+
+    g_ptr_array_foreach (terms, (GFunc) g_free, NULL);
+    g_ptr_array_free (terms, TRUE);
+
+    return ret;
+}
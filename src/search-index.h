@@ -0,0 +1,48 @@
+/*
+ *      search-index.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __SEARCH_INDEX_H__
+#define __SEARCH_INDEX_H__
+
+#include <glib.h>
+
+#include "entry.h"
+
+G_BEGIN_DECLS
+
+// Word index over the text tags of a library, answering prefix queries with
+// results ranked by the tags that matched. Entries are borrowed, they have to
+// be removed before they are finalized.
+typedef struct _SearchIndex SearchIndex;
+
+SearchIndex *search_index_new (void);
+void search_index_free (SearchIndex *self);
+
+// Adding an entry again replaces its words with its current tags
+void search_index_add (SearchIndex *self, Entry *entry);
+void search_index_remove (SearchIndex *self, Entry *entry);
+
+Entry **search_index_query (SearchIndex *self, const gchar *query, guint max);
+gboolean search_index_match (SearchIndex *self, Entry *entry, const gchar *query);
+
+G_END_DECLS
+
+#endif /* __SEARCH_INDEX_H__ */
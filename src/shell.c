@@ -20,6 +20,7 @@
  */
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 
 #include "browser.h"
 #include "device-manager.h"
@@ -29,6 +30,7 @@
 #include "progress.h"
 #include "shell.h"
 #include "tag-reader.h"
+#include "folder-watcher.h"
 #include "tray.h"
 #include "gmediadb-store.h"
 #include "column-funcs.h"
@@ -44,6 +46,7 @@ struct _ShellPrivate {
     Playlist *playlist;
     Tray *tray;
     TagReader *tag_reader;
+    FolderWatcher *folder_watcher;
     DeviceManager *device_manager;
 
     GtkBuilder *builder;
@@ -322,6 +325,7 @@ shell_new ()
 
     self->priv->player = player_new (self);
     self->priv->tag_reader = tag_reader_new (self);
+    self->priv->folder_watcher = folder_watcher_new (self, self->priv->tag_reader);
     self->priv->tray = tray_new (self);
     self->priv->mini_pane = mini_pane_new (self);
     self->priv->playlist = playlist_new (self);
@@ -484,6 +488,28 @@ shell_remove_progress (Shell *self, Progress *p)
     gdk_threads_leave ();
 }
 
+// The library shown in page loads ahead of the others
+static void
+shell_set_load_priority (Shell *self, GtkWidget *page)
+{
+    if (self->priv->musics) {
+        gmediadb_store_set_load_priority (self->priv->musics,
+            page == GTK_WIDGET (self->priv->musicb));
+    }
+    if (self->priv->moviess) {
+        gmediadb_store_set_load_priority (self->priv->moviess,
+            page == GTK_WIDGET (self->priv->moviesb));
+    }
+    if (self->priv->music_videoss) {
+        gmediadb_store_set_load_priority (self->priv->music_videoss,
+            page == GTK_WIDGET (self->priv->music_videosb));
+    }
+    if (self->priv->showss) {
+        gmediadb_store_set_load_priority (self->priv->showss,
+            page == GTK_WIDGET (self->priv->showsb));
+    }
+}
+
 static void
 selector_changed_cb (GtkTreeSelection *selection, Shell *self)
 {
@@ -508,6 +534,8 @@ selector_changed_cb (GtkTreeSelection *selection, Shell *self)
 
         if (page >= 0) {
             gtk_notebook_set_current_page (GTK_NOTEBOOK (self->priv->sidebar_book), page);
+            shell_set_load_priority (self, gtk_notebook_get_nth_page (
+                GTK_NOTEBOOK (self->priv->sidebar_book), page));
         }
     }
 }
@@ -567,78 +595,36 @@ unlock_function () {
 }
 
 static gint
-tvshow_entry_cmp (Entry *e1, Entry *e2)
-{
-    gint res;
-    if (entry_get_id (e1) == entry_get_id (e2))
-        return 0;
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "show"), entry_get_tag_str (e2, "show"));
-    if (res != 0)
-        return res;
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "season"), entry_get_tag_str (e2, "season"));
-    if (res != 0)
-        return res;
-
-    if (entry_get_tag_int (e2, "tracknumber") != entry_get_tag_int (e1, "tracknumber"))
-        return entry_get_tag_int (e1, "tracknumber") - entry_get_tag_int (e2, "tracknumber");
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "title"), entry_get_tag_str (e2, "title"));
-    if (res != 0)
-        return res;
-
-    return -1;
-}
-
-static gint
-music_entry_cmp (Entry *e1, Entry *e2)
+library_entry_cmp (Entry *e1, Entry *e2)
 {
     gint res;
     if (entry_get_id (e1) == entry_get_id (e2))
         return 0;
 
-    res = g_strcmp0 (entry_get_tag_str (e1, "artist"), entry_get_tag_str (e2, "artist"));
-    if (res != 0)
-        return res;
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "album"), entry_get_tag_str (e2, "album"));
-    if (res != 0)
-        return res;
-
-    if (entry_get_tag_int (e2, "tracknumber") != entry_get_tag_int (e1, "tracknumber"))
-        return entry_get_tag_int (e1, "tracknumber") - entry_get_tag_int (e2, "tracknumber");
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "title"), entry_get_tag_str (e2, "title"));
+    // Sort keys depend on the media type, see entry_build_sort_key
+    res = entry_sort_key_cmp (e1, e2);
     if (res != 0)
         return res;
 
     return -1;
 }
 
-static gint
-movie_entry_cmp (Entry *e1, Entry *e2)
-{
-    return g_strcmp0 (entry_get_tag_str (e1, "title"), entry_get_tag_str (e2, "title"));
-}
-
-static gint
-music_video_entry_cmp (Entry *e1, Entry *e2)
-{
-    gint res;
-    if (entry_get_id (e1) == entry_get_id (e2))
-        return 0;
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "artist"), entry_get_tag_str (e2, "artist"));
-    if (res != 0)
-        return res;
-
-    res = g_strcmp0 (entry_get_tag_str (e1, "title"), entry_get_tag_str (e2, "title"));
-    if (res != 0)
-        return res;
-
-    return -1;
-}
+// Tags read at startup for each library, covering the browser columns,
+// panes, sort keys and album records. Anything else is loaded on demand.
+static const gchar *music_tags[] = {
+    "location", "mtime", "title", "artist", "album", "albumartist",
+    "tracknumber", "duration", "durationmethod", "year", "genre", NULL
+};
+static const gchar *movie_tags[] = {
+    "location", "mtime", "title", "duration", "durationmethod", NULL
+};
+static const gchar *music_video_tags[] = {
+    "location", "mtime", "title", "artist", "duration", "durationmethod", NULL
+};
+static const gchar *tvshow_tags[] = {
+    "location", "mtime", "title", "show", "season", "tracknumber", "duration",
+    "durationmethod", NULL
+};
 
 int
 main (int argc, char *argv[])
@@ -657,8 +643,21 @@ main (int argc, char *argv[])
 
     Shell *shell = shell_new ();
 
+    // Columnar stores trade per entry objects for contiguous tag columns
+    GMediaDBStoreFlags store_flags = g_getenv ("GMEDIAMP_COLUMNAR") ?
+        GMEDIADB_STORE_COLUMNAR : 0;
+
+    // Libraries fill in while the window is already up
+    store_flags |= GMEDIADB_STORE_ASYNC;
+
     // Create Music store/widget
-    shell->priv->musics = gmediadb_store_new ("Music", MEDIA_SONG);
+    shell->priv->musics = gmediadb_store_new_full ("Music", MEDIA_SONG,
+        store_flags, music_tags);
+    media_store_add_index (MEDIA_STORE (shell->priv->musics), "artist");
+    media_store_add_index (MEDIA_STORE (shell->priv->musics), "album");
+    media_store_add_index (MEDIA_STORE (shell->priv->musics), "albumartist");
+    media_store_add_index (MEDIA_STORE (shell->priv->musics), "location");
+    media_store_enable_search (MEDIA_STORE (shell->priv->musics));
     shell->priv->musicb = browser_new_with_model (shell, MEDIA_STORE (shell->priv->musics));
 
     browser_add_column (shell->priv->musicb, "Track", "tracknumber",
@@ -671,7 +670,7 @@ main (int argc, char *argv[])
         TRUE, (GtkTreeCellDataFunc) str_column_func);
     browser_add_column (shell->priv->musicb, "Duration", "duration",
         FALSE, (GtkTreeCellDataFunc) time_column_func);
-    browser_set_compare_func (shell->priv->musicb, music_entry_cmp);
+    browser_set_compare_func (shell->priv->musicb, library_entry_cmp);
     browser_set_pane1_tag (shell->priv->musicb, "Artist", "artist");
     browser_set_pane2_tag (shell->priv->musicb, "Album", "album");
 
@@ -681,21 +680,28 @@ main (int argc, char *argv[])
 
 
     // Create Movies store/widget
-    shell->priv->moviess = gmediadb_store_new ("Movies", MEDIA_MOVIE);
+    shell->priv->moviess = gmediadb_store_new_full ("Movies", MEDIA_MOVIE,
+        store_flags, movie_tags);
+    media_store_add_index (MEDIA_STORE (shell->priv->moviess), "location");
+    media_store_enable_search (MEDIA_STORE (shell->priv->moviess));
     shell->priv->moviesb = browser_new_with_model (shell, MEDIA_STORE (shell->priv->moviess));
 
     browser_add_column (shell->priv->moviesb, "Title", "title",
         TRUE, (GtkTreeCellDataFunc) str_column_func);
     browser_add_column (shell->priv->moviesb, "Duration", "duration",
         FALSE, (GtkTreeCellDataFunc) time_column_func);
-    browser_set_compare_func (shell->priv->moviesb, movie_entry_cmp);
+    browser_set_compare_func (shell->priv->moviesb, library_entry_cmp);
 
     shell_add_widget (shell, GTK_WIDGET (shell->priv->moviesb), "Library/Movies", NULL);
     shell_register_track_source (shell, TRACK_SOURCE (shell->priv->moviesb));
     shell_register_media_store (shell, MEDIA_STORE (shell->priv->moviess));
 
     // Create MusicVideo store/widget
-    shell->priv->music_videoss = gmediadb_store_new ("MusicVideos", MEDIA_MUSIC_VIDEO);
+    shell->priv->music_videoss = gmediadb_store_new_full ("MusicVideos", MEDIA_MUSIC_VIDEO,
+        store_flags, music_video_tags);
+    media_store_add_index (MEDIA_STORE (shell->priv->music_videoss), "artist");
+    media_store_add_index (MEDIA_STORE (shell->priv->music_videoss), "location");
+    media_store_enable_search (MEDIA_STORE (shell->priv->music_videoss));
     shell->priv->music_videosb = browser_new_with_model (shell, MEDIA_STORE (shell->priv->music_videoss));
 
     browser_add_column (shell->priv->music_videosb, "Title", "title",
@@ -704,7 +710,7 @@ main (int argc, char *argv[])
         TRUE, (GtkTreeCellDataFunc) str_column_func);
     browser_add_column (shell->priv->music_videosb, "Duration", "duration",
         FALSE, (GtkTreeCellDataFunc) time_column_func);
-    browser_set_compare_func (shell->priv->music_videosb, music_video_entry_cmp);
+    browser_set_compare_func (shell->priv->music_videosb, library_entry_cmp);
 
     browser_set_pane1_tag (shell->priv->music_videosb, "Artist", "artist");
 
@@ -713,7 +719,12 @@ main (int argc, char *argv[])
     shell_register_media_store (shell, MEDIA_STORE (shell->priv->music_videoss));
 
     // Create TVShows store/widget
-    shell->priv->showss = gmediadb_store_new ("TVShows", MEDIA_TVSHOW);
+    shell->priv->showss = gmediadb_store_new_full ("TVShows", MEDIA_TVSHOW,
+        store_flags, tvshow_tags);
+    media_store_add_index (MEDIA_STORE (shell->priv->showss), "show");
+    media_store_add_index (MEDIA_STORE (shell->priv->showss), "season");
+    media_store_add_index (MEDIA_STORE (shell->priv->showss), "location");
+    media_store_enable_search (MEDIA_STORE (shell->priv->showss));
     shell->priv->showsb = browser_new_with_model (shell, MEDIA_STORE (shell->priv->showss));
 
     browser_add_column (shell->priv->showsb, "Track", "tracknumber",
@@ -723,14 +734,14 @@ main (int argc, char *argv[])
     browser_add_column (shell->priv->showsb, "Show", "show",
         TRUE, (GtkTreeCellDataFunc) str_column_func);
     browser_add_column (shell->priv->showsb, "Season", "season",
-        TRUE, (GtkTreeCellDataFunc) str_column_func);
+        TRUE, (GtkTreeCellDataFunc) int_column_func);
     browser_add_column (shell->priv->showsb, "Duration", "duration",
         FALSE, (GtkTreeCellDataFunc) time_column_func);
 
     browser_set_pane1_tag (shell->priv->showsb, "Show", "show");
     browser_set_pane2_tag (shell->priv->showsb, "Season", "season");
 
-    browser_set_compare_func (shell->priv->showsb, tvshow_entry_cmp);
+    browser_set_compare_func (shell->priv->showsb, library_entry_cmp);
     browser_set_pane2_single_mode (shell->priv->showsb, TRUE);
 
     shell_add_widget (shell, GTK_WIDGET (shell->priv->showsb), "Library/TVShows", NULL);
@@ -743,6 +754,26 @@ main (int argc, char *argv[])
 
     shell_select_path (shell, "Library/Music");
 
+    gmediadb_store_start_load (shell->priv->musics);
+    gmediadb_store_start_load (shell->priv->moviess);
+    gmediadb_store_start_load (shell->priv->music_videoss);
+    gmediadb_store_start_load (shell->priv->showss);
+
+    // Library roots to follow live, separated like PATH
+    const gchar *watch = g_getenv ("GMEDIAMP_WATCH_FOLDERS");
+    if (watch) {
+        gchar **roots = g_strsplit (watch, G_SEARCHPATH_SEPARATOR_S, -1);
+        gint i;
+
+        for (i = 0; roots[i]; i++) {
+            if (*roots[i]) {
+                folder_watcher_add (shell->priv->folder_watcher, roots[i], NULL);
+            }
+        }
+
+        g_strfreev (roots);
+    }
+
     shell_run (shell);
 
     g_object_unref (shell->priv->player);
@@ -756,6 +787,12 @@ main (int argc, char *argv[])
     browser_set_model (shell->priv->music_videosb, NULL);
     browser_set_model (shell->priv->showsb, NULL);
 
+    // Stores may outlive this when plugins still hold them, save right away
+    gmediadb_store_save_snapshot (shell->priv->musics);
+    gmediadb_store_save_snapshot (shell->priv->moviess);
+    gmediadb_store_save_snapshot (shell->priv->music_videoss);
+    gmediadb_store_save_snapshot (shell->priv->showss);
+
     g_object_unref (shell->priv->musics);
     g_object_unref (shell->priv->moviess);
     g_object_unref (shell->priv->music_videoss);
@@ -821,20 +858,33 @@ import_dir_cb (GtkMenuItem *item, Shell *self)
     gtk_widget_destroy (dialog);
 }
 
+// Files are stat'ed once here, the tag reader skips those it saw unchanged
 static void
-shell_import_thread_rec (Shell *self, const gchar *path, const gchar *mtype)
+shell_import_thread_rec (Shell *self, const gchar *path, const gchar *mtype, GHashTable *seen)
 {
-    if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
-        tag_reader_queue_entry (self->priv->tag_reader, path, mtype);
+    struct stat st;
+
+    if (g_stat (path, &st) != 0) {
+        return;
+    }
+
+    if (S_ISREG (st.st_mode)) {
+        g_hash_table_insert (seen, g_strdup (path), GINT_TO_POINTER (TRUE));
+        tag_reader_queue_file (self->priv->tag_reader, path, &st, mtype);
 //        g_print ("IMPORTING: %s\n", path);
-    } else if (g_file_test (path, G_FILE_TEST_IS_DIR)) {
+    } else if (S_ISDIR (st.st_mode)) {
         GDir *dir = g_dir_open (path, 0, NULL);
         const gchar *entry;
+
+        if (!dir) {
+            return;
+        }
+
         while (entry = g_dir_read_name (dir)) {
             gchar *new_path = g_strdup_printf ("%s/%s", path, entry);
 //            gchar *new_path = g_strjoin ("/", path, entry, NULL);
 //            import_recurse (new_path);
-            shell_import_thread_rec (self, new_path, mtype);
+            shell_import_thread_rec (self, new_path, mtype, seen);
             g_free (new_path);
         }
 
@@ -842,6 +892,29 @@ shell_import_thread_rec (Shell *self, const gchar *path, const gchar *mtype)
     }
 }
 
+// Flags the library entry of a file that disappeared since the last import
+static void
+shell_mark_missing (Shell *self, const gchar *location)
+{
+    MediaStore *ms;
+    Entry *entry;
+    guint id;
+
+    // Looked up before taking the gdk lock, the lookup may wait for loading
+    if (!(ms = shell_find_location (self, location, &id, NULL))) {
+        return;
+    }
+
+    gdk_threads_enter ();
+
+    if ((entry = media_store_get_entry (ms, id))) {
+        entry_set_state (entry, ENTRY_STATE_MISSING);
+        g_object_unref (entry);
+    }
+
+    gdk_threads_leave ();
+}
+
 struct SIData {
     Shell *shell;
     gchar *path;
@@ -851,7 +924,26 @@ struct SIData {
 static gpointer
 shell_import_thread (struct SIData *d)
 {
-    shell_import_thread_rec (d->shell, d->path, d->mtype);
+    StatCache *stats = tag_reader_get_stat_cache (d->shell->priv->tag_reader);
+    GHashTable *seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    GPtrArray *gone;
+    gint i;
+
+    shell_import_thread_rec (d->shell, d->path, d->mtype, seen);
+
+    // Anything recorded below the path that the walk did not find is gone
+    gone = stat_cache_sweep (stats, d->path, seen);
+    for (i = 0; i < gone->len; i++) {
+        shell_mark_missing (d->shell, g_ptr_array_index (gone, i));
+    }
+
+    if (gone->len) {
+        stat_cache_save (stats);
+    }
+
+    g_ptr_array_foreach (gone, (GFunc) g_free, NULL);
+    g_ptr_array_free (gone, TRUE);
+    g_hash_table_unref (seen);
 
     g_object_unref (d->shell);
     g_free (d->path);
@@ -1006,16 +1098,130 @@ shell_get_media_stores (Shell *self)
     return list;
 }
 
-gboolean
-shell_move_to (Shell *self, gchar **e, const gchar *ms_name)
+static MediaStore*
+shell_get_media_store (Shell *self, const gchar *ms_name)
 {
     gint i;
     for (i = 0; i < self->priv->stores->len; i++) {
         MediaStore *ms = MEDIA_STORE (g_ptr_array_index (self->priv->stores, i));
         if (!g_strcmp0 (media_store_get_name (ms), ms_name)) {
-            media_store_add_entry (ms, e);
+            return ms;
+        }
+    }
+
+    return NULL;
+}
+
+gboolean
+shell_move_to (Shell *self, gchar **e, const gchar *ms_name)
+{
+    MediaStore *ms = shell_get_media_store (self, ms_name);
+
+    if (!ms) {
+        return FALSE;
+    }
+
+    media_store_add_entry (ms, e);
+
+    return TRUE;
+}
+
+gboolean
+shell_move_all_to (Shell *self, gchar ***entries, guint size, const gchar *ms_name)
+{
+    MediaStore *ms = shell_get_media_store (self, ms_name);
+
+    if (!ms) {
+        return FALSE;
+    }
+
+    media_store_add_entries (ms, entries, size);
+
+    return TRUE;
+}
+
+// TRUE once every library store has finished loading
+gboolean
+shell_is_loaded (Shell *self)
+{
+    return gmediadb_store_is_loaded (self->priv->musics) &&
+        gmediadb_store_is_loaded (self->priv->moviess) &&
+        gmediadb_store_is_loaded (self->priv->music_videoss) &&
+        gmediadb_store_is_loaded (self->priv->showss);
+}
+
+/*
+ * Looks for a library entry with the given location. Returns the store
+ * holding it, or NULL, along with its id and the modification time recorded
+ * when it was imported. mtime has to be freed. Safe to call from other threads.
+ * Waits for the libraries to load first, so the main loop should only call it
+ * once shell_is_loaded returns TRUE.
+ */
+MediaStore*
+shell_find_location (Shell *self, const gchar *location, guint *id, gchar **mtime)
+{
+    MediaStore *ret = NULL;
+    gint i;
+
+    // Files not loaded yet would pass for new ones
+    gmediadb_store_wait_loaded (self->priv->musics);
+    gmediadb_store_wait_loaded (self->priv->moviess);
+    gmediadb_store_wait_loaded (self->priv->music_videoss);
+    gmediadb_store_wait_loaded (self->priv->showss);
+
+    // Each store is searched under its own lock, tag reader threads calling
+    // this would otherwise queue up on the gdk lock
+    for (i = 0; !ret && i < self->priv->stores->len; i++) {
+        MediaStore *ms = MEDIA_STORE (g_ptr_array_index (self->priv->stores, i));
+
+        // iPods and other stores are not imported into
+        if (IS_GMEDIADB_STORE (ms) &&
+            gmediadb_store_find_location (GMEDIADB_STORE (ms), location, id, mtime)) {
+            ret = ms;
         }
     }
+
+    return ret;
+}
+
+gboolean
+shell_move_entries_to (Shell *self, Entry **entries, guint size, const gchar *ms_name)
+{
+    MediaStore *ms = shell_get_media_store (self, ms_name);
+    EntryTagIter *iters;
+    GPtrArray *kvs;
+    gchar ***list;
+    guint i;
+
+    if (!ms) {
+        return FALSE;
+    }
+
+    // Tags are borrowed from the entries, numbers from their iterators, only
+    // the arrays are allocated
+    list = g_new (gchar**, size);
+    iters = g_new (EntryTagIter, size);
+    kvs = g_ptr_array_new ();
+
+    for (i = 0; i < size; i++) {
+        g_ptr_array_set_size (kvs, 0);
+        entry_get_tags (entries[i], &iters[i], kvs);
+        g_ptr_array_add (kvs, NULL);
+
+        list[i] = g_memdup (kvs->pdata, kvs->len * sizeof (gpointer));
+    }
+
+    media_store_add_entries (ms, list, size);
+
+    for (i = 0; i < size; i++) {
+        g_free (list[i]);
+    }
+
+    g_free (list);
+    g_free (iters);
+    g_ptr_array_free (kvs, TRUE);
+
+    return TRUE;
 }
 
 static gboolean
@@ -84,6 +84,10 @@ void shell_show (Shell *self);
 
 gchar **shell_get_media_stores (Shell *self);
 gboolean shell_move_to (Shell *self, gchar **e, const gchar *ms_name);
+gboolean shell_move_all_to (Shell *self, gchar ***entries, guint size, const gchar *ms_name);
+gboolean shell_move_entries_to (Shell *self, Entry **entries, guint size, const gchar *ms_name);
+gboolean shell_is_loaded (Shell *self);
+MediaStore *shell_find_location (Shell *self, const gchar *location, guint *id, gchar **mtime);
 
 G_END_DECLS
 
@@ -0,0 +1,210 @@
+/*
+ *      snapshot-bench.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/*
+ * Compares a cold start, building entries from rows the way they come out of
+ * gmediadb, with a warm start from a library snapshot, on a synthetic
+ * library. Built with "make snapshot-bench".
+ *
+ *   snapshot-bench [entries] [media type]
+ *
+ * entries defaults to 100000. With a media type the rows of that gmediadb
+ * library are also fetched and timed, which is the part of a cold start the
+ * synthetic rows leave out. The library is only read.
+ */
+
+#include <gmediadb.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "entry.h"
+#include "library-snapshot.h"
+
+#define BENCH_SIGNATURE "bench"
+
+// Rows like gmediadb_get_all_entries returns them: "id", id, then tag pairs
+static GPtrArray*
+bench_make_rows (guint n)
+{
+    GPtrArray *rows = g_ptr_array_sized_new (n);
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        gchar **row = g_new0 (gchar*, 19);
+
+        row[0] = g_strdup ("id");
+        row[1] = g_strdup_printf ("%u", i + 1);
+        row[2] = g_strdup ("title");
+        row[3] = g_strdup_printf ("Track %u", i);
+        row[4] = g_strdup ("artist");
+        row[5] = g_strdup_printf ("Artist %u", i / 120);
+        row[6] = g_strdup ("album");
+        row[7] = g_strdup_printf ("Album %u", i / 12);
+        row[8] = g_strdup ("genre");
+        row[9] = g_strdup_printf ("Genre %u", i % 40);
+        row[10] = g_strdup ("location");
+        row[11] = g_strdup_printf ("/music/Artist %u/Album %u/%02u Track %u.ogg",
+            i / 120, i / 12, i % 12 + 1, i);
+        row[12] = g_strdup ("tracknumber");
+        row[13] = g_strdup_printf ("%u", i % 12 + 1);
+        row[14] = g_strdup ("duration");
+        row[15] = g_strdup_printf ("%u", 120 + i % 300);
+        row[16] = g_strdup ("year");
+        row[17] = g_strdup_printf ("%u", 1960 + i % 50);
+
+        g_ptr_array_add (rows, row);
+    }
+
+    return rows;
+}
+
+static Entry**
+bench_load_rows (GPtrArray *rows)
+{
+    Entry **entries = g_new0 (Entry*, rows->len + 1);
+    guint i, j;
+
+    for (i = 0; i < rows->len; i++) {
+        gchar **row = g_ptr_array_index (rows, i);
+
+        entries[i] = _entry_new (atoi (row[1]));
+        _entry_set_media_type (entries[i], MEDIA_SONG);
+
+        for (j = 2; row[j]; j += 2) {
+            _entry_set_tag_str (entries[i], row[j], row[j + 1]);
+        }
+
+        _entry_update_sort_key (entries[i]);
+    }
+
+    return entries;
+}
+
+static Entry**
+bench_load_snapshot (const gchar *path)
+{
+    LibrarySnapshot *snap = library_snapshot_open (path, 0, BENCH_SIGNATURE);
+    GPtrArray *kvs = g_ptr_array_new ();
+    Entry **entries;
+    gboolean partial;
+    gchar **pairs;
+    guint i, j, n, id;
+
+    if (!snap) {
+        return NULL;
+    }
+
+    n = library_snapshot_get_num_entries (snap);
+    entries = g_new0 (Entry*, n + 1);
+
+    for (i = 0; i < n; i++) {
+        g_ptr_array_set_size (kvs, 0);
+
+        if (!library_snapshot_get_entry (snap, i, &id, &partial, kvs)) {
+            break;
+        }
+
+        entries[i] = _entry_new (id);
+        _entry_set_media_type (entries[i], MEDIA_SONG);
+
+        pairs = (gchar**) kvs->pdata;
+        for (j = 0; pairs[j]; j += 2) {
+            _entry_set_tag_str (entries[i], pairs[j], pairs[j + 1]);
+        }
+
+        _entry_update_sort_key (entries[i]);
+    }
+
+    g_ptr_array_free (kvs, TRUE);
+    library_snapshot_close (snap);
+
+    return entries;
+}
+
+static void
+bench_free_entries (Entry **entries)
+{
+    guint i;
+
+    for (i = 0; entries && entries[i]; i++) {
+        g_object_unref (entries[i]);
+    }
+
+    g_free (entries);
+}
+
+int
+main (int argc, char *argv[])
+{
+    guint n = argc > 1 ? atoi (argv[1]) : 100000;
+    GTimer *timer;
+    GPtrArray *rows;
+    Entry **entries;
+    gchar *path;
+    gint fd;
+
+    g_type_init ();
+
+    timer = g_timer_new ();
+
+    if (argc > 2) {
+        GMediaDB *db = gmediadb_new (argv[2]);
+        GPtrArray *db_rows;
+
+        g_timer_start (timer);
+        db_rows = gmediadb_get_all_entries (db, NULL);
+        g_print ("gmediadb fetch: %u %s rows in %.3fs\n", db_rows->len, argv[2],
+            g_timer_elapsed (timer, NULL));
+
+        g_object_unref (db);
+    }
+
+    rows = bench_make_rows (n);
+
+    g_timer_start (timer);
+    entries = bench_load_rows (rows);
+    g_print ("cold: %u entries from rows in %.3fs\n", n, g_timer_elapsed (timer, NULL));
+
+    if ((fd = g_file_open_tmp ("snapshot-bench-XXXXXX", &path, NULL)) < 0) {
+        g_printerr ("Unable to create a temporary file\n");
+        return 1;
+    }
+    close (fd);
+
+    g_timer_start (timer);
+    library_snapshot_write (path, 0, BENCH_SIGNATURE, entries);
+    g_print ("write: snapshot in %.3fs\n", g_timer_elapsed (timer, NULL));
+
+    bench_free_entries (entries);
+
+    g_timer_start (timer);
+    entries = bench_load_snapshot (path);
+    g_print ("warm: %u entries from snapshot in %.3fs\n", n, g_timer_elapsed (timer, NULL));
+
+    bench_free_entries (entries);
+
+    g_unlink (path);
+    g_free (path);
+    g_timer_destroy (timer);
+
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ *      stat-cache.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stat-cache.h"
+
+typedef struct {
+    guint64 ino;
+    guint64 size;
+    gint64 mtime;
+    gboolean media;
+} StatRecord;
+
+struct _StatCache {
+    gchar *path;
+
+    // Location -> StatRecord
+    GHashTable *records;
+    GMutex *mutex;
+    gboolean dirty;
+};
+
+// One record per line: "ino size mtime media\tlocation"
+static void
+stat_cache_load (StatCache *self)
+{
+    gchar *contents, *line, *next, *tab, *end;
+    StatRecord *rec;
+
+    if (!g_file_get_contents (self->path, &contents, NULL, NULL)) {
+        return;
+    }
+
+    for (line = contents; *line; line = next) {
+        next = strchr (line, '\n');
+        if (next) {
+            *next++ = '\0';
+        } else {
+            next = line + strlen (line);
+        }
+
+        if (!(tab = strchr (line, '\t'))) {
+            continue;
+        }
+
+        rec = g_new0 (StatRecord, 1);
+        rec->ino = g_ascii_strtoull (line, &end, 10);
+        rec->size = g_ascii_strtoull (end, &end, 10);
+        rec->mtime = g_ascii_strtoll (end, &end, 10);
+        rec->media = g_ascii_strtoull (end, &end, 10) != 0;
+
+        if (end != tab) {
+            g_free (rec);
+            continue;
+        }
+
+        g_hash_table_insert (self->records, g_strdup (tab + 1), rec);
+    }
+
+    g_free (contents);
+}
+
+StatCache*
+stat_cache_new (const gchar *path)
+{
+    StatCache *self = g_new0 (StatCache, 1);
+
+    self->path = g_strdup (path);
+    self->records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    self->mutex = g_mutex_new ();
+
+    stat_cache_load (self);
+
+    return self;
+}
+
+void
+stat_cache_free (StatCache *self)
+{
+    g_hash_table_unref (self->records);
+    g_mutex_free (self->mutex);
+    g_free (self->path);
+    g_free (self);
+}
+
+gboolean
+stat_cache_save (StatCache *self)
+{
+    GHashTableIter iter;
+    const gchar *location;
+    StatRecord *rec;
+    GString *out;
+    gboolean res;
+
+    g_mutex_lock (self->mutex);
+
+    if (!self->dirty) {
+        g_mutex_unlock (self->mutex);
+        return TRUE;
+    }
+
+    out = g_string_sized_new (g_hash_table_size (self->records) * 96);
+
+    g_hash_table_iter_init (&iter, self->records);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &location, (gpointer*) &rec)) {
+        g_string_append_printf (out, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+            " %" G_GINT64_FORMAT " %d\t%s\n",
+            rec->ino, rec->size, rec->mtime, rec->media ? 1 : 0, location);
+    }
+
+    self->dirty = FALSE;
+
+    g_mutex_unlock (self->mutex);
+
+    res = g_file_set_contents (self->path, out->str, out->len, NULL);
+    if (!res) {
+        g_mutex_lock (self->mutex);
+        self->dirty = TRUE;
+        g_mutex_unlock (self->mutex);
+    }
+
+    g_string_free (out, TRUE);
+
+    return res;
+}
+
+gboolean
+stat_cache_lookup (StatCache *self,
+                   const gchar *path,
+                   const struct stat *st,
+                   gboolean *media)
+{
+    StatRecord *rec;
+    gboolean res = FALSE;
+
+    g_mutex_lock (self->mutex);
+
+    rec = g_hash_table_lookup (self->records, path);
+    if (rec && rec->ino == (guint64) st->st_ino && rec->size == (guint64) st->st_size &&
+        rec->mtime == (gint64) st->st_mtime) {
+        if (media) {
+            *media = rec->media;
+        }
+        res = TRUE;
+    }
+
+    g_mutex_unlock (self->mutex);
+
+    return res;
+}
+
+void
+stat_cache_set (StatCache *self,
+                const gchar *path,
+                const struct stat *st,
+                gboolean media)
+{
+    StatRecord *rec;
+
+    g_mutex_lock (self->mutex);
+
+    rec = g_hash_table_lookup (self->records, path);
+    if (!rec) {
+        rec = g_new0 (StatRecord, 1);
+        g_hash_table_insert (self->records, g_strdup (path), rec);
+    }
+
+    rec->ino = st->st_ino;
+    rec->size = st->st_size;
+    rec->mtime = st->st_mtime;
+    rec->media = media;
+
+    self->dirty = TRUE;
+
+    g_mutex_unlock (self->mutex);
+}
+
+void
+stat_cache_remove (StatCache *self, const gchar *path)
+{
+    g_mutex_lock (self->mutex);
+
+    if (g_hash_table_remove (self->records, path)) {
+        self->dirty = TRUE;
+    }
+
+    g_mutex_unlock (self->mutex);
+}
+
+GPtrArray*
+stat_cache_sweep (StatCache *self, const gchar *root, GHashTable *seen)
+{
+    GPtrArray *gone = g_ptr_array_new ();
+    GHashTableIter iter;
+    const gchar *location;
+    gsize len = strlen (root);
+    gint i;
+
+    g_mutex_lock (self->mutex);
+
+    g_hash_table_iter_init (&iter, self->records);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &location, NULL)) {
+        if (strncmp (location, root, len) || location[len] != '/') {
+            continue;
+        }
+
+        if (!g_hash_table_lookup (seen, location)) {
+            g_ptr_array_add (gone, g_strdup (location));
+        }
+    }
+
+    for (i = 0; i < gone->len; i++) {
+        g_hash_table_remove (self->records, g_ptr_array_index (gone, i));
+    }
+
+    if (gone->len) {
+        self->dirty = TRUE;
+    }
+
+    g_mutex_unlock (self->mutex);
+
+    return gone;
+}
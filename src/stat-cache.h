@@ -0,0 +1,54 @@
+/*
+ *      stat-cache.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __STAT_CACHE_H__
+#define __STAT_CACHE_H__
+
+#include <glib.h>
+#include <sys/stat.h>
+
+G_BEGIN_DECLS
+
+// Remembers the size, modification time and inode of every file an import
+// looked at, so rescans can skip the files that did not change without
+// probing them. Kept on disk between runs and safe to use from any thread.
+typedef struct _StatCache StatCache;
+
+StatCache *stat_cache_new (const gchar *path);
+void stat_cache_free (StatCache *self);
+
+// Writes the cache out if it changed since it was loaded or last saved
+gboolean stat_cache_save (StatCache *self);
+
+// Returns TRUE when the file was recorded with exactly this stat, media is
+// set to whether it was found to be a media file back then
+gboolean stat_cache_lookup (StatCache *self, const gchar *path,
+    const struct stat *st, gboolean *media);
+void stat_cache_set (StatCache *self, const gchar *path,
+    const struct stat *st, gboolean media);
+void stat_cache_remove (StatCache *self, const gchar *path);
+
+// Forgets the files below root that are not in seen and returns their paths
+GPtrArray *stat_cache_sweep (StatCache *self, const gchar *root, GHashTable *seen);
+
+G_END_DECLS
+
+#endif /* __STAT_CACHE_H__ */
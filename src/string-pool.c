@@ -0,0 +1,124 @@
+/*
+ *      string-pool.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "string-pool.h"
+
+// Maps each pooled string to its reference count, the key is the shared copy.
+// Keys are freed by hand on the last unref, as inserting over an existing key
+// would have the table free the copy everyone shares.
+static GHashTable *pool = NULL;
+static StringPoolStats stats;
+
+G_LOCK_DEFINE_STATIC (pool);
+
+const gchar*
+string_pool_ref (const gchar *str)
+{
+    gpointer key, val;
+    gsize len;
+
+    if (!str) {
+        return NULL;
+    }
+
+    len = strlen (str) + 1;
+
+    G_LOCK (pool);
+
+    if (!pool) {
+        pool = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+
+    if (g_hash_table_lookup_extended (pool, str, &key, &val)) {
+        g_hash_table_insert (pool, key, GUINT_TO_POINTER (GPOINTER_TO_UINT (val) + 1));
+
+        stats.hits++;
+        stats.bytes_saved += len;
+    } else {
+        key = g_strdup (str);
+        g_hash_table_insert (pool, key, GUINT_TO_POINTER (1));
+
+        stats.misses++;
+        stats.strings++;
+        stats.bytes += len;
+    }
+
+    G_UNLOCK (pool);
+
+    return key;
+}
+
+void
+string_pool_unref (const gchar *str)
+{
+    gpointer key, val;
+    guint ref;
+
+    if (!str) {
+        return;
+    }
+
+    G_LOCK (pool);
+
+    if (!pool || !g_hash_table_lookup_extended (pool, str, &key, &val)) {
+        G_UNLOCK (pool);
+        g_warning ("string_pool_unref: '%s' is not in the pool", str);
+        return;
+    }
+
+    ref = GPOINTER_TO_UINT (val);
+    if (ref > 1) {
+        g_hash_table_insert (pool, key, GUINT_TO_POINTER (ref - 1));
+        stats.bytes_saved -= strlen (str) + 1;
+    } else {
+        stats.strings--;
+        stats.bytes -= strlen (str) + 1;
+        g_hash_table_remove (pool, key);
+        g_free (key);
+    }
+
+    G_UNLOCK (pool);
+}
+
+void
+string_pool_get_stats (StringPoolStats *ret)
+{
+    G_LOCK (pool);
+    *ret = stats;
+    G_UNLOCK (pool);
+}
+
+void
+string_pool_print_stats (void)
+{
+    StringPoolStats s;
+    guint lookups;
+
+    string_pool_get_stats (&s);
+    lookups = s.hits + s.misses;
+
+    g_print ("String pool: %u strings, %" G_GSIZE_FORMAT " bytes, "
+        "%.1f%% hit rate, %" G_GSIZE_FORMAT " bytes saved\n",
+        s.strings, s.bytes,
+        lookups ? 100.0 * s.hits / lookups : 0.0, s.bytes_saved);
+}
@@ -0,0 +1,45 @@
+/*
+ *      string-pool.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __STRING_POOL_H__
+#define __STRING_POOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+    guint hits;
+    guint misses;
+    guint strings;
+    gsize bytes;
+    gsize bytes_saved;
+} StringPoolStats;
+
+const gchar *string_pool_ref (const gchar *str);
+void string_pool_unref (const gchar *str);
+
+void string_pool_get_stats (StringPoolStats *stats);
+void string_pool_print_stats (void);
+
+G_END_DECLS
+
+#endif /* __STRING_POOL_H__ */
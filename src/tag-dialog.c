@@ -139,57 +139,69 @@ tag_dialog_new ()
     return g_object_new (TAG_DIALOG_TYPE, NULL);
 }
 
-gboolean
-tag_dialog_add_entry (TagDialog *self, gchar **kvs)
+static GHashTable*
+tag_dialog_get_rows (TagDialog *self)
 {
+    GHashTable *rows = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) gtk_tree_iter_free);
     GtkTreeIter iter;
+
+    if (gtk_tree_model_get_iter_first (self->priv->store, &iter)) {
+        do {
+            gchar *key;
+
+            gtk_tree_model_get (self->priv->store, &iter, 0, &key, -1);
+
+            if (key) {
+                g_hash_table_insert (rows, key, gtk_tree_iter_copy (&iter));
+            }
+        } while (gtk_tree_model_iter_next (self->priv->store, &iter));
+    }
+
+    return rows;
+}
+
+static void
+tag_dialog_merge_tags (TagDialog *self, const gchar **kvs, GHashTable *rows)
+{
+    GtkTreeIter iter, *row;
     gint i;
 
     self->priv->count++;
 
     for (i = 0; kvs[i]; i += 2) {
-        gboolean isnew = TRUE;
-
         if (!g_strcmp0 (kvs[i], "location") ||
             !g_strcmp0 (kvs[i], "id")) {
             continue;
         }
 
-        if (gtk_tree_model_get_iter_first (self->priv->store, &iter)) {
-            do {
-                gchar *key;
-                gint cnt;
-
-                gtk_tree_model_get (self->priv->store, &iter, 0, &key, -1);
-
-                if (!g_strcmp0 (key, kvs[i])) {
-                    g_free (key);
-
-                    gchar *val;
-                    gtk_tree_model_get (self->priv->store, &iter, 1, &val, 2, &cnt, -1);
-                    if (g_strcmp0 (val, kvs[i+1])) {
-                        gtk_list_store_set (GTK_LIST_STORE (self->priv->store), &iter,
-                            1, "(Different for multiple entries)", -1);
-                    }
-
-                    gtk_list_store_set (GTK_LIST_STORE (self->priv->store), &iter, 2, cnt+1, -1);
-
-                    g_free (val);
+        if ((row = g_hash_table_lookup (rows, kvs[i]))) {
+            gchar *val;
+            gint cnt;
 
-                    isnew = FALSE;
-                    break;
-                }
+            gtk_tree_model_get (self->priv->store, row, 1, &val, 2, &cnt, -1);
+            if (g_strcmp0 (val, kvs[i+1])) {
+                gtk_list_store_set (GTK_LIST_STORE (self->priv->store), row,
+                    1, "(Different for multiple entries)", -1);
+            }
 
-                g_free (key);
-            } while (gtk_tree_model_iter_next (self->priv->store, &iter));
-        }
+            gtk_list_store_set (GTK_LIST_STORE (self->priv->store), row, 2, cnt+1, -1);
 
-        if (isnew) {
+            g_free (val);
+        } else {
             gtk_list_store_append (GTK_LIST_STORE (self->priv->store), &iter);
             gtk_list_store_set (GTK_LIST_STORE (self->priv->store), &iter,
                 0, kvs[i], 1, kvs[i+1], 2, 1, -1);
+
+            g_hash_table_insert (rows, g_strdup (kvs[i]), gtk_tree_iter_copy (&iter));
         }
     }
+}
+
+static void
+tag_dialog_mark_different (TagDialog *self)
+{
+    GtkTreeIter iter;
 
     if (gtk_tree_model_get_iter_first (self->priv->store, &iter)) {
         do {
@@ -203,6 +215,44 @@ tag_dialog_add_entry (TagDialog *self, gchar **kvs)
     }
 }
 
+gboolean
+tag_dialog_add_entry (TagDialog *self, gchar **kvs)
+{
+    GHashTable *rows = tag_dialog_get_rows (self);
+
+    tag_dialog_merge_tags (self, (const gchar**) kvs, rows);
+    tag_dialog_mark_different (self);
+
+    g_hash_table_unref (rows);
+
+    return TRUE;
+}
+
+gboolean
+tag_dialog_add_entries (TagDialog *self, Entry **entries, guint size)
+{
+    GHashTable *rows = tag_dialog_get_rows (self);
+    GPtrArray *kvs = g_ptr_array_new ();
+    EntryTagIter iter;
+    guint i;
+
+    // Tags are borrowed from the entries, kvs is only reused as a buffer
+    for (i = 0; i < size; i++) {
+        g_ptr_array_set_size (kvs, 0);
+        entry_get_tags (entries[i], &iter, kvs);
+        g_ptr_array_add (kvs, NULL);
+
+        tag_dialog_merge_tags (self, (const gchar**) kvs->pdata, rows);
+    }
+
+    tag_dialog_mark_different (self);
+
+    g_ptr_array_free (kvs, TRUE);
+    g_hash_table_unref (rows);
+
+    return TRUE;
+}
+
 gboolean
 tag_dialog_show (TagDialog *self)
 {
@@ -52,7 +52,8 @@ struct _TagDialogClass {
 TagDialog *tag_dialog_new ();
 GType tag_dialog_get_type (void);
 
-gboolean tag_dialog_add_tags (TagDialog *self, gchar **kvs);
+gboolean tag_dialog_add_entry (TagDialog *self, gchar **kvs);
+gboolean tag_dialog_add_entries (TagDialog *self, Entry **entries, guint size);
 
 gboolean tag_dialog_show (TagDialog *self);
 gboolean tag_dialog_close (TagDialog *self);
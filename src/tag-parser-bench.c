@@ -0,0 +1,126 @@
+/*
+ *      tag-parser-bench.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/*
+ * Reads the tags of every file below the given directories with the native
+ * parsers and reports files per second. Built with "make tag-parser-bench".
+ *
+ *   tag-parser-bench [-v] directory...
+ *
+ * Run it twice to see the warm page cache figure. -v prints the tags found,
+ * to compare against what avformat reports for the same files.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "tag-parser.h"
+
+typedef struct {
+    gboolean verbose;
+    guint files;
+    guint parsed;
+} BenchStats;
+
+static void
+bench_read_file (BenchStats *stats, const gchar *location)
+{
+    gchar **tags = tag_parser_read (location);
+    gint i;
+
+    stats->files++;
+
+    if (!tags) {
+        return;
+    }
+
+    stats->parsed++;
+
+    if (stats->verbose) {
+        g_print ("%s\n", location);
+        for (i = 0; tags[i]; i += 2) {
+            g_print ("    %s=%s\n", tags[i], tags[i + 1]);
+        }
+    }
+
+    g_strfreev (tags);
+}
+
+static void
+bench_read_dir (BenchStats *stats, const gchar *path)
+{
+    GDir *dir = g_dir_open (path, 0, NULL);
+    const gchar *name;
+    gchar *location;
+
+    if (!dir) {
+        return;
+    }
+
+    while ((name = g_dir_read_name (dir))) {
+        location = g_build_filename (path, name, NULL);
+
+        if (g_file_test (location, G_FILE_TEST_IS_SYMLINK)) {
+            // Links are not followed, they could loop
+        } else if (g_file_test (location, G_FILE_TEST_IS_DIR)) {
+            bench_read_dir (stats, location);
+        } else if (g_file_test (location, G_FILE_TEST_IS_REGULAR)) {
+            bench_read_file (stats, location);
+        }
+
+        g_free (location);
+    }
+
+    g_dir_close (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+    BenchStats stats = { FALSE, 0, 0 };
+    GTimer *timer;
+    gdouble secs;
+    gint i = 1;
+
+    if (argc > 1 && !strcmp (argv[1], "-v")) {
+        stats.verbose = TRUE;
+        i++;
+    }
+
+    if (i >= argc) {
+        g_printerr ("Usage: %s [-v] directory...\n", argv[0]);
+        return 1;
+    }
+
+    timer = g_timer_new ();
+
+    for (; i < argc; i++) {
+        bench_read_dir (&stats, argv[i]);
+    }
+
+    secs = g_timer_elapsed (timer, NULL);
+    g_print ("%u files, %u with tags, in %.3fs: %.0f files/s\n", stats.files,
+        stats.parsed, secs, secs > 0 ? stats.files / secs : 0.0);
+
+    g_timer_destroy (timer);
+
+    return 0;
+}
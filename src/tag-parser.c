@@ -0,0 +1,1153 @@
+/*
+ *      tag-parser.c
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "tag-parser.h"
+
+// Largest tag frame or block read into memory, bigger ones hold pictures
+#define TAG_PARSER_MAX_BLOCK 65536
+
+// How much of the start and end of an Ogg file is looked at
+#define TAG_PARSER_OGG_SPAN 65536
+
+typedef struct {
+    FILE *file;
+    gint64 size;
+
+    // Tag -> value, the first one found wins
+    GHashTable *tags;
+
+    // Length in seconds and where it came from, NULL when not found
+    gint duration;
+    const gchar *method;
+} TagParser;
+
+static const gchar *id3_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge",
+    "Hip-Hop", "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B",
+    "Rap", "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska",
+    "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient",
+    "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance", "Classical",
+    "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative",
+    "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic", "Darkwave",
+    "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap",
+    "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave",
+    "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal",
+    "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll",
+    "Hard Rock",
+};
+
+// Field names of the free form formats, compared without case
+static const struct {
+    const gchar *name;
+    const gchar *tag;
+} tag_parser_names[] = {
+    { "title", "title" },
+    { "artist", "artist" },
+    { "album", "album" },
+    { "albumartist", "albumartist" },
+    { "album artist", "albumartist" },
+    { "album_artist", "albumartist" },
+    { "tracknumber", "tracknumber" },
+    { "track", "tracknumber" },
+    { "date", "year" },
+    { "year", "year" },
+    { "genre", "genre" },
+    { "discnumber", "disc" },
+    { "disc", "disc" },
+    { "composer", "composer" },
+    { "comment", "comment" },
+    { "description", "comment" },
+};
+
+// ID3v2.3/4 frame, ID3v2.2 frame, tag
+static const gchar *id3_frames[][3] = {
+    { "TIT2", "TT2", "title" },
+    { "TPE1", "TP1", "artist" },
+    { "TALB", "TAL", "album" },
+    { "TPE2", "TP2", "albumartist" },
+    { "TRCK", "TRK", "tracknumber" },
+    { "TYER", "TYE", "year" },
+    { "TDRC", NULL, "year" },
+    { "TCON", "TCO", "genre" },
+    { "TPOS", "TPA", "disc" },
+    { "TCOM", "TCM", "composer" },
+    { "COMM", "COM", "comment" },
+};
+
+// iTunes item, tag
+static const gchar *mp4_items[][2] = {
+    { "\251nam", "title" },
+    { "\251ART", "artist" },
+    { "\251alb", "album" },
+    { "aART", "albumartist" },
+    { "\251day", "year" },
+    { "\251gen", "genre" },
+    { "\251wrt", "composer" },
+    { "\251cmt", "comment" },
+};
+
+// kbit/s by MPEG-1 or 2/2.5, layer and index
+static const gint mpeg_bitrates[2][3][16] = {
+    {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+    },
+    {
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+    },
+};
+
+static const gint mpeg_samplerates[] = { 44100, 48000, 32000 };
+
+typedef struct {
+    gint bitrate;
+    gint samplerate;
+    gint samples;
+    gint length;
+
+    // Where a Xing or Info header would start, from the frame start
+    gint xing;
+} MpegFrame;
+
+static guint32
+tag_parser_be32 (const guchar *b)
+{
+    return ((guint32) b[0] << 24) | ((guint32) b[1] << 16) | ((guint32) b[2] << 8) | b[3];
+}
+
+static guint32
+tag_parser_le32 (const guchar *b)
+{
+    return ((guint32) b[3] << 24) | ((guint32) b[2] << 16) | ((guint32) b[1] << 8) | b[0];
+}
+
+static guint32
+tag_parser_syncsafe (const guchar *b)
+{
+    return ((b[0] & 0x7F) << 21) | ((b[1] & 0x7F) << 14) | ((b[2] & 0x7F) << 7) | (b[3] & 0x7F);
+}
+
+static gboolean
+tag_parser_read_at (TagParser *p, gint64 offset, guchar *buf, gsize len)
+{
+    if (offset < 0 || offset + (gint64) len > p->size) {
+        return FALSE;
+    }
+
+    if (fseeko (p->file, (off_t) offset, SEEK_SET) != 0) {
+        return FALSE;
+    }
+
+    return fread (buf, 1, len, p->file) == len;
+}
+
+static guchar*
+tag_parser_read_block (TagParser *p, gint64 offset, gsize len)
+{
+    guchar *buf;
+
+    if (len > TAG_PARSER_MAX_BLOCK) {
+        return NULL;
+    }
+
+    buf = g_malloc (len + 1);
+    if (!tag_parser_read_at (p, offset, buf, len)) {
+        g_free (buf);
+        return NULL;
+    }
+
+    buf[len] = '\0';
+
+    return buf;
+}
+
+// Takes value, which is dropped when empty or when the tag is already set
+static void
+tag_parser_set (TagParser *p, const gchar *tag, gchar *value)
+{
+    gchar *end;
+
+    if (!value) {
+        return;
+    }
+
+    if (!g_utf8_validate (value, -1, NULL) || g_hash_table_lookup (p->tags, tag)) {
+        g_free (value);
+        return;
+    }
+
+    g_strstrip (value);
+
+    if ((!strcmp (tag, "tracknumber") || !strcmp (tag, "disc")) && (end = strchr (value, '/'))) {
+        *end = '\0';
+    } else if (!strcmp (tag, "year") && strlen (value) > 4) {
+        value[4] = '\0';
+    }
+
+    if (!*value) {
+        g_free (value);
+        return;
+    }
+
+    g_hash_table_insert (p->tags, (gpointer) tag, value);
+}
+
+static const gchar*
+tag_parser_lookup_name (const gchar *name)
+{
+    gint i;
+
+    for (i = 0; i < G_N_ELEMENTS (tag_parser_names); i++) {
+        if (!g_ascii_strcasecmp (name, tag_parser_names[i].name)) {
+            return tag_parser_names[i].tag;
+        }
+    }
+
+    return NULL;
+}
+
+static gchar*
+tag_parser_latin1 (const guchar *data, gsize len)
+{
+    const guchar *nul = memchr (data, '\0', len);
+
+    if (nul) {
+        len = nul - data;
+    }
+
+    return g_convert ((const gchar*) data, len, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+}
+
+// ID3 genres may be given by number, either bare or as "(17)"
+static gchar*
+tag_parser_id3_genre (gchar *value)
+{
+    gchar *start = value, *end;
+    guint64 num;
+
+    if (*start == '(') {
+        start++;
+    }
+
+    num = g_ascii_strtoull (start, &end, 10);
+    if (end == start || (*end && !(*value == '(' && *end == ')' && !end[1]))) {
+        return value;
+    }
+
+    if (num < G_N_ELEMENTS (id3_genres)) {
+        g_free (value);
+        return g_strdup (id3_genres[num]);
+    }
+
+    return value;
+}
+
+/*
+ * Parses the vorbis comment block shared by Ogg and FLAC, which starts with
+ * the vendor string and is followed by counted "NAME=value" fields.
+ */
+static void
+tag_parser_vorbis_comment (TagParser *p, const guchar *data, gsize len)
+{
+    guint32 vlen, count, clen, i;
+    const guchar *eq;
+    const gchar *tag;
+    gsize pos = 0;
+    gchar *name;
+
+    if (len < 8) {
+        return;
+    }
+
+    vlen = tag_parser_le32 (data);
+    if (vlen > len - 8) {
+        return;
+    }
+
+    pos = 4 + vlen;
+    count = tag_parser_le32 (data + pos);
+    pos += 4;
+
+    for (i = 0; i < count && pos + 4 <= len; i++) {
+        clen = tag_parser_le32 (data + pos);
+        pos += 4;
+
+        if (clen > len - pos) {
+            return;
+        }
+
+        if ((eq = memchr (data + pos, '=', clen))) {
+            name = g_strndup ((const gchar*) data + pos, eq - (data + pos));
+
+            if ((tag = tag_parser_lookup_name (name))) {
+                tag_parser_set (p, tag, g_strndup ((const gchar*) eq + 1,
+                    clen - (eq + 1 - (data + pos))));
+            }
+
+            g_free (name);
+        }
+
+        pos += clen;
+    }
+}
+
+static gchar*
+tag_parser_id3_text (const guchar *data, gsize len)
+{
+    gsize i;
+
+    if (len < 2) {
+        return NULL;
+    }
+
+    switch (data[0]) {
+    case 0:
+        return tag_parser_latin1 (data + 1, len - 1);
+    case 1:
+    case 2:
+        // UTF-16 strings end on an aligned pair of zero bytes
+        for (i = 1; i + 1 < len; i += 2) {
+            if (!data[i] && !data[i + 1]) {
+                break;
+            }
+        }
+
+        return g_convert ((const gchar*) data + 1, i - 1, "UTF-8",
+            data[0] == 1 ? "UTF-16" : "UTF-16BE", NULL, NULL, NULL);
+    case 3:
+        return g_strndup ((const gchar*) data + 1, len - 1);
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Comment frames put a language and a description between the encoding and
+ * the text, the encoding byte is moved up to just before the text.
+ */
+static gchar*
+tag_parser_id3_comment (guchar *data, gsize len)
+{
+    gsize i, step = data[0] == 1 || data[0] == 2 ? 2 : 1;
+
+    for (i = 4; i + step <= len; i += step) {
+        if (!data[i] && (step == 1 || !data[i + 1])) {
+            i += step - 1;
+            data[i] = data[0];
+            return tag_parser_id3_text (data + i, len - i);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Reads the text frames of an ID3v2 tag at the start of the file, skipping
+ * over the others without reading them. Returns the size of the tag, or 0
+ * when there is none.
+ */
+static gint64
+tag_parser_id3v2 (TagParser *p)
+{
+    guchar head[10];
+    guchar *data;
+    gint version, flags, hlen, fflags, skip;
+    gint64 pos, end;
+    guint32 fsize;
+    const gchar *tag;
+    gchar *value;
+    gint i;
+
+    if (!tag_parser_read_at (p, 0, head, 10) || memcmp (head, "ID3", 3)) {
+        return 0;
+    }
+
+    version = head[3];
+    flags = head[5];
+    end = 10 + tag_parser_syncsafe (head + 6);
+
+    // Tags unsynchronised as a whole would have to be decoded first
+    if (version < 2 || version > 4 || (version < 4 && (flags & 0x80))) {
+        return end + (flags & 0x10 ? 10 : 0);
+    }
+
+    pos = 10;
+    if (version > 2 && (flags & 0x40)) {
+        if (!tag_parser_read_at (p, pos, head, 4)) {
+            return end;
+        }
+        pos += version == 3 ? 4 + tag_parser_be32 (head) : tag_parser_syncsafe (head);
+    }
+
+    hlen = version == 2 ? 6 : 10;
+
+    while (pos + hlen <= end && tag_parser_read_at (p, pos, head, hlen) && head[0]) {
+        if (version == 2) {
+            fsize = (head[3] << 16) | (head[4] << 8) | head[5];
+            fflags = 0;
+        } else {
+            fsize = version == 4 ? tag_parser_syncsafe (head + 4) : tag_parser_be32 (head + 4);
+            fflags = head[9];
+        }
+
+        pos += hlen;
+        if (!fsize || pos + fsize > end) {
+            break;
+        }
+
+        tag = NULL;
+        for (i = 0; i < G_N_ELEMENTS (id3_frames); i++) {
+            const gchar *id = id3_frames[i][version == 2 ? 1 : 0];
+
+            if (id && !memcmp (head, id, version == 2 ? 3 : 4)) {
+                tag = id3_frames[i][2];
+                break;
+            }
+        }
+
+        // Compressed, encrypted and unsynchronised frames are left alone,
+        // a data length indicator is skipped
+        skip = version == 4 && (fflags & 0x01) ? 4 : 0;
+        if ((version == 3 && (fflags & 0xC0)) || (version == 4 && (fflags & 0x0E))) {
+            tag = NULL;
+        }
+
+        if (tag && fsize > skip && (data = tag_parser_read_block (p, pos + skip, fsize - skip))) {
+            if (!strcmp (tag, "comment")) {
+                value = fsize - skip > 4 ? tag_parser_id3_comment (data, fsize - skip) : NULL;
+            } else {
+                value = tag_parser_id3_text (data, fsize - skip);
+            }
+
+            if (value && !strcmp (tag, "genre")) {
+                value = tag_parser_id3_genre (value);
+            }
+
+            tag_parser_set (p, tag, value);
+            g_free (data);
+        }
+
+        pos += fsize;
+    }
+
+    return end + (flags & 0x10 ? 10 : 0);
+}
+
+// Returns the size of an ID3v1 tag ending at end, or 0
+static gint64
+tag_parser_id3v1 (TagParser *p, gint64 end)
+{
+    guchar tag[128];
+
+    if (!tag_parser_read_at (p, end - 128, tag, 128) || memcmp (tag, "TAG", 3)) {
+        return 0;
+    }
+
+    tag_parser_set (p, "title", tag_parser_latin1 (tag + 3, 30));
+    tag_parser_set (p, "artist", tag_parser_latin1 (tag + 33, 30));
+    tag_parser_set (p, "album", tag_parser_latin1 (tag + 63, 30));
+    tag_parser_set (p, "year", tag_parser_latin1 (tag + 93, 4));
+
+    // ID3v1.1 keeps the track in the last byte of the comment
+    if (!tag[125] && tag[126]) {
+        tag_parser_set (p, "tracknumber", g_strdup_printf ("%d", tag[126]));
+        tag_parser_set (p, "comment", tag_parser_latin1 (tag + 97, 28));
+    } else {
+        tag_parser_set (p, "comment", tag_parser_latin1 (tag + 97, 30));
+    }
+
+    if (tag[127] < G_N_ELEMENTS (id3_genres)) {
+        tag_parser_set (p, "genre", g_strdup (id3_genres[tag[127]]));
+    }
+
+    return 128;
+}
+
+// Returns the size of an APE tag ending at end, or 0
+static gint64
+tag_parser_ape (TagParser *p, gint64 end)
+{
+    guchar foot[32];
+    guchar *items;
+    guint32 size, count, flags, vsize, iflags, i;
+    const guchar *key_end;
+    const gchar *tag;
+    gsize pos = 0, len;
+
+    if (!tag_parser_read_at (p, end - 32, foot, 32) || memcmp (foot, "APETAGEX", 8)) {
+        return 0;
+    }
+
+    size = tag_parser_le32 (foot + 12);
+    count = tag_parser_le32 (foot + 16);
+    flags = tag_parser_le32 (foot + 20);
+
+    if (size < 32 || size > end) {
+        return 0;
+    }
+
+    len = size - 32;
+    if ((items = tag_parser_read_block (p, end - size, len))) {
+        for (i = 0; i < count && pos + 8 < len; i++) {
+            vsize = tag_parser_le32 (items + pos);
+            iflags = tag_parser_le32 (items + pos + 4);
+            pos += 8;
+
+            if (!(key_end = memchr (items + pos, '\0', len - pos)) ||
+                vsize > len - (key_end + 1 - items)) {
+                break;
+            }
+
+            // Only UTF-8 text items, not binary ones or links
+            if (!(iflags & 0x06) && (tag = tag_parser_lookup_name ((const gchar*) items + pos))) {
+                tag_parser_set (p, tag, g_strndup ((const gchar*) key_end + 1, vsize));
+            }
+
+            pos = key_end + 1 - items + vsize;
+        }
+
+        g_free (items);
+    }
+
+    return size + (flags & 0x80000000 ? 32 : 0);
+}
+
+static gboolean
+tag_parser_mpeg_frame (guint32 h, MpegFrame *f)
+{
+    gint version = (h >> 19) & 3;
+    gint layer = 4 - ((h >> 17) & 3);
+    gint index = (h >> 12) & 15;
+    gint rate = (h >> 10) & 3;
+    gint padding = (h >> 9) & 1;
+    gboolean lsf = version != 3;
+    gboolean mono = ((h >> 6) & 3) == 3;
+
+    if ((h >> 21) != 0x7FF || version == 1 || layer == 4 || index == 0 || index == 15 || rate == 3) {
+        return FALSE;
+    }
+
+    f->bitrate = mpeg_bitrates[lsf][layer - 1][index];
+    f->samplerate = mpeg_samplerates[rate] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+
+    if (layer == 1) {
+        f->samples = 384;
+        f->length = (12 * f->bitrate * 1000 / f->samplerate + padding) * 4;
+    } else {
+        f->samples = layer == 3 && lsf ? 576 : 1152;
+        f->length = f->samples / 8 * f->bitrate * 1000 / f->samplerate + padding;
+    }
+
+    // Side information comes before a Xing header
+    f->xing = 4 + (mono ? (lsf ? 9 : 17) : (lsf ? 17 : 32));
+
+    return TRUE;
+}
+
+/*
+ * Works out the length of the MPEG audio between start and end from the
+ * first frame. VBR files carry a frame count in a Xing, Info or VBRI header,
+ * others are taken to be constant bitrate.
+ */
+static gboolean
+tag_parser_mpeg (TagParser *p, gint64 start, gint64 end)
+{
+    guchar buf[4096], next[4];
+    gsize len = MIN (sizeof (buf), end - start);
+    MpegFrame f, g;
+    guint32 frames = 0;
+    const gchar *method = "xing";
+    gsize i;
+
+    if (end - start < 4 || !tag_parser_read_at (p, start, buf, len)) {
+        return FALSE;
+    }
+
+    // A frame only counts when another one follows it
+    for (i = 0; i + 4 <= len; i++) {
+        if (buf[i] != 0xFF || !tag_parser_mpeg_frame (tag_parser_be32 (buf + i), &f)) {
+            continue;
+        }
+
+        if (start + i + f.length + 4 > end) {
+            break;
+        }
+
+        if (i + f.length + 4 <= len) {
+            memcpy (next, buf + i + f.length, 4);
+        } else if (!tag_parser_read_at (p, start + i + f.length, next, 4)) {
+            return FALSE;
+        }
+
+        if (tag_parser_mpeg_frame (tag_parser_be32 (next), &g)) {
+            break;
+        }
+    }
+
+    if (i + 4 > len || start + i + f.length + 4 > end) {
+        return FALSE;
+    }
+
+    if (i + f.xing + 12 <= len && (!memcmp (buf + i + f.xing, "Xing", 4) ||
+        !memcmp (buf + i + f.xing, "Info", 4))) {
+        if (buf[i + f.xing + 7] & 0x01) {
+            frames = tag_parser_be32 (buf + i + f.xing + 8);
+        }
+    } else if (i + 36 + 18 <= len && !memcmp (buf + i + 36, "VBRI", 4)) {
+        frames = tag_parser_be32 (buf + i + 36 + 14);
+        method = "vbri";
+    }
+
+    if (frames) {
+        p->duration = (gint64) frames * f.samples / f.samplerate;
+        p->method = method;
+    } else {
+        p->duration = (end - start - i) * 8 / (f.bitrate * 1000);
+        p->method = "bitrate";
+    }
+
+    return TRUE;
+}
+
+static gboolean
+tag_parser_flac (TagParser *p, gint64 pos)
+{
+    guchar head[18];
+    guchar *data;
+    gboolean last = FALSE, found = FALSE;
+    guint32 type, len, rate;
+    guint64 samples;
+
+    for (pos += 4; !last && tag_parser_read_at (p, pos, head, 4); pos += len) {
+        last = head[0] & 0x80;
+        type = head[0] & 0x7F;
+        len = (head[1] << 16) | (head[2] << 8) | head[3];
+        pos += 4;
+
+        if (type == 0 && len >= 18 && tag_parser_read_at (p, pos, head, 18)) {
+            rate = (head[10] << 12) | (head[11] << 4) | (head[12] >> 4);
+            samples = ((guint64) (head[13] & 0x0F) << 32) | tag_parser_be32 (head + 14);
+
+            if (rate) {
+                p->duration = samples / rate;
+                p->method = "streaminfo";
+                found = TRUE;
+            }
+        } else if (type == 4 && (data = tag_parser_read_block (p, pos, len))) {
+            tag_parser_vorbis_comment (p, data, len);
+            g_free (data);
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Ogg Vorbis and Opus keep the stream setup and the comments in the first two
+ * packets, and the length in the granule position of the last page.
+ */
+static gboolean
+tag_parser_ogg (TagParser *p)
+{
+    gsize len = MIN (p->size, TAG_PARSER_OGG_SPAN);
+    guchar *buf = g_malloc (len);
+    GByteArray *packet = g_byte_array_new ();
+    gint npackets = 0, nsegs, s;
+    guint32 rate = 0, preskip = 0;
+    gboolean opus = FALSE;
+    guint64 granule = 0;
+    gsize pos = 0, data;
+    gint64 i;
+
+    if (!tag_parser_read_at (p, 0, buf, len)) {
+        goto fail;
+    }
+
+    while (npackets < 2 && pos + 27 <= len && !memcmp (buf + pos, "OggS", 4)) {
+        nsegs = buf[pos + 26];
+        data = pos + 27 + nsegs;
+
+        // The segment table itself can run past the window
+        if (data > len) {
+            goto fail;
+        }
+
+        for (s = 0; s < nsegs && npackets < 2; s++) {
+            gint seg = buf[pos + 27 + s];
+
+            if (data + seg > len) {
+                goto fail;
+            }
+
+            g_byte_array_append (packet, buf + data, seg);
+            data += seg;
+
+            if (seg == 255) {
+                continue;
+            }
+
+            if (npackets == 0) {
+                if (packet->len >= 30 && !memcmp (packet->data, "\001vorbis", 7)) {
+                    rate = tag_parser_le32 (packet->data + 12);
+                } else if (packet->len >= 19 && !memcmp (packet->data, "OpusHead", 8)) {
+                    rate = 48000;
+                    preskip = packet->data[10] | (packet->data[11] << 8);
+                    opus = TRUE;
+                } else {
+                    goto fail;
+                }
+            } else if (!opus && packet->len > 7 && !memcmp (packet->data, "\003vorbis", 7)) {
+                tag_parser_vorbis_comment (p, packet->data + 7, packet->len - 7);
+            } else if (opus && packet->len > 8 && !memcmp (packet->data, "OpusTags", 8)) {
+                tag_parser_vorbis_comment (p, packet->data + 8, packet->len - 8);
+            }
+
+            g_byte_array_set_size (packet, 0);
+            npackets++;
+        }
+
+        pos = data;
+    }
+
+    if (npackets < 2 || !rate || !tag_parser_read_at (p, p->size - len, buf, len)) {
+        goto fail;
+    }
+
+    // Pages without a finished packet carry no position
+    for (i = (gint64) len - 27; i >= 0; i--) {
+        if (!memcmp (buf + i, "OggS", 4)) {
+            granule = (guint64) tag_parser_le32 (buf + i + 6) |
+                ((guint64) tag_parser_le32 (buf + i + 10) << 32);
+            if (granule != G_MAXUINT64) {
+                break;
+            }
+        }
+    }
+
+    if (i < 0 || granule < preskip) {
+        goto fail;
+    }
+
+    p->duration = (granule - preskip) / rate;
+    p->method = "granule";
+
+    g_byte_array_free (packet, TRUE);
+    g_free (buf);
+
+    return TRUE;
+
+fail:
+    g_byte_array_free (packet, TRUE);
+    g_free (buf);
+
+    return FALSE;
+}
+
+static gboolean
+tag_parser_mp4_is (const guchar *type, const gchar *name)
+{
+    return !memcmp (type, name, 4);
+}
+
+static void
+tag_parser_mp4_item (TagParser *p, const guchar *type, gint64 pos, gint64 len)
+{
+    guchar *data;
+    guint32 dlen;
+    gint i;
+
+    if (len < 16 || !(data = tag_parser_read_block (p, pos, len))) {
+        return;
+    }
+
+    dlen = tag_parser_be32 (data);
+    if (!tag_parser_mp4_is (data + 4, "data") || dlen < 16 || dlen > len) {
+        g_free (data);
+        return;
+    }
+
+    if (tag_parser_mp4_is (type, "trkn") && dlen >= 20) {
+        tag_parser_set (p, "tracknumber", g_strdup_printf ("%d", (data[18] << 8) | data[19]));
+    } else if (tag_parser_mp4_is (type, "disk") && dlen >= 20) {
+        tag_parser_set (p, "disc", g_strdup_printf ("%d", (data[18] << 8) | data[19]));
+    } else if (tag_parser_mp4_is (type, "gnre") && dlen >= 18) {
+        guint genre = (data[16] << 8) | data[17];
+
+        if (genre > 0 && genre <= G_N_ELEMENTS (id3_genres)) {
+            tag_parser_set (p, "genre", g_strdup (id3_genres[genre - 1]));
+        }
+    } else {
+        for (i = 0; i < G_N_ELEMENTS (mp4_items); i++) {
+            if (tag_parser_mp4_is (type, mp4_items[i][0])) {
+                tag_parser_set (p, mp4_items[i][1],
+                    g_strndup ((const gchar*) data + 16, dlen - 16));
+                break;
+            }
+        }
+    }
+
+    g_free (data);
+}
+
+/*
+ * Walks the atoms between pos and end, seeking over the media data and
+ * descending only into those leading to the movie header, the track handlers
+ * and the iTunes item list.
+ */
+static gboolean
+tag_parser_mp4_atoms (TagParser *p, gint64 pos, gint64 end, gboolean in_ilst,
+                      gboolean *video, gint depth)
+{
+    guchar head[32];
+    gint64 size, body;
+    guint64 length;
+    guint32 scale;
+    gboolean found = FALSE;
+
+    if (depth > 8) {
+        return FALSE;
+    }
+
+    while (pos + 8 <= end && tag_parser_read_at (p, pos, head, 8)) {
+        size = tag_parser_be32 (head);
+        body = pos + 8;
+
+        if (size == 1) {
+            if (!tag_parser_read_at (p, pos + 8, head + 8, 8)) {
+                break;
+            }
+            size = ((gint64) tag_parser_be32 (head + 8) << 32) | tag_parser_be32 (head + 12);
+            body += 8;
+        } else if (size == 0) {
+            size = end - pos;
+        }
+
+        if (size < body - pos || pos + size > end) {
+            break;
+        }
+
+        if (in_ilst) {
+            tag_parser_mp4_item (p, head + 4, body, pos + size - body);
+        } else if (tag_parser_mp4_is (head + 4, "moov") || tag_parser_mp4_is (head + 4, "trak") ||
+            tag_parser_mp4_is (head + 4, "mdia") || tag_parser_mp4_is (head + 4, "udta")) {
+            found |= tag_parser_mp4_atoms (p, body, pos + size, FALSE, video, depth + 1);
+        } else if (tag_parser_mp4_is (head + 4, "meta")) {
+            tag_parser_mp4_atoms (p, body + 4, pos + size, FALSE, video, depth + 1);
+        } else if (tag_parser_mp4_is (head + 4, "ilst")) {
+            tag_parser_mp4_atoms (p, body, pos + size, TRUE, video, depth + 1);
+        } else if (tag_parser_mp4_is (head + 4, "mvhd") && tag_parser_read_at (p, body, head, 32)) {
+            if (head[0] == 1) {
+                scale = tag_parser_be32 (head + 20);
+                length = ((guint64) tag_parser_be32 (head + 24) << 32) | tag_parser_be32 (head + 28);
+            } else {
+                scale = tag_parser_be32 (head + 12);
+                length = tag_parser_be32 (head + 16);
+            }
+
+            if (scale) {
+                p->duration = length / scale;
+                p->method = "mvhd";
+                found = TRUE;
+            }
+        } else if (tag_parser_mp4_is (head + 4, "hdlr") && tag_parser_read_at (p, body, head, 12)) {
+            if (tag_parser_mp4_is (head + 8, "vide")) {
+                *video = TRUE;
+            }
+        }
+
+        pos += size;
+    }
+
+    return found;
+}
+
+// Reads an EBML element header, returns its length or 0. Unknown sizes are -1.
+static gint
+tag_parser_ebml_element (TagParser *p, gint64 pos, guint32 *id, gint64 *size)
+{
+    guchar head[12];
+    gsize len = MIN (sizeof (head), p->size - pos);
+    gint idlen, slen, i;
+    guint64 value;
+    gboolean unknown;
+
+    if (pos >= p->size || !tag_parser_read_at (p, pos, head, len)) {
+        return 0;
+    }
+
+    for (idlen = 1; idlen <= 4 && !(head[0] & (0x100 >> idlen)); idlen++);
+    if (idlen > 4 || idlen >= len) {
+        return 0;
+    }
+
+    for (slen = 1; slen <= 8 && !(head[idlen] & (0x100 >> slen)); slen++);
+    if (slen > 8 || idlen + slen > len) {
+        return 0;
+    }
+
+    *id = 0;
+    for (i = 0; i < idlen; i++) {
+        *id = (*id << 8) | head[i];
+    }
+
+    value = head[idlen] & (0xFF >> slen);
+    unknown = value == (0xFF >> slen);
+    for (i = 1; i < slen; i++) {
+        value = (value << 8) | head[idlen + i];
+        unknown &= head[idlen + i] == 0xFF;
+    }
+
+    *size = unknown ? -1 : (gint64) value;
+
+    return idlen + slen;
+}
+
+/*
+ * Matroska keeps the length in the Segment Info, which comes before any
+ * cluster. Only the length is read, the tags and streams are left to
+ * avformat.
+ */
+static gboolean
+tag_parser_matroska (TagParser *p)
+{
+    guint32 id;
+    gint64 size, pos = 0, end, info_end;
+    guint64 scale = 1000000, bits = 0;
+    gdouble length = -1;
+    guchar data[8];
+    gint hlen, i;
+
+    // EBML header, then the segment
+    if (!(hlen = tag_parser_ebml_element (p, pos, &id, &size)) || id != 0x1A45DFA3 || size < 0) {
+        return FALSE;
+    }
+    pos += hlen + size;
+
+    if (!(hlen = tag_parser_ebml_element (p, pos, &id, &size)) || id != 0x18538067) {
+        return FALSE;
+    }
+    pos += hlen;
+    end = size < 0 ? p->size : MIN (p->size, pos + size);
+
+    while ((hlen = tag_parser_ebml_element (p, pos, &id, &size)) && size >= 0 && id != 0x1F43B675) {
+        pos += hlen;
+
+        if (id != 0x1549A966) {
+            pos += size;
+            if (pos >= end) {
+                break;
+            }
+            continue;
+        }
+
+        for (info_end = pos + size; pos < info_end; pos += size) {
+            if (!(hlen = tag_parser_ebml_element (p, pos, &id, &size)) || size < 0) {
+                return FALSE;
+            }
+            pos += hlen;
+
+            if (size > 8 || !tag_parser_read_at (p, pos, data, size)) {
+                continue;
+            }
+
+            for (i = 0, bits = 0; i < size; i++) {
+                bits = (bits << 8) | data[i];
+            }
+
+            if (id == 0x2AD7B1 && bits) {
+                scale = bits;
+            } else if (id == 0x4489 && size == 4) {
+                union { guint32 i; gfloat f; } u = { bits };
+                length = u.f;
+            } else if (id == 0x4489 && size == 8) {
+                union { guint64 i; gdouble d; } u = { bits };
+                length = u.d;
+            }
+        }
+
+        break;
+    }
+
+    if (length < 0) {
+        return FALSE;
+    }
+
+    p->duration = length * scale / 1000000000.0;
+    p->method = "segmentinfo";
+
+    return TRUE;
+}
+
+static gboolean
+tag_parser_has_suffix (const gchar *location, const gchar *suffix)
+{
+    gsize len = strlen (location), slen = strlen (suffix);
+
+    return len >= slen && !g_ascii_strcasecmp (location + len - slen, suffix);
+}
+
+// Lays the tags out like tag_reader_get_tags does for avformat
+static gchar**
+tag_parser_finish (TagParser *p, const gchar *location)
+{
+    GHashTableIter iter;
+    const gchar *tag;
+    gchar *value, *dot;
+    gchar **tags = g_new0 (gchar*, 2 * g_hash_table_size (p->tags) + 9);
+    gint i = 0;
+
+    g_hash_table_iter_init (&iter, p->tags);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &tag, (gpointer*) &value)) {
+        tags[i++] = g_strdup (tag);
+        tags[i++] = g_strdup (value);
+    }
+
+    tags[i++] = g_strdup ("duration");
+    tags[i++] = g_strdup_printf ("%d", p->duration);
+    tags[i++] = g_strdup ("durationmethod");
+    tags[i++] = g_strdup (p->method);
+    tags[i++] = g_strdup ("location");
+    tags[i++] = g_strdup (location);
+
+    // Same made up title as for files without one read through avformat
+    if (!g_hash_table_lookup (p->tags, "title")) {
+        value = g_path_get_basename (location);
+        if ((dot = strrchr (value, '.'))) {
+            *dot = '\0';
+        }
+
+        tags[i++] = g_strdup ("title");
+        tags[i++] = value;
+    }
+
+    return tags;
+}
+
+/*
+ * Picks the parser by the magic at the start of the file. Returns TRUE when
+ * the tags were read as well as the length, video is left to avformat.
+ */
+static gboolean
+tag_parser_parse (TagParser *p, const gchar *location)
+{
+    guchar magic[12] = { 0 };
+    gint64 start, end;
+    gboolean video = FALSE, ok = FALSE;
+
+    start = tag_parser_id3v2 (p);
+
+    if (tag_parser_read_at (p, start, magic, 4) && !memcmp (magic, "fLaC", 4)) {
+        ok = tag_parser_flac (p, start);
+    } else if (!start && !memcmp (magic, "OggS", 4)) {
+        ok = tag_parser_ogg (p);
+    } else if (!start && !memcmp (magic, "\x1A\x45\xDF\xA3", 4)) {
+        tag_parser_matroska (p);
+    } else if (!start && tag_parser_read_at (p, 0, magic, 12) && !memcmp (magic + 4, "ftyp", 4)) {
+        // Video goes through avformat, which knows about its streams
+        ok = tag_parser_mp4_atoms (p, 0, p->size, FALSE, &video, 0) && !video;
+    } else if (start || tag_parser_has_suffix (location, ".mp3")) {
+        end = p->size;
+        end -= tag_parser_id3v1 (p, end);
+        end -= tag_parser_ape (p, end);
+        ok = tag_parser_mpeg (p, start, end);
+    }
+
+    return ok;
+}
+
+static gboolean
+tag_parser_open (TagParser *p, const gchar *location)
+{
+    struct stat st;
+
+    if (!(p->file = g_fopen (location, "rb"))) {
+        return FALSE;
+    }
+
+    if (fstat (fileno (p->file), &st) != 0) {
+        fclose (p->file);
+        return FALSE;
+    }
+
+    p->size = st.st_size;
+    p->duration = 0;
+    p->method = NULL;
+    p->tags = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+    return TRUE;
+}
+
+static void
+tag_parser_close (TagParser *p)
+{
+    g_hash_table_unref (p->tags);
+    fclose (p->file);
+}
+
+gchar**
+tag_parser_read (const gchar *location)
+{
+    TagParser p;
+    gchar **tags = NULL;
+
+    if (!tag_parser_open (&p, location)) {
+        return NULL;
+    }
+
+    if (tag_parser_parse (&p, location)) {
+        tags = tag_parser_finish (&p, location);
+    }
+
+    tag_parser_close (&p);
+
+    return tags;
+}
+
+const gchar*
+tag_parser_read_duration (const gchar *location, gint *duration)
+{
+    TagParser p;
+    const gchar *method;
+
+    if (!tag_parser_open (&p, location)) {
+        return NULL;
+    }
+
+    tag_parser_parse (&p, location);
+
+    if ((method = p.method)) {
+        *duration = p.duration;
+    }
+
+    tag_parser_close (&p);
+
+    return method;
+}
@@ -0,0 +1,40 @@
+/*
+ *      tag-parser.h
+ *
+ *      Copyright 2009 Brett Mravec <brett.mravec@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __TAG_PARSER_H__
+#define __TAG_PARSER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// Reads ID3v1/v2, APE, Vorbis comment and MP4 tags of the audio files it knows
+// from their headers and trailers alone, without decoding anything. Returns
+// NULL for any other file, or one it could not make sense of.
+gchar **tag_parser_read (const gchar *location);
+
+// Only finds the length in seconds, from the container headers of the same
+// formats and of Matroska. Returns how it was found, or NULL.
+const gchar *tag_parser_read_duration (const gchar *location, gint *duration);
+
+G_END_DECLS
+
+#endif /* __TAG_PARSER_H__ */
@@ -21,14 +21,26 @@
 
 #include "../config.h"
 
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
 #include "shell.h"
 #include "progress.h"
 
 #include "tag-reader.h"
 #include "media-store.h"
+#include "stat-cache.h"
+#include "tag-parser.h"
+
+// Number of read files handed to the stores at once
+#define TAG_READER_BATCH 64
+
+G_LOCK_DEFINE_STATIC (queued);
 
 static void media_store_init (MediaStoreInterface *iface);
-gpointer tag_reader_main (TagReader *self);
+static void tag_reader_work (gpointer data, TagReader *self);
+static void tag_reader_free_batch (GPtrArray *batch);
 
 G_DEFINE_TYPE_WITH_CODE (TagReader, tag_reader, G_TYPE_OBJECT,
     G_IMPLEMENT_INTERFACE (MEDIA_STORE_TYPE, media_store_init)
@@ -37,6 +49,17 @@ G_DEFINE_TYPE_WITH_CODE (TagReader, tag_reader, G_TYPE_OBJECT,
 typedef struct {
     gchar *location;
     gchar *mtype;
+
+    // Position in the queue, results are committed in this order
+    guint seq;
+
+    // Filled in by the reader thread
+    gchar **kvs;
+    gboolean has_video;
+    MediaStore *known;
+    guint id;
+    struct stat st;
+    gboolean has_stat;
 } QueueEntry;
 
 struct _TagReaderPrivate {
@@ -45,8 +68,23 @@ struct _TagReaderPrivate {
 
     gint total, done;
 
-    GAsyncQueue *job_queue;
-    GThread *job_thread;
+    GThreadPool *pool;
+
+    // Read jobs waiting for the ones queued before them, by seq
+    GHashTable *finished;
+    guint next_seq, next_commit;
+    GMutex *commit_mutex;
+
+    // Store name -> GPtrArray of read tags not yet added
+    GHashTable *batches;
+    guint num_batched;
+
+    // Locations queued but not yet committed, and those read but not yet added
+    GHashTable *queued;
+    GHashTable *batched;
+
+    // Files seen by earlier imports, unchanged ones are not read again
+    StatCache *stats;
 
     gboolean run;
 };
@@ -59,36 +97,68 @@ media_store_init (MediaStoreInterface *iface)
     iface->get_mtype = NULL;
 }
 
+static void
+tag_reader_free_job (QueueEntry *entry)
+{
+    if (entry->location) {
+        g_free (entry->location);
+    }
+    if (entry->mtype) {
+        g_free (entry->mtype);
+    }
+    if (entry->kvs) {
+        g_strfreev (entry->kvs);
+    }
+    g_free (entry);
+}
+
 static void
 tag_reader_finalize (GObject *object)
 {
     TagReader *self = TAG_READER (object);
 
+    // Jobs still queued are dropped by the readers without being read
     self->priv->run = FALSE;
+    g_thread_pool_free (self->priv->pool, FALSE, TRUE);
 
-    while (g_async_queue_length (self->priv->job_queue) > 0) {
-        QueueEntry *entry = g_async_queue_try_pop (self->priv->job_queue);
+    g_hash_table_unref (self->priv->finished);
+    g_mutex_free (self->priv->commit_mutex);
 
-        if (!entry) {
-            continue;
-        }
+    g_hash_table_unref (self->priv->batches);
+    g_hash_table_unref (self->priv->batched);
+    g_hash_table_unref (self->priv->queued);
 
-        if (entry->location) {
-            g_free (entry->location);
-        }
-        if (entry->mtype) {
-            g_free (entry->mtype);
-        }
-        g_free (entry);
-    }
+    stat_cache_save (self->priv->stats);
+    stat_cache_free (self->priv->stats);
 
-    g_async_queue_push (self->priv->job_queue, NULL);
-    g_thread_join (self->priv->job_thread);
+    G_OBJECT_CLASS (tag_reader_parent_class)->finalize (object);
+}
 
-    g_async_queue_unref (self->priv->job_queue);
+#ifdef USE_TAG_READER_AVCODEC
+#include <libavcodec/avcodec.h>
 
-    G_OBJECT_CLASS (tag_reader_parent_class)->finalize (object);
+// Lets libavcodec guard codec opening while several files are read at once
+static int
+tag_reader_av_lock (void **mutex, enum AVLockOp op)
+{
+    switch (op) {
+    case AV_LOCK_CREATE:
+        *mutex = g_mutex_new ();
+        break;
+    case AV_LOCK_OBTAIN:
+        g_mutex_lock (*mutex);
+        break;
+    case AV_LOCK_RELEASE:
+        g_mutex_unlock (*mutex);
+        break;
+    case AV_LOCK_DESTROY:
+        g_mutex_free (*mutex);
+        break;
+    }
+
+    return 0;
 }
+#endif
 
 static void
 tag_reader_class_init (TagReaderClass *klass)
@@ -101,16 +171,34 @@ tag_reader_class_init (TagReaderClass *klass)
     object_class->finalize = tag_reader_finalize;
 
     av_register_all();
+
+#ifdef USE_TAG_READER_AVCODEC
+    av_lockmgr_register (tag_reader_av_lock);
+#endif
 }
 
 static void
 tag_reader_init (TagReader *self)
 {
+    gchar *dir, *path;
+
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, TAG_READER_TYPE, TagReaderPrivate);
 
-    self->priv->job_queue = g_async_queue_new ();
+    self->priv->finished = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->priv->commit_mutex = g_mutex_new ();
+    self->priv->batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) tag_reader_free_batch);
+    self->priv->queued = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    self->priv->batched = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
     self->priv->run = TRUE;
 
+    dir = g_build_filename (g_get_user_cache_dir (), "gmediamp", NULL);
+    path = g_build_filename (dir, "stat-cache", NULL);
+    g_mkdir_with_parents (dir, 0755);
+    self->priv->stats = stat_cache_new (path);
+    g_free (dir);
+    g_free (path);
+
     self->priv->shell = NULL;
     self->priv->p = NULL;
 }
@@ -118,81 +206,230 @@ tag_reader_init (TagReader *self)
 TagReader*
 tag_reader_new (Shell *shell) {
     TagReader *self = g_object_new (TAG_READER_TYPE, NULL);
+    const gchar *threads = g_getenv ("GMEDIAMP_TAG_READERS");
 
     self->priv->shell = g_object_ref (shell);
 
-    self->priv->job_thread =
-        g_thread_create ((GThreadFunc) tag_reader_main, self, TRUE, NULL);
+    self->priv->pool = g_thread_pool_new ((GFunc) tag_reader_work, self,
+        1, FALSE, NULL);
+
+    // One reader per core unless told otherwise
+    tag_reader_set_num_threads (self, threads ? atoi (threads) : sysconf (_SC_NPROCESSORS_ONLN));
 
     return self;
 }
 
-gpointer
-tag_reader_main (TagReader *self)
+void
+tag_reader_set_num_threads (TagReader *self, gint num)
+{
+    g_thread_pool_set_max_threads (self->priv->pool, MAX (num, 1), NULL);
+}
+
+StatCache*
+tag_reader_get_stat_cache (TagReader *self)
+{
+    return self->priv->stats;
+}
+
+static void
+tag_reader_free_batch (GPtrArray *batch)
+{
+    g_ptr_array_foreach (batch, (GFunc) g_strfreev, NULL);
+    g_ptr_array_free (batch, TRUE);
+}
+
+static void
+tag_reader_batch (TagReader *self, gchar **kvs, const gchar *mtype)
 {
-    while (self->priv->run) {
-        QueueEntry *entry;
+    GPtrArray *batch = g_hash_table_lookup (self->priv->batches, mtype);
 
+    if (!batch) {
+        batch = g_ptr_array_new ();
+        g_hash_table_insert (self->priv->batches, g_strdup (mtype), batch);
+    }
+
+    g_ptr_array_add (batch, kvs);
+    self->priv->num_batched++;
+}
+
+static void
+tag_reader_flush (TagReader *self)
+{
+    GHashTableIter iter;
+    const gchar *mtype;
+    GPtrArray *batch;
+
+    g_hash_table_iter_init (&iter, self->priv->batches);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &mtype, (gpointer*) &batch)) {
+        shell_move_all_to (self->priv->shell, (gchar***) batch->pdata, batch->len, mtype);
+    }
+
+    g_hash_table_remove_all (self->priv->batches);
+    g_hash_table_remove_all (self->priv->batched);
+    self->priv->num_batched = 0;
+}
+
+static gchar**
+tag_reader_append_tag (gchar **kvs, const gchar *key, gchar *value)
+{
+    guint len = g_strv_length (kvs);
+
+    kvs = g_renew (gchar*, kvs, len + 3);
+    kvs[len] = g_strdup (key);
+    kvs[len + 1] = value;
+    kvs[len + 2] = NULL;
+
+    return kvs;
+}
+
+/*
+ * Reads the tags of a queued file on a reader thread. Files already in a
+ * library are skipped when they did not change since they were imported.
+ */
+static void
+tag_reader_read_entry (TagReader *self, QueueEntry *entry)
+{
+    struct stat st;
+    gchar *mtime = NULL, *old_mtime = NULL;
+
+    if (g_stat (entry->location, &st) == 0) {
+        entry->st = st;
+        entry->has_stat = TRUE;
+        mtime = g_strdup_printf ("%ld", (glong) st.st_mtime);
+        entry->known = shell_find_location (self->priv->shell, entry->location,
+            &entry->id, &old_mtime);
+    }
+
+    if (entry->known && !g_strcmp0 (mtime, old_mtime)) {
+        g_free (mtime);
+        g_free (old_mtime);
+        return;
+    }
+
+    g_free (old_mtime);
+
+    if (!(entry->kvs = tag_reader_get_tags (self, entry->location, &entry->has_video))) {
+        g_free (mtime);
+        return;
+    }
+
+    if (mtime) {
+        entry->kvs = tag_reader_append_tag (entry->kvs, "mtime", mtime);
+    }
+}
+
+// Hands a read file to its store, changed files update their entry in place
+static void
+tag_reader_commit_entry (TagReader *self, QueueEntry *entry)
+{
+    G_LOCK (queued);
+    g_hash_table_remove (self->priv->queued, entry->location);
+    G_UNLOCK (queued);
+
+    // Files that failed to read are remembered too, so they are not retried
+    if (entry->has_stat) {
+        stat_cache_set (self->priv->stats, entry->location, &entry->st,
+            entry->kvs || entry->known);
+    } else {
+        stat_cache_remove (self->priv->stats, entry->location);
+    }
+
+    if (!entry->kvs) {
+        return;
+    }
+
+    if (entry->known) {
+        media_store_update_entry (entry->known, entry->id, entry->kvs);
+        return;
+    }
+
+    if (g_hash_table_lookup (self->priv->batched, entry->location)) {
+        return;
+    }
+
+    g_hash_table_insert (self->priv->batched, g_strdup (entry->location), GINT_TO_POINTER (TRUE));
+
+    if (entry->mtype) {
+        tag_reader_batch (self, entry->kvs, entry->mtype);
+    } else {
+        tag_reader_batch (self, entry->kvs, entry->has_video ? "Movies" : "Music");
+    }
+
+    entry->kvs = NULL;
+}
+
+static void
+tag_reader_update_progress (TagReader *self)
+{
+    gchar *new_str;
+
+    if (self->priv->done == self->priv->total) {
         if (self->priv->p) {
-            if (g_async_queue_length (self->priv->job_queue) == 0) {
-                shell_remove_progress (self->priv->shell, self->priv->p);
-                g_object_unref (self->priv->p);
-                self->priv->p = NULL;
-                self->priv->total = 0;
-                self->priv->done = 0;
-            } else {
-                gchar *new_str = g_strdup_printf ("%d of %d",
-                    self->priv->done, self->priv->total);
-                progress_set_text (self->priv->p, new_str);
-                progress_set_percent (self->priv->p,
-                    (gdouble) self->priv->done / (gdouble) self->priv->total);
-                g_free (new_str);
-            }
+            shell_remove_progress (self->priv->shell, self->priv->p);
+            g_object_unref (self->priv->p);
+            self->priv->p = NULL;
         }
 
-        entry = g_async_queue_pop (self->priv->job_queue);
+        stat_cache_save (self->priv->stats);
 
-        if (!entry || !self->priv->run)
-            continue;
+        self->priv->total = 0;
+        self->priv->done = 0;
+        return;
+    }
 
-        if (!self->priv->p) {
-            self->priv->p = progress_new ("Importing...");
-            shell_add_progress (self->priv->shell, self->priv->p);
-            gchar *new_str = g_strdup_printf ("%d of %d", self->priv->done, self->priv->total);
-            progress_set_text (self->priv->p, new_str);
-            progress_set_percent (self->priv->p,
-                (gdouble) self->priv->done / (gdouble) self->priv->total);
-            g_free (new_str);
-        }
+    if (!self->priv->p) {
+        self->priv->p = progress_new ("Importing...");
+        shell_add_progress (self->priv->shell, self->priv->p);
+    }
 
-        gboolean has_video;
-        gchar **kvs = tag_reader_get_tags (self, entry->location, &has_video);
-
-        if (kvs) {
-            if (entry->mtype) {
-                shell_move_to (self->priv->shell, kvs, entry->mtype);
-            } else {
-                if (has_video) {
-                    shell_move_to (self->priv->shell, kvs, "Movies");
-                } else {
-                    shell_move_to (self->priv->shell, kvs, "Music");
-                }
-            }
+    new_str = g_strdup_printf ("%d of %d", self->priv->done, self->priv->total);
+    progress_set_text (self->priv->p, new_str);
+    progress_set_percent (self->priv->p,
+        (gdouble) self->priv->done / (gdouble) self->priv->total);
+    g_free (new_str);
+}
 
-            g_strfreev (kvs);
-            kvs = NULL;
-        }
+/*
+ * Runs on the reader threads. Files are read in any order, but results are
+ * committed in queue order by whichever reader completes the next one, so
+ * stores see the same adds whatever the number of readers.
+ */
+static void
+tag_reader_work (gpointer data, TagReader *self)
+{
+    QueueEntry *entry = data;
 
-        if (entry->location) {
-            g_free (entry->location);
-        }
-        if (entry->mtype) {
-            g_free (entry->mtype);
+    if (self->priv->run) {
+        tag_reader_read_entry (self, entry);
+    }
+
+    g_mutex_lock (self->priv->commit_mutex);
+
+    g_hash_table_insert (self->priv->finished, GUINT_TO_POINTER (entry->seq), entry);
+
+    while ((entry = g_hash_table_lookup (self->priv->finished,
+                GUINT_TO_POINTER (self->priv->next_commit)))) {
+        g_hash_table_remove (self->priv->finished, GUINT_TO_POINTER (self->priv->next_commit));
+        self->priv->next_commit++;
+
+        if (self->priv->run) {
+            tag_reader_commit_entry (self, entry);
         }
-        g_free (entry);
+        tag_reader_free_job (entry);
 
         self->priv->done++;
     }
+
+    if (self->priv->run) {
+        if (self->priv->num_batched >= TAG_READER_BATCH ||
+            self->priv->next_commit == self->priv->next_seq) {
+            tag_reader_flush (self);
+        }
+
+        tag_reader_update_progress (self);
+    }
+
+    g_mutex_unlock (self->priv->commit_mutex);
 }
 
 void
@@ -200,20 +437,66 @@ tag_reader_queue_entry (TagReader *self,
                         const gchar *location,
                         const gchar *media_type)
 {
-    QueueEntry *qe = g_new0 (QueueEntry, 1);
+    struct stat st;
+
+    if (g_stat (location, &st) == 0) {
+        tag_reader_queue_file (self, location, &st, media_type);
+    } else {
+        tag_reader_queue_file (self, location, NULL, media_type);
+    }
+}
+
+/*
+ * Queues a file the caller already stat'ed. Files matching the stat cache are
+ * dropped without being read, unless they were media files that have since
+ * left the library. While the libraries load that cannot be told yet, and
+ * the file is left to the reader, which waits for them.
+ */
+void
+tag_reader_queue_file (TagReader *self,
+                       const gchar *location,
+                       const struct stat *st,
+                       const gchar *media_type)
+{
+    QueueEntry *qe;
+    gboolean media;
+
+    if (st && stat_cache_lookup (self->priv->stats, location, st, &media) &&
+        (!media || (shell_is_loaded (self->priv->shell) &&
+            shell_find_location (self->priv->shell, location, NULL, NULL)))) {
+        return;
+    }
+
+    // The same file dropped twice is only read once
+    G_LOCK (queued);
+    if (g_hash_table_lookup (self->priv->queued, location)) {
+        G_UNLOCK (queued);
+        return;
+    }
+    g_hash_table_insert (self->priv->queued, g_strdup (location), GINT_TO_POINTER (TRUE));
+    G_UNLOCK (queued);
+
+    qe = g_new0 (QueueEntry, 1);
 
     qe->location = g_strdup (location);
     if (media_type) {
         qe->mtype = g_strdup (media_type);
     }
 
-    g_async_queue_push (self->priv->job_queue, qe);
-
+    g_mutex_lock (self->priv->commit_mutex);
+    qe->seq = self->priv->next_seq++;
     self->priv->total++;
+    g_mutex_unlock (self->priv->commit_mutex);
+
+    g_thread_pool_push (self->priv->pool, qe, NULL);
 }
 
 #ifdef USE_TAG_READER_AVCODEC
 #include <libavformat/avformat.h>
+
+// Bounds on what av_find_stream_info reads of files without a header length
+#define TAG_READER_PROBESIZE (256 * 1024)
+#define TAG_READER_ANALYZE_DURATION (2 * AV_TIME_BASE)
 struct AVMetadata {
     int count;
     AVMetadataTag *elems;
@@ -223,7 +506,12 @@ gchar**
 tag_reader_av_get_tags (TagReader *self, const gchar *location, gboolean *has_video)
 {
     AVFormatContext *fmt_ctx;
-    gint i, j;
+    const gchar *method;
+    gint i, j, duration = 0;
+
+    // Stream types are known once the header is read, only the length may
+    // need frames to be looked at
+    method = tag_parser_read_duration (location, &duration);
 
     if (av_open_input_file (&fmt_ctx, location, NULL, 0, NULL) != 0) {
         return NULL;
@@ -234,9 +522,19 @@ tag_reader_av_get_tags (TagReader *self, const gchar *location, gboolean *has_vi
         return NULL;
     }
 
-    if (av_find_stream_info (fmt_ctx) < 0) {
-        av_close_input_file (fmt_ctx);
-        return NULL;
+    if (!method) {
+        fmt_ctx->probesize = TAG_READER_PROBESIZE;
+        fmt_ctx->max_analyze_duration = TAG_READER_ANALYZE_DURATION;
+
+        if (av_find_stream_info (fmt_ctx) < 0) {
+            av_close_input_file (fmt_ctx);
+            return NULL;
+        }
+
+        if (fmt_ctx->duration != AV_NOPTS_VALUE) {
+            duration = fmt_ctx->duration / AV_TIME_BASE;
+        }
+        method = "probe";
     }
 
     if (has_video) {
@@ -250,7 +548,7 @@ tag_reader_av_get_tags (TagReader *self, const gchar *location, gboolean *has_vi
     }
 
     AVMetadata *md = fmt_ctx->metadata;
-    gint count = md ? 2 * md->count + 7 : 7;
+    gint count = md ? 2 * md->count + 9 : 9;
 
     gchar **tags = g_new0 (gchar*, count);
     gboolean has_title = FALSE;
@@ -262,6 +560,12 @@ tag_reader_av_get_tags (TagReader *self, const gchar *location, gboolean *has_vi
             tags[2*i] = g_ascii_strdown (md->elems[i].key, -1);
             tags[2*i+1] = g_strdup (md->elems[i].value);
 
+            // Store the track under the integer tag Entry knows about
+            if (!g_strcmp0 (tags[2*i], "track")) {
+                g_free (tags[2*i]);
+                tags[2*i] = g_strdup ("tracknumber");
+            }
+
             if (!g_strcmp0 (tags[2*i], "title")) {
                 has_title = TRUE;
             }
@@ -269,9 +573,11 @@ tag_reader_av_get_tags (TagReader *self, const gchar *location, gboolean *has_vi
     }
 
     tags[2*i] = g_strdup ("duration");
-    tags[2*i+1] = g_strdup_printf ("%d", (gint) (fmt_ctx->duration / AV_TIME_BASE));
+    tags[2*i+1] = g_strdup_printf ("%d", duration);
     tags[2*i+2] = g_strdup ("location");
     tags[2*i+3] = g_strdup (location);
+    tags[2*i+4] = g_strdup ("durationmethod");
+    tags[2*i+5] = g_strdup (method);
 
     // If the file does not have a title field, lets make one up
     if (!has_title) {
@@ -285,17 +591,32 @@ tag_reader_av_get_tags (TagReader *self, const gchar *location, gboolean *has_vi
             }
         }
 
-        tags[2*i+4] = g_strdup ("title");
-        tags[2*i+5] = title;
+        tags[2*i+6] = g_strdup ("title");
+        tags[2*i+7] = title;
     }
 
     return tags;
 }
 #endif
 
+/*
+ * Common audio formats are read from their headers by the native parsers,
+ * avformat handles the rest. GMEDIAMP_NATIVE_TAGS=0 sends everything through
+ * avformat, to compare the two.
+ */
 gchar**
 tag_reader_get_tags (TagReader *self, const gchar *location, gboolean *has_video)
 {
+    const gchar *native = g_getenv ("GMEDIAMP_NATIVE_TAGS");
+    gchar **tags;
+
+    if ((!native || atoi (native)) && (tags = tag_parser_read (location))) {
+        if (has_video) {
+            *has_video = FALSE;
+        }
+        return tags;
+    }
+
 #ifdef USE_TAG_READER_AVCODEC
     return tag_reader_av_get_tags (self, location, has_video);
 #else
@@ -24,6 +24,8 @@
 
 #include <glib-object.h>
 
+#include "stat-cache.h"
+
 #define TAG_READER_TYPE (tag_reader_get_type ())
 #define TAG_READER(object) (G_TYPE_CHECK_INSTANCE_CAST ((object), TAG_READER_TYPE, TagReader))
 #define TAG_READER_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), TAG_READER_TYPE, TagReaderClass))
@@ -49,9 +51,13 @@ struct _TagReaderClass {
 
 GType tag_reader_get_type (void);
 TagReader *tag_reader_new (Shell *shell);
+void tag_reader_set_num_threads (TagReader *self, gint num);
+StatCache *tag_reader_get_stat_cache (TagReader *self);
 
 gchar **tag_reader_get_tags (TagReader *self, const gchar *location, gboolean *has_video);
 void tag_reader_queue_entry (TagReader *self, const gchar *location, const gchar *media_type);
+void tag_reader_queue_file (TagReader *self, const gchar *location,
+    const struct stat *st, const gchar *media_type);
 
 G_END_DECLS
 
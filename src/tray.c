@@ -239,7 +239,9 @@ tray_state_changed (Player *player, gint state, Tray *self)
         self->priv->note = notify_notification_new_with_status_icon (
             "Now Playing", body, NULL, self->priv->icon);
 
-        self->priv->img = gdk_pixbuf_new_from_file_at_scale (entry_get_art (e), 50, 50, TRUE, NULL);
+        gchar *art = entry_get_art (e);
+        self->priv->img = gdk_pixbuf_new_from_file_at_scale (art, 50, 50, TRUE, NULL);
+        g_free (art);
 
         if (self->priv->img) {
             notify_notification_set_icon_from_pixbuf (self->priv->note, self->priv->img);